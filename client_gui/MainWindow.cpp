@@ -4,39 +4,55 @@
  */
 
 #include "MainWindow.h"
+#include "MessageDelegate.h"
+#include "MessageModel.h"
 #include "SocketClient.h"
 #include "ShmClient.h"
 #include "common.h"
 #include <QVBoxLayout>
 #include <QHBoxLayout>
 #include <QGroupBox>
+#include <QListView>
 #include <QMessageBox>
 #include <QScrollBar>
 #include <QTime>
+#include <QTimer>
+
+constexpr int RENDER_INTERVAL_MS = 16;   // Received messages reach the view once per frame
 
 MainWindow::MainWindow(QWidget* parent)
-    : QMainWindow(parent), currentMode(SOCKET_MODE) {
+    : QMainWindow(parent), currentMode(SOCKET_MODE), incoming(CHAT_SCROLLBACK) {
     
     socketClient = std::make_unique<SocketClient>(this);
     shmClient = std::make_unique<ShmClient>(this);
     
     setupUi();
     
+    // Received messages are queued on whichever thread the client emits
+    // from (direct connection) and rendered in batches by renderTimer
     connect(socketClient.get(), &SocketClient::messageReceived,
-            this, &MainWindow::onMessageReceived);
+            this, &MainWindow::onMessageReceived, Qt::DirectConnection);
     connect(socketClient.get(), &SocketClient::userListUpdated,
             this, &MainWindow::onUserListUpdated);
+    connect(socketClient.get(), &SocketClient::presenceChanged,
+            this, &MainWindow::onPresenceChanged);
+    connect(socketClient.get(), &SocketClient::roomLeft,
+            this, &MainWindow::onRoomLeft);
     connect(socketClient.get(), &SocketClient::connectionStatusChanged,
             this, &MainWindow::onConnectionStatusChanged);
     connect(socketClient.get(), &SocketClient::errorOccurred,
             this, &MainWindow::onErrorOccurred);
     
     connect(shmClient.get(), &ShmClient::messageReceived,
-            this, &MainWindow::onMessageReceived);
+            this, &MainWindow::onMessageReceived, Qt::DirectConnection);
     connect(shmClient.get(), &ShmClient::connectionStatusChanged,
             this, &MainWindow::onConnectionStatusChanged);
     connect(shmClient.get(), &ShmClient::errorOccurred,
             this, &MainWindow::onErrorOccurred);
+    
+    renderTimer = new QTimer(this);
+    connect(renderTimer, &QTimer::timeout, this, &MainWindow::renderIncoming);
+    renderTimer->start(RENDER_INTERVAL_MS);
 }
 
 MainWindow::~MainWindow() {
@@ -59,9 +75,15 @@ void MainWindow::setupUi() {
     
     QVBoxLayout* leftLayout = new QVBoxLayout();
     
-    chatDisplay = new QTextEdit(this);
-    chatDisplay->setReadOnly(true);
-    leftLayout->addWidget(chatDisplay);
+    // Virtualized: only visible rows are laid out and painted
+    messageModel = new MessageModel(this);
+    chatView = new QListView(this);
+    chatView->setModel(messageModel);
+    chatView->setItemDelegate(new MessageDelegate(chatView));
+    chatView->setUniformItemSizes(true);
+    chatView->setSelectionMode(QAbstractItemView::NoSelection);
+    chatView->setVerticalScrollMode(QAbstractItemView::ScrollPerPixel);
+    leftLayout->addWidget(chatView);
     
     QHBoxLayout* inputLayout = new QHBoxLayout();
     messageInput = new QLineEdit(this);
@@ -192,6 +214,9 @@ void MainWindow::onDisconnectClicked() {
     modeSelector->setEnabled(true);
     usernameInput->setEnabled(true);
     usersList->clear();
+    presenceSeqs.clear();
+    shownRoom.clear();
+    renderIncoming(); // Whatever arrived before the disconnect
 }
 
 void MainWindow::onSendClicked() {
@@ -200,26 +225,69 @@ void MainWindow::onSendClicked() {
         return;
     }
     
+    char now[MAX_TIMESTAMP_LEN];
     if (currentMode == SOCKET_MODE && socketClient->isConnected()) {
         socketClient->sendMessage(message);
-        addMessageToChat(usernameInput->text(), QString::fromStdString(get_timestamp()), message);
+        addMessageToChat(usernameInput->text(), QString::fromLatin1(now, get_timestamp(now)), message);
     } else if (currentMode == SHM_MODE && shmClient->isConnected()) {
         shmClient->sendMessage(message);
-        addMessageToChat(usernameInput->text(), QString::fromStdString(get_timestamp()), message);
+        addMessageToChat(usernameInput->text(), QString::fromLatin1(now, get_timestamp(now)), message);
     }
     
     messageInput->clear();
 }
 
+// Runs on the client's receive thread; must not touch widgets
 void MainWindow::onMessageReceived(QString user, QString time, QString text) {
-    addMessageToChat(user, time, text);
+    incoming.push(ChatEntry{std::move(user), std::move(time), std::move(text)});
 }
 
-void MainWindow::onUserListUpdated(QStringList users) {
+// Versions are per room on the server, so each room keeps its own
+// sequence; the list shows the room of the latest snapshot
+void MainWindow::onUserListUpdated(QString room, QStringList users, quint64 seq) {
+    presenceSeqs[room].reset(seq);
+    shownRoom = room;
     usersList->clear();
     usersList->addItems(users);
 }
 
+// Apply one presence delta in place; a missed delta costs one resync
+void MainWindow::onPresenceChanged(QString room, QString user, bool added, quint64 seq) {
+    auto it = presenceSeqs.find(room);
+    if (it == presenceSeqs.end()) {
+        return; // No snapshot of that room yet
+    }
+    switch (it->accept(seq)) {
+    case PresenceSequence::Result::APPLY:
+        break;
+    case PresenceSequence::Result::GAP:
+        socketClient->requestResync(room);
+        return;
+    case PresenceSequence::Result::STALE:
+        return;
+    }
+
+    if (room != shownRoom) {
+        return;
+    }
+    if (added) {
+        usersList->addItem(user);
+        return;
+    }
+    QList<QListWidgetItem*> items = usersList->findItems(user, Qt::MatchExactly);
+    if (!items.isEmpty()) {
+        delete usersList->takeItem(usersList->row(items.first()));
+    }
+}
+
+void MainWindow::onRoomLeft(QString room) {
+    presenceSeqs.remove(room);
+    if (room == shownRoom) {
+        shownRoom.clear();
+        usersList->clear();
+    }
+}
+
 void MainWindow::onConnectionStatusChanged(bool connected) {
     if (connected) {
         statusLabel->setText("Status: Connected");
@@ -240,15 +308,23 @@ void MainWindow::onErrorOccurred(QString error) {
 }
 
 void MainWindow::addMessageToChat(const QString& user, const QString& time, const QString& text) {
-    QString html = QString("<div style='margin: 5px 0;'>"
-                          "<b style='color: #0066cc;'>%1</b> "
-                          "<span style='color: #666; font-size: 10px;'>%2</span><br>"
-                          "<span>%3</span>"
-                          "</div>")
-                   .arg(user, time, text.toHtmlEscaped());
-    
-    chatDisplay->append(html);
+    incoming.push(ChatEntry{user, time, text});
+}
+
+// Once per frame: move everything received since the last frame into the
+// model in one update, following the newest message unless the user has
+// scrolled up
+void MainWindow::renderIncoming() {
+    renderBatch.clear();
+    incoming.take(renderBatch);
+    if (renderBatch.empty()) {
+        return;
+    }
     
-    QScrollBar* scrollBar = chatDisplay->verticalScrollBar();
-    scrollBar->setValue(scrollBar->maximum());
+    QScrollBar* scrollBar = chatView->verticalScrollBar();
+    bool following = scrollBar->value() >= scrollBar->maximum();
+    messageModel->appendBatch(renderBatch);
+    if (following) {
+        chatView->scrollToBottom();
+    }
 }
@@ -0,0 +1,63 @@
+/*
+ * MIT License
+ * Painter for chat view rows
+ */
+
+#include "MessageDelegate.h"
+#include "MessageModel.h"
+#include <QStyle>
+#include <QFontMetrics>
+#include <QPainter>
+
+namespace {
+
+constexpr int ROW_PADDING = 5;
+
+} // namespace
+
+MessageDelegate::MessageDelegate(QObject* parent) : QStyledItemDelegate(parent) {}
+
+void MessageDelegate::paint(QPainter* painter, const QStyleOptionViewItem& option,
+                            const QModelIndex& index) const {
+    painter->save();
+    if (option.state & QStyle::State_Selected) {
+        painter->fillRect(option.rect, option.palette.highlight());
+    }
+
+    QRect area = option.rect.adjusted(ROW_PADDING, ROW_PADDING, -ROW_PADDING, -ROW_PADDING);
+    QFont boldFont = option.font;
+    boldFont.setBold(true);
+    QFont smallFont = option.font;
+    smallFont.setPointSizeF(option.font.pointSizeF() * 0.8);
+    QFontMetrics boldMetrics(boldFont);
+    QFontMetrics metrics(option.font);
+
+    QString user = index.data(MessageModel::UserRole).toString();
+    QString time = index.data(MessageModel::TimeRole).toString();
+    QString text = index.data(MessageModel::TextRole).toString();
+
+    // Header: user in bold blue, then the time in small grey
+    painter->setFont(boldFont);
+    painter->setPen(QColor(0x00, 0x66, 0xcc));
+    QString elidedUser = boldMetrics.elidedText(user, Qt::ElideRight, area.width() / 2);
+    painter->drawText(area.left(), area.top() + boldMetrics.ascent(), elidedUser);
+
+    painter->setFont(smallFont);
+    painter->setPen(QColor(0x66, 0x66, 0x66));
+    painter->drawText(area.left() + boldMetrics.horizontalAdvance(elidedUser) + ROW_PADDING,
+                      area.top() + boldMetrics.ascent(), time);
+
+    // Body: one line, elided
+    painter->setFont(option.font);
+    painter->setPen(option.palette.color(QPalette::Text));
+    painter->drawText(area.left(), area.top() + boldMetrics.height() + metrics.ascent(),
+                      metrics.elidedText(text, Qt::ElideRight, area.width()));
+    painter->restore();
+}
+
+QSize MessageDelegate::sizeHint(const QStyleOptionViewItem& option, const QModelIndex&) const {
+    QFont boldFont = option.font;
+    boldFont.setBold(true);
+    int height = QFontMetrics(boldFont).height() + QFontMetrics(option.font).height();
+    return QSize(option.rect.width(), height + 2 * ROW_PADDING);
+}
@@ -0,0 +1,25 @@
+/*
+ * MIT License
+ * Painter for chat view rows
+ */
+
+#ifndef MESSAGE_DELEGATE_H
+#define MESSAGE_DELEGATE_H
+
+#include <QStyledItemDelegate>
+
+// Paints a message as a header line (user, time) over one elided line of
+// text. Every row has the same height, so the view can use uniform item
+// sizes and never measures rows that are not on screen.
+class MessageDelegate : public QStyledItemDelegate {
+    Q_OBJECT
+
+public:
+    explicit MessageDelegate(QObject* parent = nullptr);
+
+    void paint(QPainter* painter, const QStyleOptionViewItem& option,
+               const QModelIndex& index) const override;
+    QSize sizeHint(const QStyleOptionViewItem& option, const QModelIndex& index) const override;
+};
+
+#endif // MESSAGE_DELEGATE_H
@@ -0,0 +1,64 @@
+/*
+ * MIT License
+ * Chat history model with a bounded scrollback
+ */
+
+#include "MessageModel.h"
+
+MessageModel::MessageModel(QObject* parent, size_t capacity)
+    : QAbstractListModel(parent), lines(capacity) {}
+
+int MessageModel::rowCount(const QModelIndex& parent) const {
+    return parent.isValid() ? 0 : static_cast<int>(lines.size());
+}
+
+QVariant MessageModel::data(const QModelIndex& index, int role) const {
+    if (!index.isValid() || index.row() < 0 || static_cast<size_t>(index.row()) >= lines.size()) {
+        return QVariant();
+    }
+
+    const ChatEntry& entry = lines.at(index.row());
+    switch (role) {
+    case Qt::DisplayRole:
+        return QString("%1 [%2] %3").arg(entry.user, entry.time, entry.text);
+    case UserRole:
+        return entry.user;
+    case TimeRole:
+        return entry.time;
+    case TextRole:
+    case Qt::ToolTipRole:
+        return entry.text;
+    default:
+        return QVariant();
+    }
+}
+
+void MessageModel::appendBatch(std::vector<ChatEntry>& batch) {
+    // Of a batch larger than the scrollback only the newest part survives
+    size_t first = batch.size() > lines.capacity() ? batch.size() - lines.capacity() : 0;
+    size_t incoming = batch.size() - first;
+    if (incoming == 0) {
+        return;
+    }
+
+    size_t overflow = lines.size() + incoming > lines.capacity()
+        ? lines.size() + incoming - lines.capacity() : 0;
+    if (overflow > 0) {
+        beginRemoveRows(QModelIndex(), 0, static_cast<int>(overflow) - 1);
+        lines.popFront(overflow);
+        endRemoveRows();
+    }
+
+    int row = static_cast<int>(lines.size());
+    beginInsertRows(QModelIndex(), row, row + static_cast<int>(incoming) - 1);
+    for (size_t i = first; i < batch.size(); i++) {
+        lines.push(std::move(batch[i]));
+    }
+    endInsertRows();
+}
+
+void MessageModel::clear() {
+    beginResetModel();
+    lines.popFront(lines.size());
+    endResetModel();
+}
@@ -0,0 +1,48 @@
+/*
+ * MIT License
+ * Chat history model with a bounded scrollback
+ */
+
+#ifndef MESSAGE_MODEL_H
+#define MESSAGE_MODEL_H
+
+#include "MessagePipeline.h"
+#include <QAbstractListModel>
+#include <QString>
+#include <vector>
+
+constexpr size_t CHAT_SCROLLBACK = 5000;   // Messages kept in the view
+
+struct ChatEntry {
+    QString user;
+    QString time;
+    QString text;
+};
+
+// Messages shown in the chat view, newest last. Only the last
+// CHAT_SCROLLBACK are kept, so memory stays flat in a busy room, and the
+// view only ever lays out the rows on screen.
+class MessageModel : public QAbstractListModel {
+    Q_OBJECT
+
+public:
+    enum Role {
+        UserRole = Qt::UserRole + 1,
+        TimeRole,
+        TextRole
+    };
+
+    explicit MessageModel(QObject* parent = nullptr, size_t capacity = CHAT_SCROLLBACK);
+
+    int rowCount(const QModelIndex& parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const override;
+
+    // One remove and one insert notification for the whole batch
+    void appendBatch(std::vector<ChatEntry>& batch);
+    void clear();
+
+private:
+    ScrollbackRing<ChatEntry> lines;
+};
+
+#endif // MESSAGE_MODEL_H
@@ -0,0 +1,98 @@
+/*
+ * MIT License
+ * Receive-side batching and bounded scrollback for the chat view
+ */
+
+#ifndef MESSAGE_PIPELINE_H
+#define MESSAGE_PIPELINE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// Fixed-capacity ring that keeps the newest items; pushing into a full
+// ring overwrites the oldest. Index 0 is the oldest item.
+template <typename T>
+class ScrollbackRing {
+public:
+    explicit ScrollbackRing(size_t capacity) : items(capacity), head(0), count(0) {}
+
+    size_t size() const { return count; }
+    size_t capacity() const { return items.size(); }
+    bool empty() const { return count == 0; }
+
+    const T& at(size_t i) const { return items[(head + i) % items.size()]; }
+
+    // Returns true if the oldest item was evicted to make room
+    bool push(T value) {
+        if (count < items.size()) {
+            items[(head + count) % items.size()] = std::move(value);
+            count++;
+            return false;
+        }
+        items[head] = std::move(value);
+        head = (head + 1) % items.size();
+        return true;
+    }
+
+    // Discard the n oldest items
+    void popFront(size_t n) {
+        n = n < count ? n : count;
+        head = (head + n) % items.size();
+        count -= n;
+    }
+
+    // Move everything out, oldest first, and empty the ring
+    void drain(std::vector<T>& out) {
+        out.reserve(out.size() + count);
+        for (size_t i = 0; i < count; i++) {
+            out.push_back(std::move(items[(head + i) % items.size()]));
+        }
+        head = 0;
+        count = 0;
+    }
+
+private:
+    std::vector<T> items;
+    size_t head;
+    size_t count;
+};
+
+// Hand-off from receive threads to the UI thread. Producers push parsed
+// messages as they arrive; the UI takes everything pending once per frame,
+// so it does one model update per frame rather than per message. Pending
+// messages are bounded like the scrollback: if the UI falls behind, the
+// oldest are dropped, as they would scroll out of the view anyway.
+template <typename T>
+class BatchQueue {
+public:
+    explicit BatchQueue(size_t limit) : pending(limit) {}
+
+    // Thread-safe
+    void push(T value) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (pending.push(std::move(value))) {
+            dropped++;
+        }
+    }
+
+    // Thread-safe; appends the pending batch to out, oldest first
+    void take(std::vector<T>& out) {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.drain(out);
+    }
+
+    uint64_t droppedCount() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return dropped;
+    }
+
+private:
+    std::mutex mutex;
+    ScrollbackRing<T> pending;
+    uint64_t dropped = 0;
+};
+
+#endif // MESSAGE_PIPELINE_H
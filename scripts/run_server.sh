@@ -5,7 +5,8 @@ PORT=5000
 
 if [ ! -z "$1" ]; then
     PORT=$1
+    shift
 fi
 
 echo "Starting chat server on port $PORT..."
-./build/server/chat_server --port $PORT
+./build/server/chat_server --port $PORT "$@"
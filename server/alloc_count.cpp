@@ -0,0 +1,38 @@
+/*
+ * MIT License
+ * Heap allocation counting for the socket server
+ */
+
+#include "alloc_count.h"
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+thread_local uint64_t allocations = 0;
+
+} // namespace
+
+uint64_t thread_heap_allocations() {
+    return allocations;
+}
+
+// The array, nothrow and sized forms all end up here. Over-aligned types
+// keep the library's aligned new, uncounted; only the long-lived workers
+// and their queues are over-aligned.
+void* operator new(std::size_t size) {
+    allocations++;
+    void* p = std::malloc(size ? size : 1);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
@@ -0,0 +1,16 @@
+/*
+ * MIT License
+ * Heap allocation counting for the socket server
+ */
+
+#ifndef ALLOC_COUNT_H
+#define ALLOC_COUNT_H
+
+#include <cstdint>
+
+// operator new calls made by the calling thread so far. The server replaces
+// the global operator new with one that counts per thread before calling
+// malloc, so a worker can report how many allocations its loop makes.
+uint64_t thread_heap_allocations();
+
+#endif // ALLOC_COUNT_H
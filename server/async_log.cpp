@@ -0,0 +1,167 @@
+/*
+ * MIT License
+ * Asynchronous server log
+ */
+
+#include "async_log.h"
+#include <sys/eventfd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+namespace {
+
+void write_all(int fd, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t n = ::write(fd, data, length);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return;
+        }
+        data += n;
+        length -= n;
+    }
+}
+
+} // namespace
+
+AsyncLogger& server_logger() {
+    static AsyncLogger logger;
+    return logger;
+}
+
+AsyncLogger::AsyncLogger() : slots(new Slot[LOG_RING_CAPACITY]) {
+    for (size_t i = 0; i < LOG_RING_CAPACITY; i++) {
+        slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+AsyncLogger::~AsyncLogger() {
+    stop();
+    delete[] slots;
+}
+
+bool AsyncLogger::start() {
+    wake_fd = eventfd(0, EFD_CLOEXEC);
+    if (wake_fd == -1) {
+        return false;
+    }
+    running = true;
+    writer = std::thread(&AsyncLogger::run_writer, this);
+    return true;
+}
+
+void AsyncLogger::stop() {
+    if (!writer.joinable()) {
+        return;
+    }
+    stopping = true;
+    uint64_t one = 1;
+    ssize_t ignored = ::write(wake_fd, &one, sizeof(one));
+    (void)ignored;
+    writer.join();
+    running = false;
+    drain(); // Lines that raced with the shutdown
+    close(wake_fd);
+    wake_fd = -1;
+    if (dropped() > 0) {
+        log_err() << "[SERVER] Log ring overflowed, dropped " << dropped() << " lines\n";
+    }
+}
+
+void AsyncLogger::write(int fd, const char* text, size_t length) {
+    if (!running.load(std::memory_order_acquire)) {
+        write_all(fd, text, length);
+        return;
+    }
+    if (!push(fd, text, length)) {
+        dropped_lines.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    // Only the first line after a drain pays for the eventfd write
+    if (!wake_pending.exchange(true)) {
+        uint64_t one = 1;
+        ssize_t ignored = ::write(wake_fd, &one, sizeof(one));
+        (void)ignored;
+    }
+}
+
+// Bounded MPSC ring: each slot's sequence says whether it is free for the
+// producer at a position or holds a line for the consumer
+bool AsyncLogger::push(int fd, const char* text, size_t length) {
+    uint64_t pos = enqueue_pos.load(std::memory_order_relaxed);
+    Slot* slot;
+    for (;;) {
+        slot = &slots[pos & (LOG_RING_CAPACITY - 1)];
+        uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+        int64_t diff = static_cast<int64_t>(sequence - pos);
+        if (diff == 0) {
+            if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false; // Full
+        } else {
+            pos = enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+    slot->fd = fd;
+    slot->length = static_cast<uint32_t>(length);
+    std::memcpy(slot->text, text, length);
+    slot->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+void AsyncLogger::run_writer() {
+    while (!stopping.load()) {
+        uint64_t count;
+        ssize_t ignored = read(wake_fd, &count, sizeof(count));
+        (void)ignored;
+
+        // Let the burst that woke us build up, so it goes out in one write
+        // and its producers skip the eventfd meanwhile
+        std::this_thread::sleep_for(LOG_FLUSH_DELAY);
+
+        // Clear before draining so a concurrent line either lands in this
+        // drain or triggers a fresh wakeup
+        wake_pending.store(false);
+        drain();
+    }
+    drain();
+}
+
+// Copy out consecutive lines for the same stream and write them together
+void AsyncLogger::drain() {
+    static thread_local std::string batch;
+    int batch_fd = -1;
+    for (;;) {
+        Slot& slot = slots[dequeue_pos & (LOG_RING_CAPACITY - 1)];
+        if (slot.sequence.load(std::memory_order_acquire) != dequeue_pos + 1) {
+            break;
+        }
+        if (slot.fd != batch_fd && !batch.empty()) {
+            write_all(batch_fd, batch.data(), batch.size());
+            batch.clear();
+        }
+        batch_fd = slot.fd;
+        batch.append(slot.text, slot.length);
+        slot.sequence.store(dequeue_pos + LOG_RING_CAPACITY, std::memory_order_release);
+        dequeue_pos++;
+    }
+    if (!batch.empty()) {
+        write_all(batch_fd, batch.data(), batch.size());
+        batch.clear();
+    }
+}
+
+LogLine::~LogLine() {
+    if (truncated) {
+        length = std::min(length, LOG_LINE_MAX - 4);
+        std::memcpy(buffer + length, "...\n", 4);
+        length += 4;
+    }
+    server_logger().write(fd, buffer, length);
+}
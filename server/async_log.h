@@ -0,0 +1,116 @@
+/*
+ * MIT License
+ * Asynchronous server log
+ */
+
+#ifndef ASYNC_LOG_H
+#define ASYNC_LOG_H
+
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <unistd.h>
+
+constexpr size_t LOG_LINE_MAX = 496;        // Longer lines are truncated
+constexpr size_t LOG_RING_CAPACITY = 4096;  // Lines buffered; a power of two
+constexpr std::chrono::microseconds LOG_FLUSH_DELAY{2000};  // Batching delay after a wakeup
+
+// Server log lines go through a bounded lock-free ring to a writer thread,
+// so a thread that logs never blocks on the terminal or a pipe and never
+// serializes with other loggers on a stream lock. When the ring is full
+// the line is dropped and counted. Before start() and after stop(), lines
+// are written directly.
+class AsyncLogger {
+public:
+    AsyncLogger();
+    ~AsyncLogger();
+
+    AsyncLogger(const AsyncLogger&) = delete;
+    AsyncLogger& operator=(const AsyncLogger&) = delete;
+
+    bool start();
+    // Write out everything queued and stop the writer
+    void stop();
+
+    // Thread-safe; fd is STDOUT_FILENO or STDERR_FILENO
+    void write(int fd, const char* text, size_t length);
+
+    uint64_t dropped() const { return dropped_lines.load(std::memory_order_relaxed); }
+
+private:
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> sequence;
+        uint32_t length;
+        int fd;
+        char text[LOG_LINE_MAX];
+    };
+
+    Slot* slots;
+    alignas(64) std::atomic<uint64_t> enqueue_pos{0};
+    alignas(64) uint64_t dequeue_pos = 0;   // Writer thread only
+    std::atomic<uint64_t> dropped_lines{0};
+    std::atomic<bool> running{false};
+    std::atomic<bool> stopping{false};
+    std::atomic<bool> wake_pending{false};
+    int wake_fd = -1;
+    std::thread writer;
+
+    bool push(int fd, const char* text, size_t length);
+    void run_writer();
+    void drain();
+};
+
+// The server-wide logger
+AsyncLogger& server_logger();
+
+// One log line, formatted on the caller's stack and queued when it goes
+// out of scope: log_out() << "[SERVER] ..." << value << "\n";
+class LogLine {
+public:
+    explicit LogLine(int fd) : fd(fd) {}
+    ~LogLine();
+
+    LogLine(const LogLine&) = delete;
+    LogLine& operator=(const LogLine&) = delete;
+
+    LogLine& operator<<(std::string_view text) {
+        size_t room = LOG_LINE_MAX - length;
+        if (text.size() > room) {
+            truncated = true;
+        }
+        size_t n = text.size() < room ? text.size() : room;
+        text.copy(buffer + length, n);
+        length += n;
+        return *this;
+    }
+    LogLine& operator<<(const char* text) { return *this << std::string_view(text); }
+    LogLine& operator<<(const std::string& text) { return *this << std::string_view(text); }
+    LogLine& operator<<(char c) { return *this << std::string_view(&c, 1); }
+
+    template <typename T, std::enable_if_t<std::is_integral_v<T>, int> = 0>
+    LogLine& operator<<(T value) {
+        auto result = std::to_chars(buffer + length, buffer + LOG_LINE_MAX, value);
+        if (result.ec == std::errc()) {
+            length = result.ptr - buffer;
+        } else {
+            truncated = true;
+        }
+        return *this;
+    }
+
+private:
+    int fd;
+    size_t length = 0;
+    bool truncated = false;
+    char buffer[LOG_LINE_MAX];
+};
+
+inline LogLine log_out() { return LogLine(STDOUT_FILENO); }
+inline LogLine log_err() { return LogLine(STDERR_FILENO); }
+
+#endif // ASYNC_LOG_H
@@ -0,0 +1,103 @@
+/*
+ * MIT License
+ * Compressed binary frames for connections that negotiated them
+ */
+
+#include "compress.h"
+#include "chat_dictionary.h"
+#include "lz4_block.h"
+#include <zlib.h>
+
+uint8_t parse_compression(std::string_view requested) {
+    uint8_t codecs = COMPRESS_NONE;
+    while (!requested.empty()) {
+        size_t comma = requested.find(',');
+        std::string_view name = requested.substr(0, comma);
+        if (name == LZ4_COMPRESSION_NAME) {
+            codecs |= COMPRESS_LZ4;
+        } else if (name == DEFLATE_COMPRESSION_NAME) {
+            codecs |= COMPRESS_DEFLATE;
+        }
+        requested.remove_prefix(comma == std::string_view::npos ? requested.size() : comma + 1);
+    }
+    return codecs;
+}
+
+FrameRef compress_lz4(const Frame& binary) {
+    BinaryHeader header = decode_binary_header(binary.data());
+    if (header.length < LZ4_MIN_PAYLOAD || header.flags != 0) {
+        return FrameRef();
+    }
+
+    size_t offset = BINARY_HEADER_SIZE + COMPRESSED_LENGTH_SIZE;
+    FrameRef frame(Frame::allocate(offset + lz4::compress_bound(header.length), binary.is_notice()));
+    char* out = frame->buffer();
+    size_t packed = lz4::compress(binary.data() + BINARY_HEADER_SIZE, header.length, out + offset,
+                                  CHAT_DICTIONARY);
+    if (COMPRESSED_LENGTH_SIZE + packed >= header.length) {
+        return FrameRef();
+    }
+
+    store_le(out + BINARY_HEADER_SIZE, header.length, COMPRESSED_LENGTH_SIZE);
+    header.flags = BINARY_FLAG_LZ4;
+    header.length = static_cast<uint32_t>(COMPRESSED_LENGTH_SIZE + packed);
+    encode_binary_header(out, header);
+    frame->set_size(BINARY_HEADER_SIZE + header.length);
+    return frame;
+}
+
+ReplayBatcher::ReplayBatcher() : stream(std::make_unique<z_stream>()), ready(false) {}
+
+ReplayBatcher::~ReplayBatcher() {
+    if (ready) {
+        deflateEnd(stream.get());
+    }
+}
+
+void ReplayBatcher::add(BinaryType type, uint32_t user_id, uint64_t timestamp,
+                        std::string_view name, std::string_view room, std::string_view text) {
+    size_t at = raw.size();
+    raw.resize(at + binary_frame_size(name, room, text));
+    encode_binary_frame(&raw[at], type, user_id, timestamp, name, room, text);
+}
+
+FrameRef ReplayBatcher::finish() {
+    if (raw.empty()) {
+        return FrameRef();
+    }
+    z_stream* z = stream.get();
+    if (!ready) {
+        ready = deflateInit(z, REPLAY_DEFLATE_LEVEL) == Z_OK;
+    } else {
+        deflateReset(z);
+    }
+    if (!ready || deflateSetDictionary(z, reinterpret_cast<const Bytef*>(CHAT_DICTIONARY.data()),
+                                       static_cast<uInt>(CHAT_DICTIONARY.size())) != Z_OK) {
+        raw.clear();
+        return FrameRef();
+    }
+
+    size_t offset = BINARY_HEADER_SIZE + COMPRESSED_LENGTH_SIZE;
+    size_t bound = deflateBound(z, raw.size());
+    FrameRef frame(Frame::allocate(offset + bound));
+    char* out = frame->buffer();
+    z->next_in = reinterpret_cast<Bytef*>(raw.data());
+    z->avail_in = static_cast<uInt>(raw.size());
+    z->next_out = reinterpret_cast<Bytef*>(out + offset);
+    z->avail_out = static_cast<uInt>(bound);
+    int result = deflate(z, Z_FINISH);
+    size_t packed = bound - z->avail_out;
+    size_t length = raw.size();
+    raw.clear();
+    if (result != Z_STREAM_END) {
+        return FrameRef();
+    }
+
+    BinaryHeader header{};
+    header.length = static_cast<uint32_t>(COMPRESSED_LENGTH_SIZE + packed);
+    header.type = static_cast<uint8_t>(BinaryType::BATCH);
+    encode_binary_header(out, header);
+    store_le(out + BINARY_HEADER_SIZE, length, COMPRESSED_LENGTH_SIZE);
+    frame->set_size(BINARY_HEADER_SIZE + header.length);
+    return frame;
+}
@@ -0,0 +1,64 @@
+/*
+ * MIT License
+ * Compressed binary frames for connections that negotiated them
+ */
+
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include "frame.h"
+#include "wire_protocol.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+struct z_stream_s;
+
+// Codecs a connection accepts, as a bit set
+enum Compression : uint8_t {
+    COMPRESS_NONE = 0,
+    COMPRESS_LZ4 = 1,       // Large single frames
+    COMPRESS_DEFLATE = 2    // History replay in BATCH frames
+};
+
+// zlib level for replay batches. Replays are packed on the worker's
+// thread, and level 1 takes a third of the time of the default for about
+// 15% more output.
+constexpr int REPLAY_DEFLATE_LEVEL = 1;
+
+// Codecs named in a username line's "compress" field; unknown names are ignored
+uint8_t parse_compression(std::string_view requested);
+
+// LZ4 copy of a CHAT or CONTROL binary frame (see wire_protocol.h); empty
+// if its payload is under LZ4_MIN_PAYLOAD bytes or would not shrink
+FrameRef compress_lz4(const Frame& binary);
+
+// Packs binary frames into BATCH frames, each one zlib stream holding up
+// to REPLAY_BATCH_BYTES of them. One per worker: a replay is packed on the
+// worker's thread from start to finish, and the deflate state (about
+// 256 KB) is made on first use and reset, not rebuilt, for each batch.
+class ReplayBatcher {
+public:
+    ReplayBatcher();
+    ~ReplayBatcher();
+
+    // Append a frame as encode_binary_frame() would write it
+    void add(BinaryType type, uint32_t user_id, uint64_t timestamp, std::string_view name,
+             std::string_view room, std::string_view text);
+
+    bool full() const { return raw.size() >= REPLAY_BATCH_BYTES; }
+    bool empty() const { return raw.empty(); }
+    size_t pending() const { return raw.size(); }
+
+    // The appended frames as one BATCH frame; empty if there were none or
+    // zlib failed
+    FrameRef finish();
+
+private:
+    std::unique_ptr<z_stream_s> stream;
+    bool ready;
+    std::string raw;   // Frames not yet compressed
+};
+
+#endif // COMPRESS_H
@@ -0,0 +1,227 @@
+/*
+ * MIT License
+ * Immutable, reference-counted wire frames for broadcast fan-out
+ */
+
+#ifndef FRAME_H
+#define FRAME_H
+
+#include "block_pool.h"
+#include "wire_protocol.h"
+#include <sys/types.h>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <new>
+#include <string_view>
+#include <utility>
+
+// Bytes of a file sent with sendfile() instead of from memory. The owner
+// keeps the descriptor open while the frame is queued.
+struct FileRegion {
+    int fd;
+    off_t offset;
+    std::shared_ptr<const void> owner;
+};
+
+// Encoded bytes of one outbound message. A frame is filled in once by its
+// creator and is read-only from the moment it is shared; every recipient
+// queue (on any worker) holds a reference instead of its own copy. Header
+// and bytes live in a single block from the block pools, so a frame costs
+// no malloc once the pools have warmed up. A file frame holds a FileRegion
+// in place of the bytes.
+class Frame {
+public:
+    static Frame* allocate(size_t capacity, bool notice = false) {
+        void* mem = block_pool::allocate(sizeof(Frame) + capacity);
+        return new (mem) Frame(capacity, notice);
+    }
+
+    static Frame* allocate_file(FileRegion region, size_t length) {
+        void* mem = block_pool::allocate(sizeof(Frame) + sizeof(FileRegion));
+        Frame* frame = new (mem) Frame(0, false);
+        new (frame + 1) FileRegion(std::move(region));
+        frame->file = true;
+        frame->length = static_cast<uint32_t>(length);
+        return frame;
+    }
+
+    // Not valid for file frames
+    const char* data() const { return reinterpret_cast<const char*>(this + 1); }
+    size_t size() const { return length; }
+    bool is_notice() const { return notice; }
+    bool is_file() const { return file; }
+    const FileRegion& region() const { return *reinterpret_cast<const FileRegion*>(this + 1); }
+
+    // Only valid before the frame is shared
+    char* buffer() { return reinterpret_cast<char*>(this + 1); }
+    size_t max_size() const { return capacity; }
+    void set_size(size_t n) { length = static_cast<uint32_t>(n); }
+
+    void retain() { refs.fetch_add(1, std::memory_order_relaxed); }
+    void release() {
+        if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            size_t bytes = sizeof(Frame) + capacity;
+            if (file) {
+                reinterpret_cast<FileRegion*>(this + 1)->~FileRegion();
+                bytes = sizeof(Frame) + sizeof(FileRegion);
+            }
+            this->~Frame();
+            block_pool::free(this, bytes);
+        }
+    }
+
+private:
+    Frame(size_t capacity, bool notice)
+        : refs(1), length(0), capacity(static_cast<uint32_t>(capacity)), notice(notice),
+          file(false) {}
+
+    std::atomic<uint32_t> refs;
+    uint32_t length;
+    uint32_t capacity;
+    bool notice;  // Generated "skipped" notice rather than a chat frame
+    bool file;    // Bytes live in a FileRegion
+};
+
+static_assert(sizeof(Frame) % alignof(FileRegion) == 0, "FileRegion follows the header");
+
+// Owning handle to a Frame; copying shares the frame
+class FrameRef {
+public:
+    FrameRef() : frame(nullptr) {}
+    explicit FrameRef(Frame* adopt) : frame(adopt) {}
+    FrameRef(const FrameRef& other) : frame(other.frame) {
+        if (frame) frame->retain();
+    }
+    FrameRef(FrameRef&& other) noexcept : frame(other.frame) { other.frame = nullptr; }
+    ~FrameRef() {
+        if (frame) frame->release();
+    }
+
+    FrameRef& operator=(FrameRef other) noexcept {
+        std::swap(frame, other.frame);
+        return *this;
+    }
+
+    Frame* get() const { return frame; }
+    Frame* operator->() const { return frame; }
+    explicit operator bool() const { return frame != nullptr; }
+
+private:
+    Frame* frame;
+};
+
+// Frame holding a copy of bytes
+inline FrameRef make_frame(std::string_view bytes, bool notice = false) {
+    Frame* frame = Frame::allocate(bytes.size(), notice);
+    std::memcpy(frame->buffer(), bytes.data(), bytes.size());
+    frame->set_size(bytes.size());
+    return FrameRef(frame);
+}
+
+// Frame sent straight from a file; length must fit in 32 bits
+inline FrameRef make_file_frame(FileRegion region, size_t length) {
+    return FrameRef(Frame::allocate_file(std::move(region), length));
+}
+
+// Frame holding line followed by the protocol's newline terminator
+inline FrameRef make_line_frame(std::string_view line) {
+    Frame* frame = Frame::allocate(line.size() + 1);
+    std::memcpy(frame->buffer(), line.data(), line.size());
+    frame->buffer()[line.size()] = '\n';
+    frame->set_size(line.size() + 1);
+    return FrameRef(frame);
+}
+
+// {"user":"...","time":"...","text":"..."}\n with user and text escaped,
+// plus a "room" field when room is not empty
+inline FrameRef make_json_message_frame(std::string_view user, std::string_view text,
+                                        std::string_view time, std::string_view room = {}) {
+    thread_local std::string json; // Scratch reused across calls on this thread
+    json.clear();
+    json.append("{\"user\":\"");
+    append_json_escaped(json, user);
+    json.append("\",\"time\":\"").append(time);
+    if (!room.empty()) {
+        json.append("\",\"room\":\"");
+        append_json_escaped(json, room);
+    }
+    json.append("\",\"text\":\"");
+    append_json_escaped(json, text);
+    json.append("\"}\n");
+    return make_frame(json);
+}
+
+// Binary-protocol frame: header, name, room, text
+inline FrameRef make_binary_frame(BinaryType type, uint32_t user_id, uint64_t timestamp,
+                                  std::string_view name, std::string_view room,
+                                  std::string_view text, bool notice = false) {
+    Frame* frame = Frame::allocate(binary_frame_size(name, room, text), notice);
+    frame->set_size(encode_binary_frame(frame->buffer(), type, user_id, timestamp,
+                                        name, room, text));
+    return FrameRef(frame);
+}
+
+// Per-connection FIFO of frames. A power-of-two ring that only grows, so at
+// steady state queueing and dequeueing a frame never allocates.
+class FrameQueue {
+public:
+    FrameQueue() : capacity(0), head(0), count(0) {}
+
+    bool empty() const { return count == 0; }
+    size_t size() const { return count; }
+
+    FrameRef& at(size_t index) { return slots[(head + index) & (capacity - 1)]; }
+    FrameRef& front() { return at(0); }
+
+    void push_back(FrameRef frame) {
+        if (count == capacity) {
+            grow();
+        }
+        at(count) = std::move(frame);
+        count++;
+    }
+
+    void pop_front() {
+        at(0) = FrameRef();
+        head = (head + 1) & (capacity - 1);
+        count--;
+    }
+
+    // Remove the entry at index, keeping the order of the rest
+    void erase(size_t index) {
+        for (size_t i = index; i > 0; i--) {
+            at(i) = std::move(at(i - 1));
+        }
+        pop_front();
+    }
+
+    // Keep only the first n entries
+    void truncate(size_t n) {
+        while (count > n) {
+            count--;
+            at(count) = FrameRef();
+        }
+    }
+
+private:
+    std::unique_ptr<FrameRef[]> slots;
+    size_t capacity;
+    size_t head;
+    size_t count;
+
+    void grow() {
+        size_t new_capacity = capacity == 0 ? 8 : capacity * 2;
+        std::unique_ptr<FrameRef[]> bigger(new FrameRef[new_capacity]);
+        for (size_t i = 0; i < count; i++) {
+            bigger[i] = std::move(at(i));
+        }
+        slots = std::move(bigger);
+        capacity = new_capacity;
+        head = 0;
+    }
+};
+
+#endif // FRAME_H
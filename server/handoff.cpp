@@ -0,0 +1,395 @@
+/*
+ * MIT License
+ * Passing live sockets to a new server process
+ */
+
+#include "handoff.h"
+#include "async_log.h"
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+
+namespace {
+
+constexpr uint32_t HANDOFF_MAGIC = 0x4f484843;   // "CHHO"
+constexpr uint32_t HANDOFF_VERSION = 2;
+constexpr size_t FDS_PER_MESSAGE = 200;         // Below the kernel's SCM_MAX_FD
+constexpr size_t CHUNK_SIZE = 32 * 1024;        // State bytes per message
+constexpr int HANDOFF_TIMEOUT_S = 10;
+constexpr char ACK = 'A';
+constexpr char RELEASE = 'R';
+
+struct Header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t fd_count;
+    uint32_t reserved;
+    uint64_t state_len;
+};
+
+// Native byte order: both ends are builds of this server on one host
+class Writer {
+public:
+    std::string bytes;
+
+    void u8(uint8_t v) { bytes.push_back(static_cast<char>(v)); }
+    void u32(uint32_t v) { bytes.append(reinterpret_cast<const char*>(&v), sizeof(v)); }
+    void u64(uint64_t v) { bytes.append(reinterpret_cast<const char*>(&v), sizeof(v)); }
+    void str(const std::string& s) {
+        u32(static_cast<uint32_t>(s.size()));
+        bytes += s;
+    }
+};
+
+// Reads fail soft: past the end every value is zero and ok() turns false
+class Reader {
+public:
+    explicit Reader(const std::string& bytes) : pos(bytes.data()), end(bytes.data() + bytes.size()) {}
+
+    bool ok() const { return valid; }
+    uint8_t u8() { uint8_t v = 0; take(&v, sizeof(v)); return v; }
+    uint32_t u32() { uint32_t v = 0; take(&v, sizeof(v)); return v; }
+    uint64_t u64() { uint64_t v = 0; take(&v, sizeof(v)); return v; }
+    std::string str() {
+        uint32_t len = u32();
+        if (!valid || len > size_t(end - pos)) {
+            valid = false;
+            return std::string();
+        }
+        std::string s(pos, len);
+        pos += len;
+        return s;
+    }
+
+private:
+    const char* pos;
+    const char* end;
+    bool valid = true;
+
+    void take(void* out, size_t len) {
+        if (!valid || len > size_t(end - pos)) {
+            valid = false;
+            return;
+        }
+        std::memcpy(out, pos, len);
+        pos += len;
+    }
+};
+
+std::string encode_state(const HandoffState& state) {
+    Writer out;
+    out.u32(state.next_user_id);
+    out.u32(static_cast<uint32_t>(state.presence.size()));
+    for (const auto& table : state.presence) {
+        out.u32(static_cast<uint32_t>(table.size()));
+        for (const auto& [room, entry] : table) {
+            out.str(room);
+            out.u64(entry.version);
+            out.u32(static_cast<uint32_t>(entry.users.size()));
+            for (const auto& [user, count] : entry.users) {
+                out.str(user);
+                out.u32(static_cast<uint32_t>(count));
+            }
+        }
+    }
+    out.u32(static_cast<uint32_t>(state.connections.size()));
+    for (const ConnectionState& conn : state.connections) {
+        out.u32(static_cast<uint32_t>(conn.worker));
+        out.u8(static_cast<uint8_t>(conn.state));
+        out.u8(static_cast<uint8_t>(conn.format));
+        out.u8(conn.compression);
+        out.u32(conn.user_id);
+        out.str(conn.username);
+        out.u32(static_cast<uint32_t>(conn.rooms.size()));
+        for (const std::string& room : conn.rooms) {
+            out.str(room);
+        }
+        out.str(conn.current_room);
+        out.str(conn.pending_in);
+        out.str(conn.pending_out);
+    }
+    return std::move(out.bytes);
+}
+
+// Descriptors are not part of the bytes; fds holds them in send order,
+// listening sockets first
+bool decode_state(const std::string& bytes, const std::vector<int>& fds, HandoffState& state) {
+    Reader in(bytes);
+    state.next_user_id = in.u32();
+    uint32_t tables = in.u32();
+    for (uint32_t t = 0; t < tables && in.ok(); t++) {
+        auto& table = state.presence.emplace_back();
+        uint32_t rooms = in.u32();
+        for (uint32_t r = 0; r < rooms && in.ok(); r++) {
+            RoomPresence& entry = table[in.str()];
+            entry.version = in.u64();
+            uint32_t users = in.u32();
+            for (uint32_t u = 0; u < users && in.ok(); u++) {
+                std::string user = in.str();
+                entry.users[user] = static_cast<int>(in.u32());
+            }
+        }
+    }
+
+    uint32_t count = in.u32();
+    if (!in.ok() || count > fds.size()) {
+        return false;
+    }
+    size_t listen_count = fds.size() - count;
+    state.listen_fds.assign(fds.begin(), fds.begin() + listen_count);
+    for (uint32_t i = 0; i < count && in.ok(); i++) {
+        ConnectionState& conn = state.connections.emplace_back();
+        conn.fd = fds[listen_count + i];
+        conn.worker = static_cast<int>(in.u32());
+        conn.state = static_cast<ConnState>(in.u8());
+        conn.format = static_cast<WireFormat>(in.u8());
+        conn.compression = in.u8();
+        conn.user_id = in.u32();
+        conn.username = in.str();
+        uint32_t rooms = in.u32();
+        for (uint32_t r = 0; r < rooms && in.ok(); r++) {
+            conn.rooms.push_back(in.str());
+        }
+        conn.current_room = in.str();
+        conn.pending_in = in.str();
+        conn.pending_out = in.str();
+    }
+    return in.ok() && !state.listen_fds.empty();
+}
+
+void set_timeouts(int sock) {
+    timeval timeout{HANDOFF_TIMEOUT_S, 0};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+bool fill_address(const std::string& path, sockaddr_un& addr) {
+    addr = sockaddr_un{};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        log_err() << "[SERVER] Handoff socket path is too long: " << path << "\n";
+        return false;
+    }
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+bool send_bytes(int sock, const void* data, size_t len, const int* fds = nullptr,
+                size_t fd_count = 0) {
+    iovec iov{const_cast<void*>(data), len};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * FDS_PER_MESSAGE)];
+    if (fd_count > 0) {
+        msg.msg_control = control;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * fd_count);
+        cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fd_count);
+        std::memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * fd_count);
+    }
+
+    while (true) {
+        ssize_t sent = sendmsg(sock, &msg, MSG_NOSIGNAL);
+        if (sent == static_cast<ssize_t>(len)) {
+            return true;
+        }
+        if (sent == -1 && errno == EINTR) {
+            continue;
+        }
+        return false;
+    }
+}
+
+// One message; descriptors that came with it are appended to fds.
+// Returns the message length, 0 at end of stream, -1 on error.
+ssize_t receive_bytes(int sock, void* data, size_t len, std::vector<int>* fds = nullptr) {
+    iovec iov{data, len};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * FDS_PER_MESSAGE)];
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t n;
+    do {
+        n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    } while (n == -1 && errno == EINTR);
+    if (n <= 0) {
+        return n;
+    }
+
+    for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+            continue;
+        }
+        size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        const int* received = reinterpret_cast<const int*>(CMSG_DATA(cmsg));
+        for (size_t i = 0; i < count; i++) {
+            if (fds != nullptr) {
+                fds->push_back(received[i]);
+            } else {
+                close(received[i]);
+            }
+        }
+    }
+    if (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) {
+        return -1;
+    }
+    return n;
+}
+
+} // namespace
+
+int handoff_listen(const std::string& path) {
+    sockaddr_un addr;
+    if (!fill_address(path, addr)) {
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        log_err() << "[SERVER] Failed to create handoff socket\n";
+        return -1;
+    }
+
+    // Whoever connects here is given every client socket
+    mode_t old_mask = umask(0077);
+    unlink(path.c_str());
+    bool bound = bind(fd, (sockaddr*)&addr, sizeof(addr)) == 0;
+    umask(old_mask);
+    if (!bound || listen(fd, 1) == -1) {
+        log_err() << "[SERVER] Failed to listen on handoff socket " << path << ": "
+                  << strerror(errno) << "\n";
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int handoff_connect(const std::string& path) {
+    sockaddr_un addr;
+    if (!fill_address(path, addr)) {
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    if (connect(fd, (sockaddr*)&addr, sizeof(addr)) == -1) {
+        if (errno != ENOENT && errno != ECONNREFUSED) {
+            log_err() << "[SERVER] Failed to connect to handoff socket " << path << ": "
+                      << strerror(errno) << "\n";
+        }
+        close(fd);
+        return -1;
+    }
+    set_timeouts(fd);
+    return fd;
+}
+
+int handoff_accept(int listen_fd) {
+    int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+
+    ucred peer{};
+    socklen_t len = sizeof(peer);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &len) == -1 || peer.uid != geteuid()) {
+        log_err() << "[SERVER] Refusing handoff to a process of another user\n";
+        close(fd);
+        return -1;
+    }
+    set_timeouts(fd);
+    log_out() << "[SERVER] Handing off to process " << peer.pid << "\n";
+    return fd;
+}
+
+bool handoff_send(int sock, const HandoffState& state) {
+    std::vector<int> fds = state.listen_fds;
+    for (const ConnectionState& conn : state.connections) {
+        fds.push_back(conn.fd);
+    }
+    std::string bytes = encode_state(state);
+
+    Header header{HANDOFF_MAGIC, HANDOFF_VERSION, static_cast<uint32_t>(fds.size()), 0,
+                  bytes.size()};
+    if (!send_bytes(sock, &header, sizeof(header))) {
+        return false;
+    }
+    for (size_t i = 0; i < fds.size(); i += FDS_PER_MESSAGE) {
+        uint32_t count = static_cast<uint32_t>(std::min(FDS_PER_MESSAGE, fds.size() - i));
+        if (!send_bytes(sock, &count, sizeof(count), fds.data() + i, count)) {
+            return false;
+        }
+    }
+    for (size_t i = 0; i < bytes.size(); i += CHUNK_SIZE) {
+        if (!send_bytes(sock, bytes.data() + i, std::min(CHUNK_SIZE, bytes.size() - i))) {
+            return false;
+        }
+    }
+
+    char reply = 0;
+    if (receive_bytes(sock, &reply, sizeof(reply)) != 1 || reply != ACK) {
+        log_err() << "[SERVER] Successor did not take over; still serving\n";
+        return false;
+    }
+    return true;
+}
+
+bool handoff_receive(int sock, HandoffState& state) {
+    Header header{};
+    if (receive_bytes(sock, &header, sizeof(header)) != sizeof(header) ||
+        header.magic != HANDOFF_MAGIC || header.version != HANDOFF_VERSION) {
+        log_err() << "[SERVER] Running server sent no usable handoff\n";
+        return false;
+    }
+
+    std::vector<int> fds;
+    bool ok = true;
+    while (ok && fds.size() < header.fd_count) {
+        uint32_t count = 0;
+        size_t before = fds.size();
+        ok = receive_bytes(sock, &count, sizeof(count), &fds) == sizeof(count) &&
+             fds.size() - before == count;
+    }
+
+    std::string bytes;
+    std::string chunk(CHUNK_SIZE, '\0');
+    while (ok && bytes.size() < header.state_len) {
+        ssize_t n = receive_bytes(sock, chunk.data(), chunk.size());
+        ok = n > 0;
+        if (ok) {
+            bytes.append(chunk.data(), n);
+        }
+    }
+
+    ok = ok && decode_state(bytes, fds, state) && send_bytes(sock, &ACK, sizeof(ACK));
+    if (!ok) {
+        log_err() << "[SERVER] Handoff from the running server failed\n";
+        for (int fd : fds) {
+            close(fd);
+        }
+        state = HandoffState();
+        return false;
+    }
+    return true;
+}
+
+void handoff_release(int sock) {
+    send_bytes(sock, &RELEASE, sizeof(RELEASE));
+}
+
+void handoff_wait_release(int sock) {
+    // Also returns when the old process exits or the timeout passes
+    char reply = 0;
+    receive_bytes(sock, &reply, sizeof(reply));
+}
@@ -0,0 +1,69 @@
+/*
+ * MIT License
+ * Passing live sockets to a new server process
+ */
+
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include "reactor.h"
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// One client connection as the next process needs it to carry on where
+// this one stopped: the socket, the protocol stage and identity, the rooms,
+// and the bytes on either side that were not handled yet.
+struct ConnectionState {
+    int fd = -1;
+    int worker = 0;               // Reactor that owned it
+    ConnState state = ConnState::WELCOME;
+    WireFormat format = WireFormat::JSON;
+    uint8_t compression = 0;      // Compression bits, see compress.h
+    uint32_t user_id = 0;
+    std::string username;
+    std::vector<std::string> rooms;
+    std::string current_room;
+    std::string pending_in;       // Received but not yet split into frames
+    std::string pending_out;      // Queued but not yet taken by the kernel
+};
+
+// Everything a server passes to its successor
+struct HandoffState {
+    uint32_t next_user_id = 1;
+    std::vector<int> listen_fds;  // One per worker, in worker order
+    std::vector<std::unordered_map<std::string, RoomPresence>> presence;  // Per worker
+    std::vector<ConnectionState> connections;
+};
+
+// The running server listens on a UNIX socket; a new process started with
+// the same path connects to it and receives the listening sockets and every
+// client socket over SCM_RIGHTS, then acknowledges. The old process closes
+// its message log, confirms, and exits without touching the connections.
+// Clients see a pause of a few milliseconds, not a disconnect.
+//
+// Only processes of the same user may connect. Messages are SOCK_SEQPACKET
+// so each batch of descriptors arrives with the bytes it was sent with.
+
+// Listen for a successor on path, replacing a stale socket file; -1 on failure
+int handoff_listen(const std::string& path);
+
+// Connect to a running server on path; -1 when none is listening
+int handoff_connect(const std::string& path);
+
+// Accept a successor on a listening socket; -1 if it is not trusted
+int handoff_accept(int listen_fd);
+
+// Old process: send the state, then wait for the successor to take it.
+// False if it did not, in which case the old process carries on serving.
+bool handoff_send(int sock, const HandoffState& state);
+
+// New process: receive the state and acknowledge it
+bool handoff_receive(int sock, HandoffState& state);
+
+// Old process, once its message log is closed: tell the successor to go
+// ahead. New process: wait for that (or for the old process to exit).
+void handoff_release(int sock);
+void handoff_wait_release(int sock);
+
+#endif // HANDOFF_H
@@ -0,0 +1,565 @@
+/*
+ * MIT License
+ * Segmented append-only message log with history replay
+ */
+
+#include "message_log.h"
+#include "json_scan.h"
+#include "async_log.h"
+#include <algorithm>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+bool write_all(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t n = write(fd, data, size);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+// Room names are arbitrary text, so directories are named by their hex bytes
+std::string hex_encode(std::string_view text) {
+    static const char hex[] = "0123456789abcdef";
+    std::string out;
+    for (char c : text) {
+        out += hex[(c >> 4) & 0xF];
+        out += hex[c & 0xF];
+    }
+    return out;
+}
+
+bool hex_decode(const std::string& text, std::string& out) {
+    out.clear();
+    if (text.empty() || text.size() % 2 != 0) {
+        return false;
+    }
+    for (size_t i = 0; i < text.size(); i += 2) {
+        int high = json_hex_digit(text[i]);
+        int low = json_hex_digit(text[i + 1]);
+        if (high < 0 || low < 0) {
+            return false;
+        }
+        out += static_cast<char>(high << 4 | low);
+    }
+    return true;
+}
+
+std::string segment_name(const std::string& path, uint64_t first_seq, const char* suffix) {
+    char name[32];
+    snprintf(name, sizeof(name), "%020" PRIu64 "%s", first_seq, suffix);
+    return path + "/" + name;
+}
+
+} // namespace
+
+LogSegment::~LogSegment() {
+    if (map != nullptr) {
+        munmap(const_cast<char*>(map), map_size);
+    }
+    if (fd != -1) {
+        ::close(fd);
+    }
+    if (index_fd != -1) {
+        ::close(index_fd);
+    }
+}
+
+MessageLog::MessageLog(std::string dir, size_t segment_bytes, size_t open_rooms)
+    : dir(std::move(dir)), segment_bytes(segment_bytes),
+      open_limit(std::max<size_t>(open_rooms, 1)) {}
+
+MessageLog::~MessageLog() {
+    close();
+    if (wake_fd != -1) {
+        ::close(wake_fd);
+    }
+}
+
+bool MessageLog::open() {
+    if (mkdir(dir.c_str(), 0755) == -1 && errno != EEXIST) {
+        log_err() << "[SERVER] Failed to create log directory " << dir << ": "
+                  << strerror(errno) << "\n";
+        return false;
+    }
+
+    DIR* listing = opendir(dir.c_str());
+    if (listing == nullptr) {
+        log_err() << "[SERVER] Failed to open log directory " << dir << "\n";
+        return false;
+    }
+    // Segments are recovered when a room is first used
+    while (dirent* entry = readdir(listing)) {
+        std::string room;
+        if (!hex_decode(entry->d_name, room)) {
+            continue;
+        }
+        auto log = std::make_unique<RoomLog>();
+        log->path = dir + "/" + entry->d_name;
+        rooms[room] = std::move(log);
+    }
+    closedir(listing);
+
+    wake_fd = eventfd(0, EFD_CLOEXEC);
+    if (wake_fd == -1) {
+        log_err() << "[SERVER] Failed to create log writer eventfd\n";
+        return false;
+    }
+    writer = std::thread(&MessageLog::run_writer, this);
+
+    log_out() << "[SERVER] Message log: " << dir << " (" << rooms.size() << " rooms)\n";
+    return true;
+}
+
+void MessageLog::close() {
+    if (writer.joinable()) {
+        stopping.store(true);
+        uint64_t one = 1;
+        ssize_t ignored = write(wake_fd, &one, sizeof(one));
+        (void)ignored;
+        writer.join();
+    }
+}
+
+void MessageLog::append(std::string_view room, const FrameRef& line) {
+    appended.fetch_add(1, std::memory_order_relaxed);
+    queue.push(Pending{std::string(room), line});
+    wake_writer();
+}
+
+// Same wakeup protocol as the reactor inboxes
+void MessageLog::wake_writer() {
+    if (!wake_pending.exchange(true)) {
+        uint64_t one = 1;
+        ssize_t ignored = write(wake_fd, &one, sizeof(one));
+        (void)ignored;
+    }
+}
+
+void MessageLog::sync() {
+    uint64_t target = appended.load();
+    std::unique_lock<std::mutex> lock(commit_mutex);
+    commit_cv.wait(lock, [&] { return committed >= target; });
+}
+
+// Group commit: everything queued since the last pass is written with one
+// write() and one fdatasync() per segment touched. Appends that arrive
+// while a sync is in progress form the next, larger batch.
+void MessageLog::run_writer() {
+    std::vector<RoomLog*> touched;
+    while (true) {
+        uint64_t count;
+        ssize_t ignored = read(wake_fd, &count, sizeof(count));
+        (void)ignored;
+        wake_pending.store(false);
+        bool stop = stopping.load();
+
+        Pending pending;
+        uint64_t batch = 0;
+        while (queue.pop(pending)) {
+            RoomLog* log = stage(pending);
+            if (log != nullptr &&
+                std::find(touched.begin(), touched.end(), log) == touched.end()) {
+                touched.push_back(log);
+            }
+            batch++;
+        }
+        for (RoomLog* log : touched) {
+            commit(*log);
+        }
+        touched.clear();
+        close_idle_rooms();
+
+        {
+            std::lock_guard<std::mutex> lock(commit_mutex);
+            committed += batch;
+        }
+        commit_cv.notify_all();
+
+        if (stop) {
+            return;
+        }
+    }
+}
+
+// Append one line to its room's buffer; the room, or nullptr if not logged
+MessageLog::RoomLog* MessageLog::stage(Pending& pending) {
+    if (failed) {
+        return nullptr;
+    }
+    RoomLog* log = find_room(pending.room);
+    if (log == nullptr && (log = create_room(pending.room)) == nullptr) {
+        return nullptr;
+    }
+    {
+        std::lock_guard<std::mutex> lock(log->mutex);
+        if (!load(*log)) {
+            return nullptr;
+        }
+    }
+
+    size_t length = pending.line->size();
+    if (length > segment_bytes) {
+        return nullptr;
+    }
+    if (log->segments.empty() || log->size + length > segment_bytes) {
+        commit(*log);
+        auto segment = open_segment(log->path, log->next_seq, true);
+        if (!segment) {
+            failed = true;
+            return nullptr;
+        }
+        std::lock_guard<std::mutex> lock(log->mutex);
+        log->segments.push_back(std::move(segment));
+        log->size = 0;
+        log->count = 0;
+    }
+
+    // Monotonic, so index timestamps are sorted even if the clock steps back
+    log->last_timestamp = std::max(log->last_timestamp, now_epoch_ms());
+    uint64_t second = log->last_timestamp / 1000;
+    if (log->count == 0 || second != log->last_index_second ||
+        log->size - log->last_index_offset >= LOG_INDEX_INTERVAL) {
+        log->staged.push_back(LogIndexEntry{log->size, log->next_seq, log->last_timestamp});
+        log->last_index_offset = log->size;
+        log->last_index_second = second;
+    }
+
+    log->buffer.append(pending.line->data(), length);
+    log->size += length;
+    log->count++;
+    log->next_seq++;
+    log->touched = true;
+
+    // Large batches go to the kernel in chunks; they are synced together
+    if (log->buffer.size() >= LOG_WRITE_CHUNK && !write_staged(*log)) {
+        return nullptr;
+    }
+    return log;
+}
+
+// Hand staged bytes to the kernel without syncing or publishing them
+bool MessageLog::write_staged(RoomLog& log) {
+    LogSegment& segment = *log.segments.back();
+    const char* index = reinterpret_cast<const char*>(log.staged.data() + log.staged_written);
+    size_t entries = log.staged.size() - log.staged_written;
+    if (!write_all(segment.index_fd, index, entries * sizeof(LogIndexEntry)) ||
+        !write_all(segment.fd, log.buffer.data(), log.buffer.size())) {
+        log_err() << "[SERVER] Failed to write message log: " << strerror(errno)
+                  << "; history is no longer recorded\n";
+        failed = true;
+        return false;
+    }
+    log.staged_written = log.staged.size();
+    log.buffer.clear();
+    return true;
+}
+
+// Write and sync the staged bytes of the room's last segment, then make
+// them visible to readers. The index goes first: recovery drops entries
+// past the end of the log, but cannot invent missing ones.
+void MessageLog::commit(RoomLog& log) {
+    if (!log.touched) {
+        return;
+    }
+    log.touched = false;
+
+    LogSegment& segment = *log.segments.back();
+    if (!write_staged(log)) {
+        return;
+    }
+    if (fdatasync(segment.index_fd) == -1 || fdatasync(segment.fd) == -1) {
+        log_err() << "[SERVER] Failed to write message log: " << strerror(errno)
+                  << "; history is no longer recorded\n";
+        failed = true;
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(log.mutex);
+        segment.size = log.size;
+        segment.count = log.count;
+        segment.index.insert(segment.index.end(), log.staged.begin(), log.staged.end());
+    }
+    log.staged.clear();
+    log.staged_written = 0;
+}
+
+MessageLog::RoomLog* MessageLog::find_room(const std::string& room) {
+    std::lock_guard<std::mutex> lock(rooms_mutex);
+    auto it = rooms.find(room);
+    return it != rooms.end() ? it->second.get() : nullptr;
+}
+
+MessageLog::RoomLog* MessageLog::create_room(std::string_view room) {
+    auto log = std::make_unique<RoomLog>();
+    log->path = dir + "/" + hex_encode(room);
+    if (mkdir(log->path.c_str(), 0755) == -1 && errno != EEXIST) {
+        log_err() << "[SERVER] Failed to create log directory " << log->path << "\n";
+        return nullptr;
+    }
+
+    log->loaded = true;
+    log->last_used.store(++use_clock, std::memory_order_relaxed);
+    open_rooms++;
+
+    std::lock_guard<std::mutex> lock(rooms_mutex);
+    RoomLog* raw = log.get();
+    rooms[std::string(room)] = std::move(log);
+    return raw;
+}
+
+// Recover the room's segments unless they are open; called with log.mutex
+// held. Past the limit, the writer is woken to close the idle rooms.
+bool MessageLog::load(RoomLog& log) {
+    log.last_used.store(++use_clock, std::memory_order_relaxed);
+    if (log.loaded) {
+        return true;
+    }
+    log.size = 0;
+    log.count = 0;
+    log.next_seq = 0;
+    log.last_index_offset = 0;
+    log.last_index_second = 0;
+    log.last_timestamp = 0;
+    if (!recover_room(log)) {
+        log.segments.clear();
+        return false;
+    }
+    log.loaded = true;
+    if (++open_rooms > open_limit) {
+        wake_writer();
+    }
+    return true;
+}
+
+// Close the least recently used rooms beyond open_limit. Writer thread
+// only, between passes, so no room has staged bytes.
+void MessageLog::close_idle_rooms() {
+    if (open_rooms.load() <= open_limit) {
+        return;
+    }
+    std::vector<std::pair<uint64_t, RoomLog*>> by_use;
+    {
+        std::lock_guard<std::mutex> lock(rooms_mutex);
+        for (auto& entry : rooms) {
+            by_use.emplace_back(entry.second->last_used.load(std::memory_order_relaxed),
+                                entry.second.get());
+        }
+    }
+    std::sort(by_use.begin(), by_use.end());
+    for (auto& [used, log] : by_use) {
+        if (open_rooms.load() <= open_limit) {
+            break;
+        }
+        std::lock_guard<std::mutex> lock(log->mutex);
+        if (log->loaded) {
+            log->segments.clear();
+            log->loaded = false;
+            open_rooms--;
+        }
+    }
+}
+
+// Load a room's segments. Only the tail of a segment can be torn by a
+// crash: it is cut back to the last complete line, and index entries past
+// that point are dropped.
+bool MessageLog::recover_room(RoomLog& log) {
+    std::vector<uint64_t> firsts;
+    DIR* listing = opendir(log.path.c_str());
+    if (listing == nullptr) {
+        log_err() << "[SERVER] Failed to open log directory " << log.path << "\n";
+        return false;
+    }
+    while (dirent* entry = readdir(listing)) {
+        std::string name = entry->d_name;
+        if (name.size() == 24 && name.compare(20, 4, ".log") == 0) {
+            firsts.push_back(std::strtoull(name.c_str(), nullptr, 10));
+        }
+    }
+    closedir(listing);
+    std::sort(firsts.begin(), firsts.end());
+
+    for (size_t i = 0; i < firsts.size(); i++) {
+        auto segment = open_segment(log.path, firsts[i], false);
+        if (!segment) {
+            return false;
+        }
+
+        struct stat info;
+        fstat(segment->fd, &info);
+        uint64_t size = info.st_size;
+        while (size > 0 && segment->map[size - 1] != '\n') {
+            size--;
+        }
+        if (size != uint64_t(info.st_size) && ftruncate(segment->fd, size) == -1) {
+            log_err() << "[SERVER] Failed to repair log segment in " << log.path << "\n";
+            return false;
+        }
+        segment->size = size;
+
+        fstat(segment->index_fd, &info);
+        segment->index.resize(info.st_size / sizeof(LogIndexEntry));
+        ssize_t loaded = pread(segment->index_fd, segment->index.data(),
+                               segment->index.size() * sizeof(LogIndexEntry), 0);
+        if (loaded < 0) {
+            segment->index.clear();
+        }
+        while (!segment->index.empty() && segment->index.back().offset >= size) {
+            segment->index.pop_back();
+        }
+        if (ftruncate(segment->index_fd, segment->index.size() * sizeof(LogIndexEntry)) == -1) {
+            segment->index.clear();
+        }
+
+        if (i + 1 < firsts.size()) {
+            segment->count = firsts[i + 1] - firsts[i];
+        } else {
+            // Counted on from the last index entry, so a reopen scans at most
+            // LOG_INDEX_INTERVAL bytes and a line
+            const char* p = segment->map;
+            if (!segment->index.empty()) {
+                p += segment->index.back().offset;
+                segment->count = segment->index.back().seq - segment->first_seq;
+            }
+            for (; p < segment->map + size; segment->count++) {
+                p = static_cast<const char*>(memchr(p, '\n', segment->map + size - p)) + 1;
+            }
+        }
+
+        log.segments.push_back(std::move(segment));
+    }
+
+    if (!log.segments.empty()) {
+        const LogSegment& tail = *log.segments.back();
+        log.size = tail.size;
+        log.count = tail.count;
+        log.next_seq = tail.first_seq + tail.count;
+        if (!tail.index.empty()) {
+            log.last_index_offset = tail.index.back().offset;
+            log.last_index_second = tail.index.back().timestamp / 1000;
+            log.last_timestamp = tail.index.back().timestamp;
+        }
+    }
+    return true;
+}
+
+std::shared_ptr<LogSegment> MessageLog::open_segment(const std::string& path,
+                                                     uint64_t first_seq, bool create) {
+    auto segment = std::make_shared<LogSegment>();
+    segment->first_seq = first_seq;
+
+    std::string log_name = segment_name(path, first_seq, ".log");
+    int flags = O_RDWR | O_APPEND | O_CLOEXEC | (create ? O_CREAT | O_EXCL : 0);
+    segment->fd = ::open(log_name.c_str(), flags, 0644);
+    segment->index_fd = ::open(segment_name(path, first_seq, ".idx").c_str(),
+                               O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (segment->fd == -1 || segment->index_fd == -1) {
+        log_err() << "[SERVER] Failed to open log segment " << log_name << ": "
+                  << strerror(errno) << "\n";
+        return nullptr;
+    }
+
+    // Mapped at full segment size up front; only committed bytes are read
+    struct stat info;
+    fstat(segment->fd, &info);
+    segment->map_size = std::max<size_t>(segment_bytes, info.st_size);
+    void* map = mmap(nullptr, segment->map_size, PROT_READ, MAP_SHARED, segment->fd, 0);
+    if (map == MAP_FAILED) {
+        log_err() << "[SERVER] Failed to map log segment " << log_name << "\n";
+        return nullptr;
+    }
+    segment->map = static_cast<const char*>(map);
+    return segment;
+}
+
+// Everything committed from offset in segment onwards
+std::vector<LogSpan> MessageLog::spans_from(RoomLog& log, size_t segment, uint64_t offset) {
+    std::vector<LogSpan> spans;
+    for (size_t i = segment; i < log.segments.size(); i++) {
+        const auto& current = log.segments[i];
+        uint64_t start = i == segment ? offset : 0;
+        if (current->size > start) {
+            spans.push_back(LogSpan{current, start, current->size - start});
+        }
+    }
+    return spans;
+}
+
+std::vector<LogSpan> MessageLog::last(const std::string& room, size_t count) {
+    RoomLog* log = find_room(room);
+    if (log == nullptr || count == 0) {
+        return {};
+    }
+
+    std::lock_guard<std::mutex> lock(log->mutex);
+    if (!load(*log) || log->segments.empty()) {
+        return {};
+    }
+    uint64_t first = log->segments.front()->first_seq;
+    uint64_t end = log->segments.back()->first_seq + log->segments.back()->count;
+    uint64_t start = end - std::min<uint64_t>(count, end - first);
+
+    // Segment, then index entry at or before start, then scan forward
+    auto segment = std::upper_bound(log->segments.begin(), log->segments.end(), start,
+        [](uint64_t seq, const std::shared_ptr<LogSegment>& s) { return seq < s->first_seq; });
+    size_t which = std::max<size_t>(segment - log->segments.begin(), 1) - 1;
+    const LogSegment& current = *log->segments[which];
+
+    uint64_t offset = 0;
+    uint64_t seq = current.first_seq;
+    auto entry = std::upper_bound(current.index.begin(), current.index.end(), start,
+        [](uint64_t target, const LogIndexEntry& e) { return target < e.seq; });
+    if (entry != current.index.begin()) {
+        --entry;
+        offset = entry->offset;
+        seq = entry->seq;
+    }
+    for (; seq < start && offset < current.size; seq++) {
+        const char* line = current.map + offset;
+        offset += static_cast<const char*>(memchr(line, '\n', current.size - offset)) - line + 1;
+    }
+    return spans_from(*log, which, offset);
+}
+
+std::vector<LogSpan> MessageLog::since(const std::string& room, uint64_t timestamp) {
+    RoomLog* log = find_room(room);
+    if (log == nullptr) {
+        return {};
+    }
+
+    std::lock_guard<std::mutex> lock(log->mutex);
+    if (!load(*log)) {
+        return {};
+    }
+    auto segment = std::partition_point(log->segments.begin(), log->segments.end(),
+        [&](const std::shared_ptr<LogSegment>& s) {
+            return s->index.empty() || s->index.back().timestamp < timestamp;
+        });
+    if (segment == log->segments.end()) {
+        return {};
+    }
+
+    // Every second starts an index entry, so this is the first such message
+    const LogSegment& current = **segment;
+    auto entry = std::lower_bound(current.index.begin(), current.index.end(), timestamp,
+        [](const LogIndexEntry& e, uint64_t target) { return e.timestamp < target; });
+    return spans_from(*log, segment - log->segments.begin(), entry->offset);
+}
@@ -0,0 +1,162 @@
+/*
+ * MIT License
+ * Segmented append-only message log with history replay
+ */
+
+#ifndef MESSAGE_LOG_H
+#define MESSAGE_LOG_H
+
+#include "frame.h"
+#include "mpsc_queue.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+constexpr size_t DEFAULT_LOG_SEGMENT_BYTES = 64 << 20;
+constexpr size_t LOG_INDEX_INTERVAL = 4096;   // Most log bytes between two index entries
+constexpr size_t LOG_WRITE_CHUNK = 1 << 20;   // Staged bytes written out before the sync
+constexpr size_t DEFAULT_LOG_OPEN_ROOMS = 64;  // Rooms whose segments stay open and mapped
+
+// Sparse index entry: where a message starts in its segment, its sequence
+// number in the room and when it was logged. An entry is written for the
+// first message of every second and at least every LOG_INDEX_INTERVAL
+// bytes, so a lookup by (whole-second) time lands exactly on a message and
+// a lookup by count scans at most that many bytes.
+struct LogIndexEntry {
+    uint64_t offset;
+    uint64_t seq;
+    uint64_t timestamp;   // Milliseconds since the epoch
+};
+
+// One segment of a room's log: newline-terminated JSON lines exactly as
+// JSON clients receive them, plus the index. The file is mapped read-only
+// for scanning; bytes below size never change once published.
+struct LogSegment {
+    uint64_t first_seq = 0;
+    int fd = -1;
+    int index_fd = -1;
+    const char* map = nullptr;
+    size_t map_size = 0;
+
+    // Published state, guarded by the owning room's mutex
+    uint64_t size = 0;
+    uint64_t count = 0;
+    std::vector<LogIndexEntry> index;
+
+    ~LogSegment();
+};
+
+// Committed bytes of one segment, holding a reference to it
+struct LogSpan {
+    std::shared_ptr<LogSegment> segment;
+    uint64_t offset;
+    uint64_t length;
+};
+
+// Chat history on disk, one directory per room. Any thread may append
+// without taking a lock: lines go through an MPSC queue to a writer thread,
+// which writes every message queued since its last pass and then syncs
+// once (group commit). Readers on any thread look up history under a
+// per-room mutex that the message path never takes; the bytes themselves
+// are served from the mapped segments or with sendfile().
+//
+// Room names come from clients, so a room's segments are opened only when
+// it is written or read, and the least recently used rooms beyond
+// open_rooms are closed again by the writer thread. Spans already handed
+// out keep their segment mapped until they are dropped.
+class MessageLog {
+public:
+    explicit MessageLog(std::string dir, size_t segment_bytes = DEFAULT_LOG_SEGMENT_BYTES,
+                        size_t open_rooms = DEFAULT_LOG_OPEN_ROOMS);
+    ~MessageLog();
+
+    MessageLog(const MessageLog&) = delete;
+    MessageLog& operator=(const MessageLog&) = delete;
+
+    // Find existing rooms and start the writer; false on I/O errors
+    bool open();
+    // Commit everything queued and stop the writer
+    void close();
+
+    // Thread-safe; line must end in a newline
+    void append(std::string_view room, const FrameRef& line);
+    // Block until everything appended so far is on disk
+    void sync();
+
+    // The last count messages of room, oldest first
+    std::vector<LogSpan> last(const std::string& room, size_t count);
+    // Messages of room logged at or after timestamp (whole seconds)
+    std::vector<LogSpan> since(const std::string& room, uint64_t timestamp);
+
+private:
+    struct Pending {
+        std::string room;
+        FrameRef line;
+    };
+
+    struct RoomLog {
+        std::string path;
+        std::mutex mutex;   // Guards segments, their published state and loaded
+        std::vector<std::shared_ptr<LogSegment>> segments;
+        bool loaded = false;   // Segments recovered and open
+        std::atomic<uint64_t> last_used{0};
+
+        // Writer thread only, or under mutex while not loaded: staged but
+        // unpublished state of the last segment
+        std::string buffer;                   // Not yet written
+        std::vector<LogIndexEntry> staged;    // Not yet published
+        size_t staged_written = 0;            // Leading staged entries already written
+        uint64_t size = 0;
+        uint64_t count = 0;
+        uint64_t next_seq = 0;
+        uint64_t last_index_offset = 0;
+        uint64_t last_index_second = 0;
+        uint64_t last_timestamp = 0;
+        bool touched = false;
+    };
+
+    std::string dir;
+    size_t segment_bytes;
+    size_t open_limit;
+    bool failed = false;
+
+    std::mutex rooms_mutex;   // Guards the map; rooms are closed, never removed
+    std::unordered_map<std::string, std::unique_ptr<RoomLog>> rooms;
+
+    MpscQueue<Pending> queue;
+    int wake_fd = -1;
+    std::atomic<bool> wake_pending{false};
+    std::atomic<bool> stopping{false};
+    std::thread writer;
+
+    std::atomic<uint64_t> appended{0};
+    uint64_t committed = 0;
+    std::mutex commit_mutex;
+    std::condition_variable commit_cv;
+
+    std::atomic<uint64_t> use_clock{0};
+    std::atomic<size_t> open_rooms{0};
+
+    void wake_writer();
+    void run_writer();
+    RoomLog* stage(Pending& pending);
+    bool write_staged(RoomLog& log);
+    void commit(RoomLog& log);
+    RoomLog* find_room(const std::string& room);
+    RoomLog* create_room(std::string_view room);
+    bool load(RoomLog& log);
+    void close_idle_rooms();
+    bool recover_room(RoomLog& log);
+    std::shared_ptr<LogSegment> open_segment(const std::string& path, uint64_t first_seq,
+                                             bool create);
+    std::vector<LogSpan> spans_from(RoomLog& log, size_t segment, uint64_t offset);
+};
+
+#endif // MESSAGE_LOG_H
@@ -0,0 +1,198 @@
+/*
+ * MIT License
+ * Server metrics and the Prometheus endpoint
+ */
+
+#include "metrics.h"
+#include "async_log.h"
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <cstdio>
+
+namespace {
+
+void append_metric(std::string& out, const char* name, const char* type, const char* help,
+                   uint64_t value) {
+    out.append("# HELP ").append(name).append(" ").append(help).append("\n");
+    out.append("# TYPE ").append(name).append(" ").append(type).append("\n");
+    out.append(name).append(" ").append(std::to_string(value)).append("\n");
+}
+
+// Cumulative le buckets from 2^first up, with bounds divided by scale
+void append_histogram(std::string& out, const char* name, const char* help,
+                      const std::vector<const WorkerMetrics*>& workers,
+                      Pow2Histogram WorkerMetrics::*member, int first, int last, double scale) {
+    uint64_t buckets[Pow2Histogram::BUCKETS] = {};
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    for (const WorkerMetrics* worker : workers) {
+        const Pow2Histogram& histogram = worker->*member;
+        for (int b = 0; b < Pow2Histogram::BUCKETS; b++) {
+            buckets[b] += histogram.buckets[b].get();
+        }
+        count += histogram.count.get();
+        sum += histogram.sum.get();
+    }
+
+    out.append("# HELP ").append(name).append(" ").append(help).append("\n");
+    out.append("# TYPE ").append(name).append(" histogram\n");
+    uint64_t cumulative = 0;
+    char bound[32];
+    for (int b = 0; b <= last; b++) {
+        cumulative += buckets[b];
+        if (b >= first) {
+            snprintf(bound, sizeof(bound), "%g", static_cast<double>(1ull << b) / scale);
+            out.append(name).append("_bucket{le=\"").append(bound).append("\"} ")
+               .append(std::to_string(cumulative)).append("\n");
+        }
+    }
+    out.append(name).append("_bucket{le=\"+Inf\"} ").append(std::to_string(count)).append("\n");
+    snprintf(bound, sizeof(bound), "%g", sum / scale);
+    out.append(name).append("_sum ").append(bound).append("\n");
+    out.append(name).append("_count ").append(std::to_string(count)).append("\n");
+}
+
+} // namespace
+
+std::string render_metrics(const std::vector<const WorkerMetrics*>& workers,
+                           const std::function<void(std::string&)>& extra) {
+    auto total = [&](Counter WorkerMetrics::*member) {
+        uint64_t sum = 0;
+        for (const WorkerMetrics* worker : workers) {
+            sum += (worker->*member).get();
+        }
+        return sum;
+    };
+
+    std::string out;
+    append_metric(out, "chat_workers", "gauge", "Event-loop threads", workers.size());
+    append_metric(out, "chat_connections_accepted_total", "counter", "Client connections accepted",
+                  total(&WorkerMetrics::connections_accepted));
+    append_metric(out, "chat_connections_open", "gauge", "Client connections currently open",
+                  total(&WorkerMetrics::connections_open));
+    append_metric(out, "chat_bytes_received_total", "counter", "Bytes read from clients",
+                  total(&WorkerMetrics::bytes_received));
+    append_metric(out, "chat_bytes_sent_total", "counter", "Bytes written to clients",
+                  total(&WorkerMetrics::bytes_sent));
+    append_metric(out, "chat_messages_received_total", "counter", "Chat messages relayed",
+                  total(&WorkerMetrics::messages_received));
+    append_metric(out, "chat_deliveries_total", "counter", "Frames queued to recipients",
+                  total(&WorkerMetrics::deliveries));
+    append_metric(out, "chat_frames_dropped_total", "counter",
+                  "Frames discarded by the slow-consumer policy",
+                  total(&WorkerMetrics::frames_dropped));
+    append_metric(out, "chat_slow_disconnects_total", "counter",
+                  "Clients disconnected for not keeping up",
+                  total(&WorkerMetrics::slow_disconnects));
+    append_metric(out, "chat_connection_throttles_total", "counter",
+                  "Times a connection's rate limit paused reading from it",
+                  total(&WorkerMetrics::connection_throttles));
+    append_metric(out, "chat_user_throttles_total", "counter",
+                  "Times a user's shared rate limit paused reading from a connection",
+                  total(&WorkerMetrics::user_throttles));
+    append_metric(out, "chat_syscalls_total", "counter",
+                  "System calls made by the workers' event loops",
+                  total(&WorkerMetrics::syscalls));
+    append_metric(out, "chat_heap_allocations_total", "counter",
+                  "Heap allocations made by the worker threads",
+                  total(&WorkerMetrics::heap_allocations));
+    append_metric(out, "chat_compression_saved_bytes_total", "counter",
+                  "Bytes compressed frames kept off the wire",
+                  total(&WorkerMetrics::compression_saved));
+    append_histogram(out, "chat_fanout_seconds", "Time to queue a message to a room's members",
+                     workers, &WorkerMetrics::fanout_ns, 10, 30, 1e9);
+    append_histogram(out, "chat_send_queue_depth", "Recipient queue length after each enqueue",
+                     workers, &WorkerMetrics::queue_depth, 0, 16, 1);
+    append_histogram(out, "chat_write_frames", "Frames per socket write",
+                     workers, &WorkerMetrics::write_batch, 0, 12, 1);
+    if (extra) {
+        extra(out);
+    }
+    append_metric(out, "chat_log_lines_dropped_total", "counter",
+                  "Server log lines lost to a full log ring", server_logger().dropped());
+    return out;
+}
+
+MetricsEndpoint::MetricsEndpoint(std::function<std::string()> render)
+    : render(std::move(render)) {}
+
+MetricsEndpoint::~MetricsEndpoint() {
+    stop();
+}
+
+bool MetricsEndpoint::start(int port) {
+    listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd == -1) {
+        log_err() << "[SERVER] Failed to create metrics socket\n";
+        return false;
+    }
+    int opt = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    // Local only: the endpoint has no authentication
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (bind(listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == -1 ||
+        listen(listen_fd, 16) == -1) {
+        log_err() << "[SERVER] Failed to bind metrics endpoint to port " << port << "\n";
+        close(listen_fd);
+        listen_fd = -1;
+        return false;
+    }
+
+    log_out() << "[SERVER] Metrics on http://127.0.0.1:" << port << "/metrics\n";
+    running = true;
+    thread = std::thread(&MetricsEndpoint::run, this);
+    return true;
+}
+
+void MetricsEndpoint::stop() {
+    if (thread.joinable()) {
+        running = false;
+        thread.join();
+    }
+    if (listen_fd != -1) {
+        close(listen_fd);
+        listen_fd = -1;
+    }
+}
+
+// One request per connection; the request itself is not parsed
+void MetricsEndpoint::run() {
+    while (running) {
+        pollfd pfd{listen_fd, POLLIN, 0};
+        if (poll(&pfd, 1, 200) <= 0) {
+            continue;
+        }
+        int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd == -1) {
+            continue;
+        }
+        timeval timeout{1, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        char request[1024];
+        ssize_t ignored = recv(fd, request, sizeof(request), 0);
+        (void)ignored;
+
+        std::string body = render();
+        std::string response = "HTTP/1.0 200 OK\r\n"
+                               "Content-Type: text/plain; version=0.0.4\r\n"
+                               "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                               "Connection: close\r\n\r\n" + body;
+        size_t offset = 0;
+        while (offset < response.size()) {
+            ssize_t n = send(fd, response.data() + offset, response.size() - offset, MSG_NOSIGNAL);
+            if (n <= 0) {
+                break;
+            }
+            offset += n;
+        }
+        close(fd);
+    }
+}
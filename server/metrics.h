@@ -0,0 +1,106 @@
+/*
+ * MIT License
+ * Server metrics and the Prometheus endpoint
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+// A counter with a single writer. Increments are a plain load and store,
+// with no locked instruction; readers on other threads see a recent value.
+class Counter {
+public:
+    void add(uint64_t n = 1) {
+        value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+    void sub(uint64_t n = 1) {
+        value.store(value.load(std::memory_order_relaxed) - n, std::memory_order_relaxed);
+    }
+    uint64_t get() const { return value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> value{0};
+};
+
+// Single-writer histogram with power-of-two buckets: bucket b counts values
+// up to 2^b that did not fit in bucket b - 1
+class Pow2Histogram {
+public:
+    static constexpr int BUCKETS = 40;
+
+    void record(uint64_t value) {
+        int bucket = value <= 1 ? 0 : 64 - __builtin_clzll(value - 1);
+        buckets[bucket < BUCKETS ? bucket : BUCKETS - 1].add();
+        count.add();
+        sum.add(value);
+    }
+
+    Counter buckets[BUCKETS];
+    Counter count;
+    Counter sum;
+};
+
+// Hot-path counters of one reactor, written only by its thread and padded
+// so neighbouring workers never share a cache line
+struct alignas(64) WorkerMetrics {
+    Counter connections_accepted;
+    Counter connections_open;
+    Counter bytes_received;
+    Counter bytes_sent;
+    Counter messages_received;   // Chat messages from this worker's clients
+    Counter deliveries;          // Frames queued to recipients
+    Counter frames_dropped;      // By the slow-consumer policy
+    Counter slow_disconnects;
+    Counter connection_throttles; // Reads paused by a connection's rate limit
+    Counter user_throttles;       // Reads paused by a user's shared rate limit
+    Counter syscalls;            // Made by the event loop, wakes of other workers included
+    Counter heap_allocations;    // operator new calls on the worker's thread
+    Counter compression_saved;   // Bytes compressed frames kept off the wire
+    Pow2Histogram fanout_ns;     // Time to queue one message to a room's local members
+    Pow2Histogram queue_depth;   // Recipient queue length after each enqueue
+    Pow2Histogram write_batch;   // Frames per socket write
+};
+
+inline uint64_t monotonic_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+// All workers' metrics summed in the Prometheus text format. extra adds
+// series that live elsewhere (the log, the bridge).
+std::string render_metrics(const std::vector<const WorkerMetrics*>& workers,
+                           const std::function<void(std::string&)>& extra = nullptr);
+
+// Plain HTTP on 127.0.0.1 that answers every request with the current
+// metrics. Scrapes are rare, so it runs on its own blocking thread and
+// the workers never notice it beyond their counters being read.
+class MetricsEndpoint {
+public:
+    explicit MetricsEndpoint(std::function<std::string()> render);
+    ~MetricsEndpoint();
+
+    MetricsEndpoint(const MetricsEndpoint&) = delete;
+    MetricsEndpoint& operator=(const MetricsEndpoint&) = delete;
+
+    bool start(int port);
+    void stop();
+
+private:
+    std::function<std::string()> render;
+    int listen_fd = -1;
+    std::atomic<bool> running{false};
+    std::thread thread;
+
+    void run();
+};
+
+#endif // METRICS_H
@@ -0,0 +1,69 @@
+/*
+ * MIT License
+ * Lock-free multi-producer / single-consumer queue
+ */
+
+#ifndef MPSC_QUEUE_H
+#define MPSC_QUEUE_H
+
+#include "block_pool.h"
+#include <atomic>
+#include <new>
+#include <utility>
+
+// Vyukov-style linked MPSC queue. push() is wait-free (one atomic exchange)
+// and may be called from any thread; pop() must only be called by the
+// owning consumer thread. A push that is still in flight may be invisible
+// to pop() for a moment, which callers handle by draining again on wakeup.
+// Nodes come from the block pools: a push on one thread and the matching
+// pop on another do not go through malloc.
+template <typename T>
+class MpscQueue {
+public:
+    MpscQueue() : head(make_node()), tail(head.load(std::memory_order_relaxed)) {}
+
+    ~MpscQueue() {
+        T discard;
+        while (pop(discard)) {
+        }
+        destroy(tail);
+    }
+
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    void push(T value) {
+        Node* node = make_node();
+        node->value = std::move(value);
+        Node* prev = head.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    bool pop(T& out) {
+        Node* next = tail->next.load(std::memory_order_acquire);
+        if (next == nullptr) {
+            return false;
+        }
+        out = std::move(next->value);
+        destroy(tail);
+        tail = next; // next becomes the new stub
+        return true;
+    }
+
+private:
+    struct Node {
+        std::atomic<Node*> next{nullptr};
+        T value;
+    };
+
+    static Node* make_node() { return new (block_pool::allocate(sizeof(Node))) Node(); }
+    static void destroy(Node* node) {
+        node->~Node();
+        block_pool::free(node, sizeof(Node));
+    }
+
+    alignas(64) std::atomic<Node*> head; // Producers
+    alignas(64) Node* tail;              // Consumer
+};
+
+#endif // MPSC_QUEUE_H
@@ -0,0 +1,99 @@
+/*
+ * MIT License
+ * Token-bucket rate limits for inbound frames
+ */
+
+#ifndef RATE_LIMIT_H
+#define RATE_LIMIT_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// Sustained rate and burst of a token bucket, kept in the form of the
+// generic cell rate algorithm: instead of a token count and a refill time,
+// a bucket stores one timestamp, the time at which it would be full again
+// (the "theoretical arrival time"). Each frame pushes that time forward by
+// one interval, and a frame conforms while it is at most burst - 1
+// intervals ahead of now. Refill needs no timer and a bucket is one word.
+struct RateLimit {
+    uint64_t interval_ns = 0;    // 0: unlimited
+    uint64_t tolerance_ns = 0;   // (burst - 1) intervals
+
+    static RateLimit per_second(double rate, uint32_t burst) {
+        RateLimit limit;
+        if (rate > 0) {
+            limit.interval_ns = static_cast<uint64_t>(1e9 / rate);
+            limit.tolerance_ns = limit.interval_ns * (std::max<uint32_t>(burst, 1) - 1);
+        }
+        return limit;
+    }
+
+    bool enabled() const { return interval_ns != 0; }
+};
+
+// Bucket owned by one thread
+class TokenBucket {
+public:
+    // Spend one token; returns when the next one is available (<= now if
+    // the bucket is not empty)
+    uint64_t take(const RateLimit& limit, uint64_t now) {
+        tat = std::max(tat, now) + limit.interval_ns;
+        return tat - limit.tolerance_ns;
+    }
+
+private:
+    uint64_t tat = 0;
+};
+
+// Bucket shared by the connections of one user, which may be on different
+// workers. A spend is one compare-and-swap, contended only by that user.
+class SharedTokenBucket {
+public:
+    uint64_t take(const RateLimit& limit, uint64_t now) {
+        uint64_t current = tat.load(std::memory_order_relaxed);
+        uint64_t next;
+        do {
+            next = std::max(current, now) + limit.interval_ns;
+        } while (!tat.compare_exchange_weak(current, next, std::memory_order_relaxed));
+        return next - limit.tolerance_ns;
+    }
+
+private:
+    std::atomic<uint64_t> tat{0};
+};
+
+// Per-username buckets for all workers. Looked up once at login; a bucket
+// lives as long as a connection of its user holds it.
+class UserBuckets {
+public:
+    std::shared_ptr<SharedTokenBucket> acquire(const std::string& user) {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::weak_ptr<SharedTokenBucket>& slot = buckets[user];
+        std::shared_ptr<SharedTokenBucket> bucket = slot.lock();
+        if (!bucket) {
+            bucket = std::make_shared<SharedTokenBucket>();
+            slot = bucket;
+        }
+
+        // Amortized sweep of users with no connections left
+        if (buckets.size() >= sweep_at) {
+            for (auto it = buckets.begin(); it != buckets.end();) {
+                it = it->second.expired() ? buckets.erase(it) : std::next(it);
+            }
+            sweep_at = std::max<size_t>(64, buckets.size() * 2);
+        }
+        return bucket;
+    }
+
+private:
+    std::mutex mutex;
+    std::unordered_map<std::string, std::weak_ptr<SharedTokenBucket>> buckets;
+    size_t sweep_at = 64;
+};
+
+#endif // RATE_LIMIT_H
@@ -0,0 +1,1548 @@
+/*
+ * MIT License
+ * Edge-triggered epoll reactor for the socket server
+ */
+
+#include "reactor.h"
+#include "alloc_count.h"
+#include "async_log.h"
+#include "common.h"
+#include "handoff.h"
+#include "shm_bridge.h"
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+
+namespace {
+
+constexpr int MAX_EVENTS = 256;
+constexpr size_t MAX_IOV = 64;  // Frames gathered into one sendmsg()
+constexpr uint64_t MIN_WINDOW_NS = 10000;   // A coalescing window below this is closed
+
+// epoll tokens for the reactor's own descriptors; client sockets carry
+// their connection handle, which never has generation 0
+constexpr SlabId LISTEN_TOKEN = 0;
+constexpr SlabId WAKE_TOKEN = 1;
+
+std::atomic<uint32_t> next_user_id{1};     // 0 is the server
+std::atomic<uint32_t> binary_clients{0};   // Binary connections on all workers
+std::atomic<uint32_t> lz4_clients{0};      // Of those, the ones accepting LZ4 frames
+
+// Compress the binary frame once for every LZ4 recipient, on any worker
+void add_lz4(EncodedMessage& message) {
+    if (message.binary && lz4_clients.load(std::memory_order_relaxed) > 0) {
+        message.lz4 = compress_lz4(*message.binary.get());
+    }
+}
+
+// "room":"...", for every room but the lobby
+void append_room_field(std::string& json, const std::string& room) {
+    if (room != DEFAULT_ROOM) {
+        json += "\"room\":\"";
+        append_json_escaped(json, room);
+        json += "\",";
+    }
+}
+
+bool set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags != -1 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1;
+}
+
+} // namespace
+
+Reactor::Reactor(int id, int listen_fd, const ReactorConfig& config)
+    : id(id), listen_fd(listen_fd), config(config), epoll_fd(-1), wake_fd(-1),
+      welcome_frame(make_frame(WELCOME_MESSAGE)) {}
+
+Reactor::~Reactor() {
+    connections.for_each([](SlabId, Connection& conn) { close(conn.fd); });
+    ring.reset();
+    if (wake_fd != -1) {
+        close(wake_fd);
+    }
+    if (epoll_fd != -1) {
+        close(epoll_fd);
+    }
+}
+
+bool Reactor::init() {
+    if (!set_nonblocking(listen_fd)) {
+        log_err() << "[SERVER] Failed to make listening socket non-blocking\n";
+        return false;
+    }
+
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd == -1) {
+        log_err() << "[SERVER] Failed to create worker wakeup eventfd\n";
+        return false;
+    }
+
+    if (config.io == IoBackend::URING) {
+        return init_uring();
+    }
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1) {
+        log_err() << "[SERVER] Failed to create epoll instance\n";
+        return false;
+    }
+
+    epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.u64 = LISTEN_TOKEN;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev) == -1) {
+        log_err() << "[SERVER] Failed to register listening socket\n";
+        return false;
+    }
+
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.u64 = WAKE_TOKEN;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev) == -1) {
+        log_err() << "[SERVER] Failed to register worker wakeup eventfd\n";
+        return false;
+    }
+
+    return true;
+}
+
+void Reactor::set_peers(const std::vector<Reactor*>& workers) {
+    peers.clear();
+    for (Reactor* worker : workers) {
+        if (worker != this) {
+            peers.push_back(worker);
+        }
+    }
+}
+
+bool Reactor::post(ShardEvent event) {
+    inbox.push(std::move(event));
+
+    // Only the first post after a drain pays for the eventfd write
+    if (!wake_pending.exchange(true)) {
+        uint64_t one = 1;
+        ssize_t ignored = write(wake_fd, &one, sizeof(one));
+        (void)ignored;
+        return true;
+    }
+    return false;
+}
+
+void Reactor::drain_inbox() {
+    clear_wake();
+    apply_inbox(SIZE_MAX);
+}
+
+// Called before draining so a concurrent post either lands in this drain
+// or triggers a fresh wakeup
+void Reactor::clear_wake() {
+    uint64_t count;
+    do {
+        metrics.syscalls.add();
+    } while (read(wake_fd, &count, sizeof(count)) > 0);
+    wake_pending.store(false);
+}
+
+// Apply up to limit events from other workers; false if more are waiting
+bool Reactor::apply_inbox(size_t limit) {
+    ShardEvent event;
+    for (size_t i = 0; i < limit; i++) {
+        if (!inbox.pop(event)) {
+            return true;
+        }
+        apply_presence(event.type, event.room, event.username, nullptr);
+        deliver_local(event.room, event.payload, nullptr);
+    }
+    return false;
+}
+
+void Reactor::set_phase(RunPhase next, uint64_t deadline_ns) {
+    drain_deadline.store(deadline_ns, std::memory_order_relaxed);
+    phase.store(next, std::memory_order_release);
+    uint64_t one = 1;
+    ssize_t ignored = write(wake_fd, &one, sizeof(one));
+    (void)ignored;
+}
+
+void Reactor::run() {
+    while (true) {
+        RunPhase target = phase.load(std::memory_order_acquire);
+        if (target != RunPhase::RUNNING && reading) {
+            stop_input();
+        }
+        if (target == RunPhase::HALT) {
+            break;
+        }
+        if (target == RunPhase::DRAIN && drain_connections()) {
+            break;
+        }
+
+        int timeout = target == RunPhase::DRAIN ? drain_timeout() : throttle_timeout(1000);
+        if (!(ring ? poll_uring(wait_ns(timeout)) : poll_epoll(wait_ns(timeout)))) {
+            break;
+        }
+
+        if (reading) {
+            resume_throttled();
+        }
+        flush_held(false);
+        reap_closed();
+
+        uint64_t allocations = thread_heap_allocations();
+        metrics.heap_allocations.add(allocations - allocations_seen);
+        allocations_seen = allocations;
+    }
+
+    if (ring) {
+        finish_uring();
+    }
+
+    // Nobody waits on a loop that is gone
+    input_stopped.store(true, std::memory_order_release);
+}
+
+// Wait for readiness and handle it; false if the loop cannot go on
+bool Reactor::poll_epoll(uint64_t timeout_ns) {
+    epoll_event events[MAX_EVENTS];
+    int n = -1;
+    if (timeout_ns % 1000000 != 0) {
+        // A coalescing window that ends between milliseconds
+        timespec ts{time_t(timeout_ns / 1000000000), long(timeout_ns % 1000000000)};
+        n = epoll_pwait2(epoll_fd, events, MAX_EVENTS, &ts, nullptr);
+        metrics.syscalls.add();
+    }
+    if (timeout_ns % 1000000 == 0 || (n == -1 && errno == ENOSYS)) {
+        int timeout = static_cast<int>((timeout_ns + 999999) / 1000000);
+        n = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout);
+        metrics.syscalls.add();
+    }
+    if (n == -1) {
+        if (errno == EINTR) {
+            return true;
+        }
+        log_err() << "[SERVER] epoll_wait failed: " << strerror(errno) << "\n";
+        return false;
+    }
+
+    for (int i = 0; i < n; i++) {
+        SlabId token = events[i].data.u64;
+        if (token == LISTEN_TOKEN) {
+            accept_clients();
+            continue;
+        }
+        if (token == WAKE_TOKEN) {
+            drain_inbox();
+            continue;
+        }
+
+        // Stale if the connection was reaped earlier in this batch
+        Connection* conn = connections.get(token);
+        if (conn != nullptr) {
+            handle_event(*conn, events[i].events);
+        }
+    }
+    return true;
+}
+
+void Reactor::accept_clients() {
+    while (true) {
+        sockaddr_in client_addr{};
+        socklen_t client_len = sizeof(client_addr);
+
+        int client_fd = accept4(listen_fd, (sockaddr*)&client_addr, &client_len,
+                                SOCK_NONBLOCK | SOCK_CLOEXEC);
+        metrics.syscalls.add();
+        if (client_fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                log_err() << "[SERVER] Failed to accept connection: " << strerror(errno) << "\n";
+            }
+            return;
+        }
+        add_client(client_fd);
+    }
+}
+
+void Reactor::add_client(int client_fd) {
+    SlabId conn_id = connections.emplace(client_fd);
+    Connection& conn = *connections.get(conn_id);
+    conn.id = conn_id;
+    if (!watch_client(conn)) {
+        log_err() << "[SERVER] Failed to register client socket\n";
+        connections.erase(conn_id);
+        close(client_fd);
+        return;
+    }
+
+    log_out() << "[SERVER] New client connected (worker: " << id
+              << ", fd: " << client_fd << ")\n";
+    metrics.connections_accepted.add();
+    metrics.connections_open.add();
+    conn.user_id = next_user_id.fetch_add(1, std::memory_order_relaxed);
+
+    // Writes are coalesced here, so Nagle's algorithm would only add delay
+    int one = 1;
+    setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    metrics.syscalls.add();
+
+    // Request username
+    queue_send(conn, welcome_frame);
+}
+
+// Start receiving from a new connection; false if it cannot be watched
+bool Reactor::watch_client(Connection& conn) {
+    if (ring) {
+        arm_recv(conn);
+        return true;
+    }
+    epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.u64 = conn.id;
+    metrics.syscalls.add();
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, conn.fd, &ev) == 0;
+}
+
+void Reactor::handle_event(Connection& conn, uint32_t events) {
+    if (conn.closing) {
+        return;
+    }
+
+    if (events & EPOLLOUT) {
+        conn.writable = true;
+        flush(conn);
+    }
+    if (!reading) {
+        // Winding down: input stays in the socket, or for the next process
+        if (conn.shut && (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) {
+            discard_input(conn);
+        }
+        return;
+    }
+    if ((events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) && !conn.closing) {
+        read_available(conn);
+    }
+
+    // Lines that arrived during the welcome stage are handled once it completes
+    process_lines(conn);
+}
+
+void Reactor::read_available(Connection& conn) {
+    if (ring) {
+        feed(conn);
+        return;
+    }
+    while (!conn.throttled) {
+        ssize_t n = conn.inbuf.fill(conn.fd);
+        metrics.syscalls.add();
+        if (n > 0) {
+            metrics.bytes_received.add(n);
+            // Frame as we go so pipelined input never outgrows the slab
+            process_lines(conn);
+            if (conn.closing) {
+                return;
+            }
+            continue;
+        }
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)) {
+            // Idle connections do not keep a receive slab
+            conn.inbuf.release();
+            return;
+        }
+
+        // Connection closed or error
+        if (conn.state == ConnState::CHATTING) {
+            log_out() << "[SERVER] Client " << conn.username << " disconnected\n";
+        } else {
+            log_out() << "[SERVER] Client disconnected before sending username\n";
+        }
+        mark_closing(conn);
+        return;
+    }
+}
+
+void Reactor::process_lines(Connection& conn) {
+    std::string_view line;
+
+    while (conn.state != ConnState::WELCOME && !conn.closing && !conn.throttled) {
+        if (conn.format == WireFormat::BINARY) {
+            process_binary_frames(conn);
+            return;
+        }
+
+        LineBuffer::Status status = conn.inbuf.next_line(line);
+        if (status == LineBuffer::NEED_MORE) {
+            break;
+        }
+        if (status == LineBuffer::TOO_LONG) {
+            log_err() << "[SERVER] Dropping oversized frame (fd: " << conn.fd << ")\n";
+            continue;
+        }
+        if (!line.empty()) {
+            bool chatting = conn.state == ConnState::CHATTING;
+            handle_line(conn, line);
+            if (chatting) {
+                charge_frame(conn);
+            }
+        }
+    }
+}
+
+// Split length-prefixed frames out of the receive buffer. A bad length
+// cannot be resynchronized, so it closes the connection.
+void Reactor::process_binary_frames(Connection& conn) {
+    while (!conn.closing && !conn.throttled) {
+        std::string_view bytes = conn.inbuf.peek();
+        if (bytes.size() < BINARY_HEADER_SIZE) {
+            return;
+        }
+
+        BinaryHeader header = decode_binary_header(bytes.data());
+        if (header.length > MAX_BINARY_PAYLOAD ||
+            size_t(header.name_len) + header.room_len > header.length) {
+            log_err() << "[SERVER] Invalid binary frame (fd: " << conn.fd << ")\n";
+            mark_closing(conn);
+            return;
+        }
+        size_t total = BINARY_HEADER_SIZE + header.length;
+        if (bytes.size() < total) {
+            return;
+        }
+
+        handle_binary_frame(conn, header, bytes.substr(BINARY_HEADER_SIZE, header.length));
+        conn.inbuf.consume(total);
+        charge_frame(conn);
+    }
+}
+
+void Reactor::handle_line(Connection& conn, std::string_view line) {
+    // Nothing is relayed until it parses as a chat object
+    ChatFields fields;
+    JsonError error = scanner.parse(line, fields);
+    if (error != JsonError::NONE) {
+        log_err() << "[SERVER] Rejecting malformed frame (fd: " << conn.fd << ", "
+                  << json_error_name(error) << ")\n";
+        return;
+    }
+
+    if (conn.state == ConnState::USERNAME) {
+        if (fields.user.size() >= MAX_USERNAME_LEN) {
+            log_err() << "[SERVER] Rejecting oversized username (fd: " << conn.fd << ")\n";
+            return;
+        }
+        json_unescape(fields.user, conn.username);
+        if (conn.username.find('\0') != std::string::npos) {
+            log_err() << "[SERVER] Rejecting username with a NUL character (fd: " << conn.fd
+                      << ")\n";
+            conn.username.clear();
+            return;
+        }
+        if (conn.username.empty()) {
+            conn.username = "Anonymous";
+        }
+        if (config.user_buckets != nullptr) {
+            conn.user_bucket = config.user_buckets->acquire(conn.username);
+        }
+        conn.state = ConnState::CHATTING;
+
+        if (fields.proto == BINARY_PROTOCOL_NAME) {
+            conn.format = WireFormat::BINARY;
+            binary_clients.fetch_add(1, std::memory_order_relaxed);
+            conn.compression = parse_compression(fields.compress);
+            if (conn.compression & COMPRESS_LZ4) {
+                lz4_clients.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        log_out() << "[SERVER] Client identified as: " << conn.username
+                  << (conn.format == WireFormat::BINARY ? " (binary)" : "") << "\n";
+
+        // Everyone starts in the lobby, which announces the join and sends the user list
+        join_room(conn, DEFAULT_ROOM);
+        return;
+    }
+
+    if (!fields.type.empty()) {
+        handle_command(conn, fields);
+        return;
+    }
+
+    if (!fields.has_text) {
+        log_err() << "[SERVER] Rejecting frame without a valid text field (fd: " << conn.fd
+                  << ")\n";
+        return;
+    }
+    // Unescaping only shortens text, so only long texts are decoded to check it
+    std::string& text = text_scratch;
+    text.clear();
+    bool decoded = fields.text.size() >= MAX_MESSAGE_TEXT_LEN;
+    if (decoded) {
+        json_unescape(fields.text, text);
+        if (text.size() >= MAX_MESSAGE_TEXT_LEN) {
+            log_err() << "[SERVER] Rejecting oversized message from " << conn.username << "\n";
+            return;
+        }
+    }
+    // Without a time the server stamps the message; a bad one is refused
+    uint64_t timestamp = parse_epoch_ms(fields.time);
+    if (timestamp == 0 && !fields.time.empty()) {
+        log_err() << "[SERVER] Rejecting message with an invalid time from " << conn.username
+                  << "\n";
+        return;
+    }
+
+    std::string& room = room_scratch;
+    json_unescape(fields.room, room);
+    if (!resolve_room(conn, room)) {
+        return;
+    }
+
+    if (config.log_messages) {
+        log_out() << "[SERVER] Message from " << conn.username << ": " << line << "\n";
+    }
+    metrics.messages_received.add();
+
+    // Encoded once per format; every recipient queue shares the frames. The
+    // line is relayed as is only if it already names this connection's user,
+    // a valid time and its room, as the binary frame, the bridge and the
+    // log do; otherwise it is rebuilt, so no client can speak for another.
+    EncodedMessage message;
+    bool relay_as_is = fields.user == conn.username && timestamp != 0 &&
+                       (!fields.room.empty() || room == DEFAULT_ROOM);
+    bool need_binary = binary_clients.load(std::memory_order_relaxed) > 0;
+    bool bridged = config.bridge != nullptr && room == DEFAULT_ROOM;
+    timestamp = timestamp ? timestamp : now_epoch_ms();
+    if (!decoded && (!relay_as_is || need_binary || bridged)) {
+        json_unescape(fields.text, text);
+    }
+    char time[MAX_TIMESTAMP_LEN];
+    std::string_view time_text;
+    if (!relay_as_is || bridged) {
+        time_text = std::string_view(time, format_epoch_ms(timestamp, time));
+    }
+    if (bridged) {
+        config.bridge->publish(conn.username, time_text, text);
+    }
+    message.json = relay_as_is
+        ? make_line_frame(line)
+        : make_json_message_frame(conn.username, text, time_text, room);
+    if (need_binary) {
+        message.binary = make_binary_frame(BinaryType::CHAT, conn.user_id, timestamp,
+                                           conn.username, room, text);
+        add_lz4(message);
+    }
+    broadcast(room, message, &conn);
+}
+
+void Reactor::handle_binary_frame(Connection& conn, const BinaryHeader& header,
+                                  std::string_view payload) {
+    if (header.flags != 0) {
+        log_err() << "[SERVER] Rejecting compressed frame from client (fd: " << conn.fd << ")\n";
+        return;
+    }
+    std::string_view requested = payload.substr(header.name_len, header.room_len);
+    std::string_view text = payload.substr(header.name_len + header.room_len);
+
+    if (header.type == static_cast<uint8_t>(BinaryType::CONTROL)) {
+        // Commands are the same JSON objects JSON clients send
+        ChatFields fields;
+        JsonError error = scanner.parse(text, fields);
+        if (error != JsonError::NONE || fields.type.empty()) {
+            log_err() << "[SERVER] Rejecting malformed control frame (fd: " << conn.fd << ")\n";
+            return;
+        }
+        handle_command(conn, fields);
+        return;
+    }
+    if (header.type != static_cast<uint8_t>(BinaryType::CHAT)) {
+        return;
+    }
+    if (text.size() >= MAX_MESSAGE_TEXT_LEN) {
+        log_err() << "[SERVER] Rejecting oversized message from " << conn.username << "\n";
+        return;
+    }
+
+    std::string& room = room_scratch;
+    room.assign(requested);   // Raw bytes: binary frames carry no escapes
+    if (!resolve_room(conn, room)) {
+        return;
+    }
+
+    if (config.log_messages) {
+        log_out() << "[SERVER] Message from " << conn.username << ": " << text << "\n";
+    }
+    metrics.messages_received.add();
+
+    uint64_t timestamp = header.timestamp ? header.timestamp : now_epoch_ms();
+    if (config.bridge != nullptr && room == DEFAULT_ROOM) {
+        char time[MAX_TIMESTAMP_LEN];
+        std::string_view time_text(time, format_epoch_ms(timestamp, time));
+        config.bridge->publish(conn.username, time_text, text);
+    }
+    broadcast(room, encode_chat(conn.user_id, conn.username, text, timestamp, room), &conn);
+}
+
+// {"type":"join"|"leave"|"resync"|"history","room":"..."}
+void Reactor::handle_command(Connection& conn, const ChatFields& fields) {
+    std::string room;
+    json_unescape(fields.room, room);
+    if (room.empty() || room.size() >= MAX_ROOM_NAME_LEN ||
+        room.find('\0') != std::string::npos) {
+        log_err() << "[SERVER] Rejecting command with invalid room (fd: " << conn.fd << ")\n";
+        return;
+    }
+
+    if (fields.type == "join") {
+        join_room(conn, room);
+    } else if (fields.type == "leave") {
+        leave_room(conn, room);
+    } else if (fields.type == "history") {
+        send_history(conn, room, fields);
+    } else if (fields.type == "resync") {
+        // Sent by clients that saw a gap in the presence deltas
+        if (find_subscription(conn, room) != nullptr) {
+            send_user_list(conn, room);
+        }
+    } else {
+        log_err() << "[SERVER] Ignoring unknown command from " << conn.username << "\n";
+    }
+}
+
+// Room a message goes to: room, already decoded, or the sender's current
+// room if it is empty. The sender has to be a member.
+bool Reactor::resolve_room(Connection& conn, std::string& room) {
+    if (room.empty()) {
+        room = conn.current_room;
+    }
+    if (room.size() >= MAX_ROOM_NAME_LEN) {
+        log_err() << "[SERVER] Dropping message from " << conn.username
+                  << " with an oversized room name\n";
+        return false;
+    }
+    if (room.empty() || find_subscription(conn, room) == nullptr) {
+        log_err() << "[SERVER] Dropping message from " << conn.username
+                  << " to a room it has not joined\n";
+        return false;
+    }
+    return true;
+}
+
+void Reactor::join_room(Connection& conn, const std::string& name) {
+    if (find_subscription(conn, name) != nullptr) {
+        conn.current_room = name;
+        return;
+    }
+
+    Room& room = rooms[name];
+    conn.rooms.push_back(Subscription{name, &room, room.members.size()});
+    room.members.push_back(conn.id);
+    conn.current_room = name;
+    log_out() << "[SERVER] " << conn.username << " joined room " << name << "\n";
+
+    announce(ShardEvent::USER_JOINED, name, conn,
+             server_message(conn.username + " joined the chat", name));
+    send_user_list(conn, name);
+    if (config.log != nullptr && config.history > 0) {
+        replay_history(conn, name, config.log->last(name, config.history));
+    }
+}
+
+// O(1): the room's last member takes the leaving connection's slot
+void Reactor::leave_room(Connection& conn, const std::string& name) {
+    Subscription* sub = find_subscription(conn, name);
+    if (sub == nullptr) {
+        return;
+    }
+
+    Room* room = sub->room;
+    size_t slot = sub->slot;
+    SlabId moved = room->members.back();
+    room->members[slot] = moved;
+    room->members.pop_back();
+    if (moved != conn.id) {
+        find_subscription(*connections.get(moved), name)->slot = slot;
+    }
+    if (room->members.empty()) {
+        rooms.erase(name);
+    }
+
+    *sub = std::move(conn.rooms.back());
+    conn.rooms.pop_back();
+    if (conn.current_room == name) {
+        conn.current_room = conn.rooms.empty() ? std::string() : conn.rooms.back().name;
+    }
+    log_out() << "[SERVER] " << conn.username << " left room " << name << "\n";
+
+    announce(ShardEvent::USER_LEFT, name, conn,
+             server_message(conn.username + " left the chat", name));
+}
+
+Subscription* Reactor::find_subscription(Connection& conn, const std::string& name) {
+    for (Subscription& sub : conn.rooms) {
+        if (sub.name == name) {
+            return &sub;
+        }
+    }
+    return nullptr;
+}
+
+EncodedMessage Reactor::encode_chat(uint32_t user_id, std::string_view user,
+                                    std::string_view text, uint64_t timestamp,
+                                    const std::string& room) {
+    EncodedMessage message;
+    char time[MAX_TIMESTAMP_LEN];
+    message.json = make_json_message_frame(user, text,
+                                           std::string_view(time, format_epoch_ms(timestamp, time)),
+                                           room == DEFAULT_ROOM ? std::string_view() : room);
+    if (binary_clients.load(std::memory_order_relaxed) > 0) {
+        message.binary = make_binary_frame(BinaryType::CHAT, user_id, timestamp, user, room, text);
+        add_lz4(message);
+    }
+    return message;
+}
+
+// Chat line from the server itself to a room, in both formats
+EncodedMessage Reactor::server_message(const std::string& text, const std::string& room) {
+    return encode_chat(0, "SERVER", text, now_epoch_ms(), room);
+}
+
+// A JSON control object (with its newline) for every recipient format
+EncodedMessage Reactor::control_message(const std::string& json) {
+    EncodedMessage message;
+    message.json = make_frame(json);
+    if (binary_clients.load(std::memory_order_relaxed) > 0) {
+        std::string_view body(json.data(), json.size() - 1);
+        message.binary = make_binary_frame(BinaryType::CONTROL, 0, now_epoch_ms(), "", "", body);
+        add_lz4(message);
+    }
+    return message;
+}
+
+// A JSON control object (with its newline) framed for conn's format
+FrameRef Reactor::control_frame(const Connection& conn, const std::string& json, bool notice) {
+    if (conn.format == WireFormat::BINARY) {
+        std::string_view body(json.data(), json.size() - 1);
+        return compressed_for(conn, make_binary_frame(BinaryType::CONTROL, 0, now_epoch_ms(), "",
+                                                      "", body, notice));
+    }
+    return make_frame(json, notice);
+}
+
+// A binary frame for conn alone: its LZ4 form, if conn takes LZ4 and that is smaller
+FrameRef Reactor::compressed_for(const Connection& conn, FrameRef binary) {
+    if (conn.compression & COMPRESS_LZ4) {
+        FrameRef lz4 = compress_lz4(*binary.get());
+        if (lz4) {
+            metrics.compression_saved.add(binary->size() - lz4->size());
+            return lz4;
+        }
+    }
+    return binary;
+}
+
+// Queue a frame; it is written now if the socket has room, otherwise when
+// EPOLLOUT reports the client is reading again. Never blocks the loop.
+void Reactor::queue_send(Connection& conn, const FrameRef& frame) {
+    if (conn.closing || conn.shut) {
+        return;
+    }
+    if (conn.outq.size() >= config.send_queue_limit && !make_room(conn)) {
+        return;
+    }
+
+    conn.outq.push_back(frame);
+    metrics.queue_depth.record(conn.outq.size());
+    if (conn.writable) {
+        hold_for_flush(conn, frame->size());
+    }
+}
+
+// Put off writing a queued frame so later ones share the write: until the
+// end of this loop iteration, or the coalescing window while it is open.
+// A connection holding coalesce_bytes, or a full queue, is written at
+// once: held frames must not count against a client that is reading.
+void Reactor::hold_for_flush(Connection& conn, size_t bytes) {
+    conn.held_bytes += bytes;
+    held_frames++;
+    if (conn.held_bytes >= config.coalesce_bytes || conn.outq.size() >= config.send_queue_limit) {
+        flush(conn);
+        return;
+    }
+    if (conn.flush_held) {
+        return;
+    }
+    if (flush_list.empty()) {
+        flush_deadline = coalesce_window > 0 ? monotonic_ns() + coalesce_window : 0;
+    }
+    conn.flush_held = true;
+    flush_list.push_back(conn.id);
+}
+
+// Write the held queues once the window has passed (always when forced or
+// no longer reading), then adapt the window: it widens while the loop is
+// busy, so writes carry several frames, and closes under light load so a
+// lone message goes out without waiting.
+void Reactor::flush_held(bool force) {
+    if (flush_list.empty()) {
+        return;
+    }
+    uint64_t now = monotonic_ns();
+    if (!force && reading && flush_deadline > now) {
+        return;
+    }
+
+    size_t queues = 0;
+    for (SlabId conn_id : flush_list) {
+        Connection* conn = connections.get(conn_id);
+        if (conn == nullptr || !conn->flush_held) {
+            continue;
+        }
+        conn->flush_held = false;
+        queues++;
+        if (conn->writable && !conn->closing && !conn->shut) {
+            flush(*conn);
+        }
+    }
+    flush_list.clear();
+
+    uint64_t max_window = uint64_t(config.coalesce_us) * 1000;
+    if (max_window > 0) {
+        bool busy = held_frames >= 2 * queues || now - last_flush < max_window;
+        if (busy) {
+            coalesce_window = std::min(std::max(coalesce_window * 2, MIN_WINDOW_NS), max_window);
+        } else {
+            coalesce_window /= 2;
+            if (coalesce_window < MIN_WINDOW_NS) {
+                coalesce_window = 0;
+            }
+        }
+    }
+    held_frames = 0;
+    last_flush = now;
+}
+
+// How long the loop may wait for events: timeout_ms, or less while held
+// frames wait for the coalescing window to close
+uint64_t Reactor::wait_ns(int timeout_ms) const {
+    uint64_t wait = uint64_t(timeout_ms) * 1000000;
+    if (!flush_list.empty()) {
+        uint64_t now = monotonic_ns();
+        wait = std::min(wait, flush_deadline > now ? flush_deadline - now : 0);
+    }
+    return wait;
+}
+
+// Apply the slow-consumer policy to a full queue; false if the frame must not be queued
+bool Reactor::make_room(Connection& conn) {
+    // A partially written front frame has to be finished, and frames in
+    // an io_uring send in flight stay where the completion expects them
+    size_t first = std::max<size_t>(conn.out_offset > 0 ? 1 : 0, conn.in_flight);
+
+    if (conn.dropped == 0) {
+        log_out() << "[SERVER] Client " << conn.username << " is not keeping up (queue: "
+                  << conn.outq.size() << " frames)\n";
+    }
+
+    switch (config.slow_consumer) {
+    case SlowConsumerPolicy::DISCONNECT:
+        log_out() << "[SERVER] Disconnecting slow client " << conn.username << "\n";
+        metrics.slow_disconnects.add();
+        mark_closing(conn);
+        return false;
+
+    case SlowConsumerPolicy::DROP_OLDEST:
+        if (first < conn.outq.size()) {
+            if (!conn.outq.at(first)->is_notice()) {
+                conn.dropped++;
+                metrics.frames_dropped.add();
+            }
+            conn.outq.erase(first);
+        }
+        return true;
+
+    case SlowConsumerPolicy::COALESCE:
+        for (size_t i = first; i < conn.outq.size(); i++) {
+            if (!conn.outq.at(i)->is_notice()) {
+                conn.dropped++;
+                conn.skipped++;
+                metrics.frames_dropped.add();
+            }
+        }
+        conn.outq.truncate(first);
+        conn.outq.push_back(control_frame(conn, "{\"type\":\"skipped\",\"count\":" +
+                                                std::to_string(conn.skipped) + "}\n", true));
+        return true;
+    }
+    return true;
+}
+
+// Write the queue. With tcp_cork, a queue that takes more than one write
+// is corked meanwhile, so the kernel sends full segments.
+void Reactor::flush(Connection& conn) {
+    conn.held_bytes = 0;
+    if (ring) {
+        submit_send(conn);
+        return;
+    }
+    bool cork = config.tcp_cork && conn.outq.size() > MAX_IOV;
+    for (size_t i = 0; config.tcp_cork && !cork && conn.outq.size() > 1 && i < conn.outq.size(); i++) {
+        cork = conn.outq.at(i)->is_file();   // sendfile() and sendmsg() for one flush
+    }
+    int on = 1;
+    int off = 0;
+    if (cork) {
+        setsockopt(conn.fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+        metrics.syscalls.add();
+    }
+    write_queue(conn);
+    if (cork && !conn.closing) {
+        setsockopt(conn.fd, IPPROTO_TCP, TCP_CORK, &off, sizeof(off));
+        metrics.syscalls.add();
+    }
+}
+
+// Write as much of the queue as the socket takes, many frames per sendmsg().
+// File frames (history replay) go out with sendfile() on their own.
+void Reactor::write_queue(Connection& conn) {
+    while (!conn.outq.empty()) {
+        ssize_t sent;
+        const Frame* front = conn.outq.front().get();
+        if (front->is_file()) {
+            off_t offset = front->region().offset + conn.out_offset;
+            sent = sendfile(conn.fd, front->region().fd, &offset, front->size() - conn.out_offset);
+            metrics.write_batch.record(1);
+        } else {
+            iovec iov[MAX_IOV];
+            size_t limit = std::min(conn.outq.size(), MAX_IOV);
+            size_t count = 0;
+            for (; count < limit; count++) {
+                const Frame* frame = conn.outq.at(count).get();
+                if (frame->is_file()) {
+                    break;
+                }
+                size_t skip = count == 0 ? conn.out_offset : 0;
+                iov[count].iov_base = const_cast<char*>(frame->data()) + skip;
+                iov[count].iov_len = frame->size() - skip;
+            }
+
+            msghdr msg{};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = count;
+            sent = sendmsg(conn.fd, &msg, MSG_NOSIGNAL);
+            metrics.write_batch.record(count);
+        }
+        metrics.syscalls.add();
+        if (sent > 0) {
+            this->sent(conn, sent);
+            continue;
+        }
+        if (sent == -1 && errno == EINTR) {
+            continue;
+        }
+        if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            conn.writable = false; // EPOLLOUT fires when the socket drains
+            return;
+        }
+
+        log_err() << "[SERVER] Failed to send to client " << conn.username << "\n";
+        mark_closing(conn);
+        return;
+    }
+
+    if (conn.state == ConnState::WELCOME) {
+        conn.state = ConnState::USERNAME;
+    }
+}
+
+// Retire the frames, or the part of the front frame, the kernel took
+void Reactor::sent(Connection& conn, size_t bytes) {
+    metrics.bytes_sent.add(bytes);
+    while (bytes > 0) {
+        const Frame* frame = conn.outq.front().get();
+        if (frame->is_notice() && conn.out_offset == 0) {
+            conn.skipped = 0; // Reported by this notice
+        }
+        size_t left = frame->size() - conn.out_offset;
+        if (bytes < left) {
+            conn.out_offset += bytes;
+            break;
+        }
+        bytes -= left;
+        conn.outq.pop_front();
+        conn.out_offset = 0;
+    }
+}
+
+// Broadcast message to every member of room except sender, on all workers,
+// and record it in the history
+void Reactor::broadcast(const std::string& room, const EncodedMessage& message,
+                        const Connection* sender) {
+    // Text that escapes to more than a frame could not be replayed from the log
+    if (message.json->size() > MAX_FRAME_LEN + 1) {
+        log_err() << "[SERVER] Dropping message to room " << room << " longer than a frame\n";
+        return;
+    }
+    if (config.log != nullptr) {
+        config.log->append(room, message.json);
+    }
+    deliver_local(room, message, sender);
+    for (Reactor* peer : peers) {
+        if (peer->post(ShardEvent{ShardEvent::BROADCAST, room, std::string(), message})) {
+            metrics.syscalls.add();
+        }
+    }
+}
+
+// Publish a room membership change together with its notice to every worker.
+// The subject is not sent its own notice.
+void Reactor::announce(ShardEvent::Type type, const std::string& room,
+                       const Connection& subject, const EncodedMessage& message) {
+    apply_presence(type, room, subject.username, &subject);
+    deliver_local(room, message, &subject);
+    for (Reactor* peer : peers) {
+        if (peer->post(ShardEvent{type, room, subject.username, message})) {
+            metrics.syscalls.add();
+        }
+    }
+}
+
+// Record a membership change and send the delta to this worker's members
+// of room. The subject gets a snapshot instead, so it is skipped.
+void Reactor::apply_presence(ShardEvent::Type type, const std::string& room,
+                             const std::string& username, const Connection* subject) {
+    const char* kind;
+    RoomPresence* entry;
+    if (type == ShardEvent::USER_JOINED) {
+        entry = &presence[room];
+        entry->users[username]++;
+        kind = "presence_add";
+    } else if (type == ShardEvent::USER_LEFT) {
+        auto it = presence.find(room);
+        if (it == presence.end()) {
+            return;
+        }
+        auto user = it->second.users.find(username);
+        if (user == it->second.users.end()) {
+            return;
+        }
+        if (--user->second == 0) {
+            it->second.users.erase(user);
+            if (it->second.users.empty()) {
+                presence.erase(it); // Nobody left to tell
+                return;
+            }
+        }
+        entry = &it->second;
+        kind = "presence_remove";
+    } else {
+        return;
+    }
+
+    entry->version++;
+    if (rooms.find(room) == rooms.end()) {
+        return; // No local members; only the version matters
+    }
+
+    std::string json = "{\"type\":\"";
+    json += kind;
+    json += "\",";
+    append_room_field(json, room);
+    json += "\"seq\":" + std::to_string(entry->version) + ",\"user\":\"";
+    append_json_escaped(json, username);
+    json += "\"}\n";
+    deliver_local(room, control_message(json), subject);
+}
+
+// Fan out to this worker's members of room: O(members), not O(connections)
+void Reactor::deliver_local(const std::string& room, const EncodedMessage& message,
+                            const Connection* sender) {
+    auto it = rooms.find(room);
+    if (it == rooms.end()) {
+        return;
+    }
+    uint64_t start = monotonic_ns();
+    uint64_t queued = 0;
+    for (SlabId member : it->second.members) {
+        Connection& conn = *connections.get(member);
+        if (&conn != sender) {
+            // A binary client that joined while this was being encoded misses it
+            const FrameRef& frame = message.frame_for(conn);
+            if (&frame == &message.lz4) {
+                metrics.compression_saved.add(message.binary->size() - frame->size());
+            }
+            if (frame) {
+                queue_send(conn, frame);
+                queued++;
+            }
+        }
+    }
+    metrics.deliveries.add(queued);
+    metrics.fanout_ns.record(monotonic_ns() - start);
+}
+
+// Send the members of room, on every worker, to a specific client. The
+// seq is the version later deltas count up from.
+void Reactor::send_user_list(Connection& conn, const std::string& room) {
+    std::string json = "{\"type\":\"userlist\",";
+    append_room_field(json, room);
+    auto entry = presence.find(room);
+    uint64_t version = entry != presence.end() ? entry->second.version : 0;
+    json += "\"seq\":" + std::to_string(version) + ",\"users\":[";
+    bool first = true;
+    if (entry != presence.end()) {
+        for (const auto& user : entry->second.users) {
+            for (int i = 0; i < user.second; i++) {
+                if (!first) json += ",";
+                json += "\"";
+                append_json_escaped(json, user.first);
+                json += "\"";
+                first = false;
+            }
+        }
+    }
+    json += "]}\n";
+
+    queue_send(conn, control_frame(conn, json));
+}
+
+// {"type":"history","room":"...","count":N} for the last N messages, or
+// "since":"<time>" for everything logged from that second on
+void Reactor::send_history(Connection& conn, const std::string& room, const ChatFields& fields) {
+    if (config.log == nullptr || find_subscription(conn, room) == nullptr) {
+        return;
+    }
+
+    if (!fields.since.empty()) {
+        uint64_t since = parse_epoch_ms(fields.since);
+        if (since == 0) {
+            log_err() << "[SERVER] Rejecting history request with invalid time (fd: "
+                      << conn.fd << ")\n";
+            return;
+        }
+        replay_history(conn, room, config.log->since(room, since));
+        return;
+    }
+
+    size_t count = 0;
+    for (char c : fields.count) {
+        if (c < '0' || c > '9') {
+            log_err() << "[SERVER] Rejecting history request with invalid count (fd: "
+                      << conn.fd << ")\n";
+            return;
+        }
+        count = std::min<size_t>(count * 10 + (c - '0'), UINT32_MAX);
+    }
+    replay_history(conn, room, config.log->last(room, count));
+}
+
+// Queue logged messages for conn. JSON clients get the segment bytes as
+// they are, with sendfile(); binary clients get each line translated, and
+// packed into BATCH frames if they take deflate.
+void Reactor::replay_history(Connection& conn, const std::string& room,
+                             const std::vector<LogSpan>& spans) {
+    bool batched = conn.compression & COMPRESS_DEFLATE;
+    for (const LogSpan& span : spans) {
+        if (conn.format == WireFormat::JSON) {
+            FileRegion region{span.segment->fd, off_t(span.offset), span.segment};
+            queue_send(conn, make_file_frame(std::move(region), span.length));
+            continue;
+        }
+
+        std::string_view bytes(span.segment->map + span.offset, span.length);
+        ChatFields fields;
+        std::string user;
+        std::string text;
+        while (!bytes.empty()) {
+            size_t end = bytes.find('\n');
+            std::string_view line = bytes.substr(0, end);
+            bytes.remove_prefix(end + 1);
+            if (scanner.parse(line, fields) != JsonError::NONE) {
+                continue;
+            }
+            json_unescape(fields.user, user);
+            json_unescape(fields.text, text);
+            uint64_t timestamp = parse_epoch_ms(fields.time);
+            if (batched) {
+                replay_batch.add(BinaryType::CHAT, 0, timestamp, user, room, text);
+                if (replay_batch.full()) {
+                    queue_batch(conn);
+                }
+            } else {
+                queue_send(conn, compressed_for(conn, make_binary_frame(BinaryType::CHAT, 0,
+                                                                        timestamp, user, room,
+                                                                        text)));
+            }
+        }
+    }
+    if (batched) {
+        queue_batch(conn);
+    }
+}
+
+// Queue the replayed frames packed so far as one BATCH frame
+void Reactor::queue_batch(Connection& conn) {
+    if (replay_batch.empty()) {
+        return;
+    }
+    size_t raw = replay_batch.pending();
+    FrameRef batch = replay_batch.finish();
+    if (!batch) {
+        log_err() << "[SERVER] Failed to compress history for " << conn.username << "\n";
+        return;
+    }
+    metrics.compression_saved.add(raw - std::min(raw, batch->size()));
+    queue_send(conn, batch);
+}
+
+// Charge a frame to the connection's and its user's buckets. Once either
+// is empty the connection is not read until it refills: further frames
+// wait in the socket buffer and then in the sender's TCP window, not in
+// server memory, and other clients never pay for their fan-out.
+void Reactor::charge_frame(Connection& conn) {
+    if (conn.closing) {
+        return;
+    }
+    uint64_t now = 0;
+    uint64_t ready = 0;
+    bool by_user = false;
+    if (config.connection_rate.enabled()) {
+        now = monotonic_ns();
+        ready = conn.bucket.take(config.connection_rate, now);
+    }
+    if (conn.user_bucket) {
+        now = now ? now : monotonic_ns();
+        uint64_t user_ready = conn.user_bucket->take(config.user_rate, now);
+        by_user = user_ready > ready;
+        ready = std::max(ready, user_ready);
+    }
+    if (ready <= now) {
+        return;
+    }
+
+    conn.throttled = true;
+    conn.resume_at = ready;
+    throttled.push_back(conn.id);
+    (by_user ? metrics.user_throttles : metrics.connection_throttles).add();
+}
+
+// epoll timeout that wakes the loop for the first throttled connection due
+int Reactor::throttle_timeout(int timeout) {
+    if (throttled.empty()) {
+        return timeout;
+    }
+    uint64_t now = monotonic_ns();
+    for (SlabId conn_id : throttled) {
+        Connection* conn = connections.get(conn_id);
+        if (conn == nullptr || conn->resume_at <= now) {
+            return 0;
+        }
+        uint64_t wait_ms = (conn->resume_at - now + 999999) / 1000000;
+        timeout = std::min<uint64_t>(timeout, wait_ms);
+    }
+    return timeout;
+}
+
+// Read again from connections whose limit has refilled. Edge-triggered
+// epoll will not report the data that queued up meanwhile, so buffered
+// frames are handled and the socket drained here.
+void Reactor::resume_throttled() {
+    if (throttled.empty()) {
+        return;
+    }
+    uint64_t now = monotonic_ns();
+    size_t kept = 0;
+    for (size_t i = 0; i < throttled.size(); i++) {
+        Connection* conn = connections.get(throttled[i]);
+        if (conn == nullptr || conn->closing) {
+            continue;
+        }
+        if (conn->resume_at > now) {
+            throttled[kept++] = throttled[i];
+            continue;
+        }
+        conn->throttled = false;
+        process_lines(*conn);
+        if (!conn->throttled && !conn->closing) {
+            read_available(*conn);
+        }
+    }
+    // Connections throttled again above were appended, and kept by this loop
+    throttled.resize(kept);
+}
+
+// Stop accepting and reading. Clients that connect meanwhile wait in the
+// listen backlog: for the next process, or until the socket is closed.
+void Reactor::stop_input() {
+    reading = false;
+    if (ring) {
+        cancel_accept();
+    } else {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, listen_fd, nullptr);
+    }
+    input_stopped.store(true, std::memory_order_release);
+}
+
+// Shut the write side of each connection whose queue is written, then read
+// until the client closes: close() on a socket with unread input would
+// reset it and lose what the kernel had not sent yet. True once every
+// connection is gone or the deadline has passed.
+bool Reactor::drain_connections() {
+    // Every worker has stopped reading, so this is the last of their traffic
+    drain_inbox();
+
+    size_t open = 0;
+    connections.for_each([&](SlabId, Connection& conn) {
+        if (!conn.closing && !conn.shut && conn.outq.empty() && conn.in_flight == 0) {
+            shutdown(conn.fd, SHUT_WR);
+            conn.shut = true;
+            discard_input(conn);
+            if (ring && !conn.closing) {
+                feed(conn); // Receives again, to see the client close
+            }
+        }
+        open += conn.closing ? 0 : 1;
+    });
+    reap_closed();
+
+    if (open == 0) {
+        return true;
+    }
+    if (monotonic_ns() >= drain_deadline.load(std::memory_order_relaxed)) {
+        log_out() << "[SERVER] Worker " << id << " closing " << open
+                  << " connections that did not drain in time\n";
+        return true;
+    }
+    return false;
+}
+
+int Reactor::drain_timeout() {
+    uint64_t now = monotonic_ns();
+    uint64_t deadline = drain_deadline.load(std::memory_order_relaxed);
+    return deadline > now ? static_cast<int>((deadline - now + 999999) / 1000000) : 0;
+}
+
+void Reactor::discard_input(Connection& conn) {
+    char scratch[4096];
+    while (true) {
+        ssize_t n = recv(conn.fd, scratch, sizeof(scratch), 0);
+        if (n > 0 || (n == -1 && errno == EINTR)) {
+            continue;
+        }
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+        mark_closing(conn);
+        return;
+    }
+}
+
+void Reactor::export_state(HandoffState& state) {
+    // Traffic posted before the other workers stopped still belongs here
+    drain_inbox();
+    reap_closed();
+
+    state.next_user_id = next_user_id.load();
+    if (state.presence.size() <= size_t(id)) {
+        state.presence.resize(id + 1);
+    }
+    state.presence[id] = presence;
+
+    connections.for_each([&](SlabId, Connection& conn) {
+        ConnectionState& out = state.connections.emplace_back();
+        out.fd = conn.fd;
+        out.worker = id;
+        out.state = conn.state;
+        out.format = conn.format;
+        out.compression = conn.compression;
+        out.user_id = conn.user_id;
+        out.username = conn.username;
+        for (const Subscription& sub : conn.rooms) {
+            out.rooms.push_back(sub.name);
+        }
+        out.current_room = conn.current_room;
+        out.pending_in = conn.inbuf.peek();
+        for (const ParkedBuffer& buffer : conn.parked) {
+            out.pending_in.append(ring->buffer(buffer.id) + buffer.offset,
+                                  buffer.length - buffer.offset);
+        }
+
+        // The unsent tail of the queue, history file frames included
+        for (size_t i = 0; i < conn.outq.size(); i++) {
+            const Frame* frame = conn.outq.at(i).get();
+            size_t skip = i == 0 ? conn.out_offset : 0;
+            if (!frame->is_file()) {
+                out.pending_out.append(frame->data() + skip, frame->size() - skip);
+                continue;
+            }
+            size_t start = out.pending_out.size();
+            size_t len = frame->size() - skip;
+            out.pending_out.resize(start + len);
+            size_t done = 0;
+            while (done < len) {
+                ssize_t n = pread(frame->region().fd, &out.pending_out[start + done], len - done,
+                                  frame->region().offset + skip + done);
+                if (n <= 0) {
+                    break;
+                }
+                done += n;
+            }
+            out.pending_out.resize(start + done);
+        }
+    });
+}
+
+void Reactor::adopt(const HandoffState& state) {
+    uint32_t ids = next_user_id.load();
+    while (ids < state.next_user_id && !next_user_id.compare_exchange_weak(ids, state.next_user_id)) {
+    }
+    if (size_t(id) < state.presence.size()) {
+        presence = state.presence[id];
+    }
+
+    size_t workers = peers.size() + 1;
+    size_t adopted = 0;
+    for (const ConnectionState& from : state.connections) {
+        if (size_t(from.worker) % workers != size_t(id)) {
+            continue;
+        }
+
+        SlabId conn_id = connections.emplace(from.fd);
+        Connection& conn = *connections.get(conn_id);
+        conn.id = conn_id;
+        if (!watch_client(conn)) {
+            log_err() << "[SERVER] Failed to register inherited client socket\n";
+            connections.erase(conn_id);
+            close(from.fd);
+            continue;
+        }
+
+        // Registering with epoll reports the socket's current readiness, so
+        // input that arrived during the handoff is read on the first pass
+        conn.state = from.state;
+        conn.format = from.format;
+        conn.compression = from.compression;
+        conn.user_id = from.user_id;
+        conn.username = from.username;
+        if (conn.format == WireFormat::BINARY) {
+            binary_clients.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (conn.compression & COMPRESS_LZ4) {
+            lz4_clients.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (conn.state == ConnState::CHATTING && config.user_buckets != nullptr) {
+            conn.user_bucket = config.user_buckets->acquire(conn.username);
+        }
+        for (const std::string& name : from.rooms) {
+            Room& room = rooms[name];
+            conn.rooms.push_back(Subscription{name, &room, room.members.size()});
+            room.members.push_back(conn_id);
+        }
+        conn.current_room = from.current_room;
+        conn.inbuf.append(from.pending_in.data(), from.pending_in.size());
+        if (!from.pending_out.empty()) {
+            conn.outq.push_back(make_frame(from.pending_out));
+        }
+        if (ring) {
+            flush(conn);
+            process_lines(conn);
+        }
+        metrics.connections_open.add();
+        adopted++;
+    }
+    if (adopted > 0) {
+        log_out() << "[SERVER] Worker " << id << " adopted " << adopted << " connections\n";
+    }
+}
+
+void Reactor::resume() {
+    phase.store(RunPhase::RUNNING);
+    input_stopped.store(false);
+    reading = true;
+
+    if (ring) {
+        ring_closing = false;
+        arm_accept();
+        arm_wake();
+    } else {
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.u64 = LISTEN_TOKEN;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev);
+    }
+
+    // Readiness reported while input was stopped was consumed unread, and
+    // io_uring requests were cancelled
+    std::vector<SlabId> ids;
+    connections.for_each([&](SlabId conn_id, Connection&) { ids.push_back(conn_id); });
+    for (SlabId conn_id : ids) {
+        Connection* conn = connections.get(conn_id);
+        if (conn == nullptr || conn->closing || conn->throttled) {
+            continue;
+        }
+        if (ring) {
+            flush(*conn);
+        }
+        process_lines(*conn);
+        if (!conn->closing && !conn->throttled) {
+            read_available(*conn);
+        }
+    }
+    reap_closed();
+}
+
+void Reactor::mark_closing(Connection& conn) {
+    if (!conn.closing) {
+        conn.closing = true;
+        closing.push_back(conn.id);
+    }
+}
+
+// Release closed connections; leave notices may close further clients
+void Reactor::reap_closed() {
+    while (!closing.empty()) {
+        SlabId conn_id = closing.back();
+        closing.pop_back();
+
+        Connection* entry = connections.get(conn_id);
+        if (entry == nullptr) {
+            continue;
+        }
+
+        // Leave rooms while still indexed; notices skip closing connections
+        Connection& conn = *entry;
+        while (!conn.rooms.empty()) {
+            std::string room = conn.rooms.back().name;
+            leave_room(conn, room);
+        }
+        if (conn.format == WireFormat::BINARY) {
+            binary_clients.fetch_sub(1, std::memory_order_relaxed);
+        }
+        if (conn.compression & COMPRESS_LZ4) {
+            lz4_clients.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+        // The slot is reused by the next accept; its generation changes
+        int fd = conn.fd;
+        if (ring) {
+            cancel_requests(conn);
+        } else {
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+        }
+        connections.erase(conn_id);
+        metrics.connections_open.sub();
+        close(fd);
+        metrics.syscalls.add(ring ? 1 : 2);
+    }
+}
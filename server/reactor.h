@@ -0,0 +1,373 @@
+/*
+ * MIT License
+ * Event-loop reactor for the socket server (epoll or io_uring)
+ */
+
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include "compress.h"
+#include "frame.h"
+#include "json_scan.h"
+#include "line_buffer.h"
+#include "message_log.h"
+#include "metrics.h"
+#include "mpsc_queue.h"
+#include "rate_limit.h"
+#include "slab.h"
+#include "uring.h"
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+class ShmBridge;
+struct ConnectionState;
+struct HandoffState;
+
+// Protocol stage of a connection
+enum class ConnState {
+    WELCOME,   // Welcome frame queued, waiting for the kernel to take it
+    USERNAME,  // Waiting for the username line
+    CHATTING   // Message loop
+};
+
+// How a worker waits for and performs socket I/O
+enum class IoBackend {
+    EPOLL,   // Readiness events, then one syscall per recv/send
+    URING    // Completions: multishot accept and recv, batched sends
+};
+
+// What to do with a client whose outbound queue is full
+enum class SlowConsumerPolicy {
+    DROP_OLDEST,  // Discard the oldest unsent frame
+    DISCONNECT,   // Close the connection
+    COALESCE      // Replace the unsent backlog with one "skipped" notice
+};
+
+// How far a worker's loop has been asked to wind down
+enum class RunPhase {
+    RUNNING,
+    QUIESCE,   // Stop accepting and reading; keep delivering and writing
+    DRAIN,     // Also close each connection once its queue is written
+    HALT       // Leave the loop at once, connections untouched
+};
+
+// Framing a connection negotiated in its username line
+enum class WireFormat {
+    JSON,    // Newline-delimited JSON (default)
+    BINARY   // Length-prefixed frames, see wire_protocol.h
+};
+
+struct ReactorConfig {
+    IoBackend io = IoBackend::EPOLL;
+    bool sqpoll = false;            // io_uring: submit through a kernel polling thread
+    size_t send_queue_limit = 256;  // Frames queued per connection
+    uint32_t coalesce_us = 200;     // Longest a queued frame may wait to share a write
+    size_t coalesce_bytes = 32 * 1024;   // Held bytes written without waiting
+    bool tcp_cork = false;          // Cork a socket while one flush takes several writes
+    SlowConsumerPolicy slow_consumer = SlowConsumerPolicy::DROP_OLDEST;
+    MessageLog* log = nullptr;      // Chat history, shared by all workers; optional
+    size_t history = 0;             // Logged messages replayed on joining a room
+    ShmBridge* bridge = nullptr;    // Lobby relay to the shared-memory ring; optional
+    bool log_messages = true;       // Log every chat message relayed
+    RateLimit connection_rate;      // Frames a connection may send; unlimited by default
+    RateLimit user_rate;            // Frames all of a user's connections may send together
+    UserBuckets* user_buckets = nullptr;   // Shared by all workers when user_rate is set
+};
+
+// This worker's members of one room, kept dense so a fan-out walks only
+// the room's own connections. Members are removed by swapping in the last
+// one, so order is not preserved.
+struct Room {
+    std::vector<SlabId> members;   // Connection handles
+};
+
+// A room a connection belongs to, and where it sits in the member array
+struct Subscription {
+    std::string name;
+    Room* room;
+    size_t slot;
+};
+
+// Received bytes in an io_uring provided buffer, waiting for room in the
+// connection's line buffer
+struct ParkedBuffer {
+    uint16_t id;
+    uint32_t offset;
+    uint32_t length;
+};
+
+// The io_uring backend's gather list for a connection's send in flight,
+// reused by its next send. The frames it points at stay in the queue until
+// the send completes; if the connection is closed first, they move here so
+// they outlive it.
+struct SendBuffer {
+    msghdr msg;
+    std::vector<iovec> iov;
+    std::vector<FrameRef> orphaned;
+};
+
+// Per-connection state owned by the reactor
+struct Connection {
+    SlabId id;                  // Handle in the reactor's connection slab
+    int fd;
+    ConnState state;
+    WireFormat format;
+    uint8_t compression;        // Compression bits the binary client accepts
+    uint32_t user_id;           // Sender id carried in binary frames
+    std::string username;
+    std::vector<Subscription> rooms;
+    std::string current_room;   // Target of messages that name no room
+    LineBuffer inbuf;           // Received bytes not yet split into lines
+    FrameQueue outq;            // Frames not yet accepted by the kernel
+    size_t out_offset;          // Bytes of the front frame already sent
+    bool writable;              // Cleared on EAGAIN, set again by EPOLLOUT
+    bool flush_held;            // Queued frames wait in the worker's flush list
+    size_t held_bytes;          // Queued since the last write
+    bool closing;
+    bool shut;                  // Write side shut down while draining
+    bool throttled;             // Over its rate limit: not read until resume_at
+    uint64_t resume_at;         // Monotonic ns
+    TokenBucket bucket;
+    std::shared_ptr<SharedTokenBucket> user_bucket;
+    uint64_t dropped;           // Frames discarded by the slow-consumer policy
+    uint64_t skipped;           // Coalesced frames not yet reported to the client
+
+    // io_uring backend only
+    std::vector<ParkedBuffer> parked;   // Received, not yet in inbuf
+    std::unique_ptr<SendBuffer> send_buffer;   // Allocated by the first send
+    uint32_t in_flight;         // Frames at the front of outq being sent
+    bool recv_armed;            // Multishot receive posted and not finished
+    bool recv_cancelling;
+    bool peer_closed;           // Receive reported end of stream or an error
+
+    explicit Connection(int socket_fd)
+        : id(0), fd(socket_fd), state(ConnState::WELCOME), format(WireFormat::JSON),
+          compression(COMPRESS_NONE), user_id(0),
+          out_offset(0), writable(true), flush_held(false), held_bytes(0),
+          closing(false), shut(false), throttled(false), resume_at(0), dropped(0), skipped(0),
+          in_flight(0), recv_armed(false), recv_cancelling(false),
+          peer_closed(false) {}
+};
+
+// One outbound message, encoded once per wire format. The binary frame is
+// only built while binary clients are connected, and its LZ4 form while
+// LZ4 clients are, if the payload is large enough to be worth it.
+struct EncodedMessage {
+    FrameRef json;
+    FrameRef binary;
+    FrameRef lz4;
+
+    const FrameRef& frame_for(const Connection& conn) const {
+        if (conn.format == WireFormat::JSON) {
+            return json;
+        }
+        return lz4 && (conn.compression & COMPRESS_LZ4) ? lz4 : binary;
+    }
+};
+
+// Users in one room on any worker. The version counts membership changes
+// seen by this worker and numbers the presence deltas it sends, so a
+// client can tell when it missed one.
+struct RoomPresence {
+    uint64_t version = 0;
+    std::unordered_map<std::string, int> users;   // Username -> connections
+};
+
+// Event forwarded from one worker to the others
+struct ShardEvent {
+    enum Type { BROADCAST, USER_JOINED, USER_LEFT };
+
+    Type type;
+    std::string room;
+    std::string username;
+    EncodedMessage payload;   // Delivered to the room's local members
+};
+
+// Single-threaded event loop that owns the client sockets of one worker.
+// All sockets are non-blocking and registered edge-triggered, so every
+// readiness notification is drained until EAGAIN.
+//
+// With several workers each one accepts on its own SO_REUSEPORT socket and
+// keeps its own client table; traffic for clients of other workers is
+// posted to their lock-free inboxes and never takes a shared lock.
+//
+// Each worker indexes its own connections by room. Room membership across
+// all workers (for user lists) is replicated through join/leave events.
+class Reactor {
+public:
+    Reactor(int id, int listen_fd, const ReactorConfig& config);
+    ~Reactor();
+
+    bool init();
+    void set_peers(const std::vector<Reactor*>& workers);
+    void run();
+
+    // Thread-safe: move the loop on to a later phase and wake it. A drain
+    // gives up on unwritten queues at deadline_ns (monotonic).
+    void set_phase(RunPhase next, uint64_t deadline_ns = 0);
+
+    // True once the loop has stopped reading (or exited): from then on it
+    // starts no new broadcasts
+    bool quiesced() const { return input_stopped.load(std::memory_order_acquire); }
+
+    // Thread-safe: queue an event for this worker and wake its loop. True
+    // if that took a syscall (the loop was not already due to wake).
+    bool post(ShardEvent event);
+
+    // Hot restart. Only while the loop is not running: export adds this
+    // worker's connections and presence to state without changing them;
+    // adopt takes over the connections a predecessor's worker of the same
+    // index (modulo the worker count) owned; resume picks up again after
+    // an export nobody took.
+    void export_state(HandoffState& state);
+    void adopt(const HandoffState& state);
+    void resume();
+
+    // Safe to read from any thread
+    const WorkerMetrics& stats() const { return metrics; }
+
+    // Chat line in both formats; the binary frame is built only while binary
+    // clients are connected, the LZ4 one while LZ4 clients are. The JSON
+    // form names the room unless it is the lobby.
+    static EncodedMessage encode_chat(uint32_t user_id, std::string_view user,
+                                      std::string_view text, uint64_t timestamp,
+                                      const std::string& room);
+
+private:
+    int id;
+    int listen_fd;
+    ReactorConfig config;
+    int epoll_fd;
+    int wake_fd;
+    Slab<Connection> connections;   // Handles double as epoll tokens and io_uring user data
+    std::vector<SlabId> closing;
+    std::vector<SlabId> throttled;   // Connections waiting for their rate limit
+    std::vector<Reactor*> peers;
+
+    // Local members of each room with at least one
+    std::unordered_map<std::string, Room> rooms;
+
+    // Users in each room on any worker, kept current by join/leave events
+    std::unordered_map<std::string, RoomPresence> presence;
+
+    MpscQueue<ShardEvent> inbox;
+    std::atomic<bool> wake_pending{false};
+
+    std::atomic<RunPhase> phase{RunPhase::RUNNING};
+    std::atomic<uint64_t> drain_deadline{0};
+    std::atomic<bool> input_stopped{false};
+    bool reading = true;   // Loop's own view: accepting and reading clients
+
+    // io_uring backend; null with epoll
+    std::unique_ptr<Uring> ring;
+    std::unordered_map<SlabId, std::unique_ptr<SendBuffer>> orphaned_sends;  // By connection
+    std::vector<SlabId> starved;   // Receives stopped by an empty buffer ring
+    uint64_t ring_ops = 0;         // Submitted requests not yet finished
+    bool ring_closing = false;     // Cancelling everything; arm nothing new
+    std::vector<SlabId> input_ready;  // Connections with parked buffers to frame
+    size_t input_handled = 0;      // Received bytes framed since the last submission
+    bool inbox_ready = false;      // Woken by another worker, events not all applied
+
+    // Send coalescing: writes are held until the end of the loop iteration,
+    // or for a window that opens while the loop is busy
+    std::vector<SlabId> flush_list;    // Connections with held frames
+    size_t held_frames = 0;            // Frames queued on them since the last flush round
+    uint64_t flush_deadline = 0;       // Monotonic ns; 0 writes at the end of the iteration
+    uint64_t coalesce_window = 0;      // Current window in ns, up to config.coalesce_us
+    uint64_t last_flush = 0;           // When the previous flush round ran
+
+    FrameRef welcome_frame;
+    JsonScanner scanner;   // Validates every inbound JSON line
+    std::string room_scratch;   // Room of the message being handled
+    std::string text_scratch;   // Its unescaped text, when it is needed
+    ReplayBatcher replay_batch;   // Packs history for deflate clients
+    WorkerMetrics metrics;
+    uint64_t allocations_seen = 0;   // thread_heap_allocations() already counted
+
+    bool poll_epoll(uint64_t timeout_ns);
+    void accept_clients();
+    void add_client(int client_fd);
+    bool watch_client(Connection& conn);
+    void handle_event(Connection& conn, uint32_t events);
+    void read_available(Connection& conn);
+    void process_lines(Connection& conn);
+    void process_binary_frames(Connection& conn);
+    void handle_line(Connection& conn, std::string_view line);
+    void handle_binary_frame(Connection& conn, const BinaryHeader& header,
+                             std::string_view payload);
+    void handle_command(Connection& conn, const ChatFields& fields);
+    bool resolve_room(Connection& conn, std::string& room);
+
+    void join_room(Connection& conn, const std::string& name);
+    void leave_room(Connection& conn, const std::string& name);
+    Subscription* find_subscription(Connection& conn, const std::string& name);
+
+    EncodedMessage server_message(const std::string& text, const std::string& room);
+    EncodedMessage control_message(const std::string& json);
+    FrameRef control_frame(const Connection& conn, const std::string& json, bool notice = false);
+    FrameRef compressed_for(const Connection& conn, FrameRef binary);
+
+    void queue_send(Connection& conn, const FrameRef& frame);
+    void hold_for_flush(Connection& conn, size_t bytes);
+    void flush_held(bool force);
+    uint64_t wait_ns(int timeout_ms) const;
+    void flush(Connection& conn);
+    void write_queue(Connection& conn);
+    void sent(Connection& conn, size_t bytes);
+    bool make_room(Connection& conn);
+    void broadcast(const std::string& room, const EncodedMessage& message,
+                   const Connection* sender);
+    void deliver_local(const std::string& room, const EncodedMessage& message,
+                       const Connection* sender);
+    void announce(ShardEvent::Type type, const std::string& room, const Connection& subject,
+                  const EncodedMessage& message);
+    void apply_presence(ShardEvent::Type type, const std::string& room,
+                        const std::string& username, const Connection* subject);
+    void drain_inbox();
+    void clear_wake();
+    bool apply_inbox(size_t limit);
+    void send_user_list(Connection& conn, const std::string& room);
+    void send_history(Connection& conn, const std::string& room, const ChatFields& fields);
+    void replay_history(Connection& conn, const std::string& room,
+                        const std::vector<LogSpan>& spans);
+    void queue_batch(Connection& conn);
+
+    void charge_frame(Connection& conn);
+    int throttle_timeout(int timeout);
+    void resume_throttled();
+
+    void stop_input();
+    bool drain_connections();
+    int drain_timeout();
+    void discard_input(Connection& conn);
+
+    void mark_closing(Connection& conn);
+    void reap_closed();
+
+    // io_uring backend, in reactor_uring.cpp
+    bool init_uring();
+    bool poll_uring(uint64_t timeout_ns);
+    void finish_uring();
+    void reap_completions();
+    void complete(const io_uring_cqe& cqe);
+    io_uring_sqe* next_sqe(uint64_t user_data);
+    void arm_accept();
+    void arm_wake();
+    void arm_recv(Connection& conn);
+    void cancel(uint64_t user_data);
+    void cancel_accept();
+    void cancel_requests(Connection& conn);
+    void received(SlabId conn_id, const io_uring_cqe& cqe);
+    void feed(Connection& conn);
+    void release_parked(Connection& conn);
+    void submit_send(Connection& conn);
+    void send_completed(SlabId conn_id, int result);
+};
+
+#endif // REACTOR_H
@@ -0,0 +1,448 @@
+/*
+ * MIT License
+ * io_uring backend of the socket server's reactor
+ */
+
+#include "reactor.h"
+#include "async_log.h"
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+
+// The reactor's I/O through an io_uring instead of epoll. Everything above
+// the socket calls (framing, commands, rooms, queues, slow consumers, rate
+// limits, drain and handoff) is the shared code in reactor.cpp; this file
+// only replaces how bytes get in and out:
+//
+//   - one multishot accept on the listening socket;
+//   - one multishot receive per connection, filling buffers the kernel
+//     picks from a per-worker provided-buffer ring;
+//   - at most one send per connection in flight, gathering everything
+//     queued (up to SEND_BATCH frames), all submitted together once per
+//     loop iteration.
+//
+// A loop iteration is a single io_uring_enter (none with SQPOLL while busy)
+// however many sockets it touches.
+
+namespace {
+
+constexpr unsigned RING_ENTRIES = 4096;
+constexpr uint16_t BUFFER_GROUP = 0;
+constexpr unsigned RECV_BUFFERS = 1024;       // Per worker, shared by its connections
+constexpr unsigned RECV_BUFFER_SIZE = 4096;
+constexpr size_t SEND_BATCH = 1024;           // Frames per send, at most IOV_MAX
+constexpr size_t MAX_PARKED = 64;             // Buffers one connection may hold unframed
+constexpr size_t INPUT_BATCH = 16 * 1024;     // Received bytes framed between submissions
+constexpr size_t INBOX_BATCH = 64;            // Events from other workers between submissions
+
+// user_data is a connection handle with the operation in bits 28-31 of the slot
+// index, which leaves room for 2^28 connections per worker
+constexpr int OP_SHIFT = 28;
+constexpr uint64_t OP_MASK = 0xfull << OP_SHIFT;
+
+enum Op : uint64_t {
+    OP_ACCEPT = 1,
+    OP_WAKE,
+    OP_RECV,
+    OP_SEND,
+    OP_CANCEL
+};
+
+uint64_t tag(Op op, SlabId id = 0) {
+    return id | (uint64_t(op) << OP_SHIFT);
+}
+
+} // namespace
+
+bool Reactor::init_uring() {
+    ring = std::make_unique<Uring>();
+    if (!ring->init(RING_ENTRIES, config.sqpoll)) {
+        log_err() << "[SERVER] Failed to set up io_uring: " << strerror(errno) << "\n";
+        return false;
+    }
+    if (!ring->setup_buffers(BUFFER_GROUP, RECV_BUFFERS, RECV_BUFFER_SIZE)) {
+        log_err() << "[SERVER] Failed to register io_uring receive buffers: "
+                  << strerror(errno) << "\n";
+        return false;
+    }
+    arm_accept();
+    arm_wake();
+    return true;
+}
+
+bool Reactor::poll_uring(uint64_t timeout_ns) {
+    bool ok = ring->submit_and_wait(int64_t(timeout_ns));
+    reap_completions();
+
+    // Frame the input in batches, submitting the sends each batch produced
+    // and collecting finished ones before taking the next. A receive
+    // backlog would otherwise reach the recipients' queues all at once.
+    input_handled = 0;
+    for (size_t i = 0; i < input_ready.size(); i++) {
+        Connection* conn = connections.get(input_ready[i]);
+        if (conn != nullptr) {
+            feed(*conn);
+        }
+        if (input_handled >= INPUT_BATCH) {
+            if (ok) {
+                flush_held(true);
+                ok = ring->submit();
+                reap_completions();
+            }
+            input_handled = 0;
+        }
+    }
+    input_ready.clear();
+
+    // Likewise for frames from other workers: a recipient has one send in
+    // flight, so a whole inbox queued at once would overflow its queue
+    while (inbox_ready) {
+        inbox_ready = !apply_inbox(INBOX_BATCH);
+        if (inbox_ready && ok) {
+            flush_held(true);
+            ok = ring->submit();
+            reap_completions();
+        }
+    }
+    if (!ok) {
+        log_err() << "[SERVER] io_uring_enter failed: " << strerror(errno) << "\n";
+    }
+    metrics.syscalls.add(ring->take_syscalls());
+
+    // Receives that ran out of buffers, once some are back
+    if (!starved.empty() && ring->free_buffers() > 0) {
+        std::vector<SlabId> waiting;
+        waiting.swap(starved);
+        for (SlabId conn_id : waiting) {
+            Connection* conn = connections.get(conn_id);
+            if (conn != nullptr) {
+                feed(*conn);
+            }
+        }
+    }
+    return ok;
+}
+
+void Reactor::reap_completions() {
+    ring->for_each_completion([this](const io_uring_cqe& cqe) { complete(cqe); });
+}
+
+// Cancel everything in flight and wait until the kernel has let go of the
+// buffers and frames those requests point at
+void Reactor::finish_uring() {
+    ring_closing = true;
+    io_uring_sqe* sqe = next_sqe(tag(OP_CANCEL));
+    if (sqe != nullptr) {
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY | IORING_ASYNC_CANCEL_ALL;
+    }
+    while (ring_ops > 0 && ring->submit_and_wait(100000000)) {
+        reap_completions();
+    }
+    metrics.syscalls.add(ring->take_syscalls());
+}
+
+void Reactor::complete(const io_uring_cqe& cqe) {
+    Op op = static_cast<Op>((cqe.user_data & OP_MASK) >> OP_SHIFT);
+    SlabId target = cqe.user_data & ~OP_MASK;
+    bool more = cqe.flags & IORING_CQE_F_MORE;
+    if (!more) {
+        ring_ops--;
+    }
+
+    switch (op) {
+    case OP_ACCEPT:
+        if (cqe.res >= 0) {
+            add_client(cqe.res);
+        } else if (cqe.res != -ECANCELED) {
+            log_err() << "[SERVER] Failed to accept connection: " << strerror(-cqe.res) << "\n";
+        }
+        if (!more && reading && cqe.res != -ECANCELED) {
+            arm_accept();
+        }
+        break;
+    case OP_WAKE:
+        clear_wake();
+        inbox_ready = true;
+        if (!more && cqe.res != -ECANCELED) {
+            arm_wake();
+        }
+        break;
+    case OP_RECV:
+        received(target, cqe);
+        break;
+    case OP_SEND:
+        send_completed(target, cqe.res);
+        break;
+    case OP_CANCEL:
+        break;
+    }
+}
+
+io_uring_sqe* Reactor::next_sqe(uint64_t user_data) {
+    io_uring_sqe* sqe = ring->get_sqe();
+    if (sqe == nullptr) {
+        log_err() << "[SERVER] io_uring submission queue is stuck\n";
+        return nullptr;
+    }
+    sqe->user_data = user_data;
+    ring_ops++;
+    return sqe;
+}
+
+void Reactor::arm_accept() {
+    io_uring_sqe* sqe = ring_closing ? nullptr : next_sqe(tag(OP_ACCEPT));
+    if (sqe != nullptr) {
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->fd = listen_fd;
+        sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    }
+}
+
+// The inbox eventfd, polled like any socket
+void Reactor::arm_wake() {
+    io_uring_sqe* sqe = ring_closing ? nullptr : next_sqe(tag(OP_WAKE));
+    if (sqe != nullptr) {
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = wake_fd;
+        sqe->poll32_events = POLLIN;
+        sqe->len = IORING_POLL_ADD_MULTI;
+    }
+}
+
+void Reactor::arm_recv(Connection& conn) {
+    io_uring_sqe* sqe = ring_closing ? nullptr : next_sqe(tag(OP_RECV, conn.id));
+    if (sqe != nullptr) {
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = conn.fd;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = BUFFER_GROUP;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        conn.recv_armed = true;
+    }
+}
+
+void Reactor::cancel(uint64_t user_data) {
+    io_uring_sqe* sqe = next_sqe(tag(OP_CANCEL));
+    if (sqe != nullptr) {
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = user_data;
+    }
+}
+
+void Reactor::cancel_accept() {
+    cancel(tag(OP_ACCEPT));
+}
+
+// Before the socket is closed: a request in flight holds its own reference
+// to the socket, which would otherwise stay open until it completes
+void Reactor::cancel_requests(Connection& conn) {
+    if (conn.recv_armed && !conn.recv_cancelling) {
+        cancel(tag(OP_RECV, conn.id));
+    }
+    if (conn.in_flight > 0) {
+        cancel(tag(OP_SEND, conn.id));
+        // The connection goes now; the kernel may still be reading its frames
+        SendBuffer& buffer = *conn.send_buffer;
+        for (uint32_t i = 0; i < conn.in_flight; i++) {
+            buffer.orphaned.push_back(conn.outq.at(i));
+        }
+        orphaned_sends[conn.id] = std::move(conn.send_buffer);
+    }
+    release_parked(conn);
+}
+
+void Reactor::received(SlabId conn_id, const io_uring_cqe& cqe) {
+    bool has_buffer = cqe.flags & IORING_CQE_F_BUFFER;
+    uint16_t buffer = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+    if (has_buffer) {
+        ring->consumed();
+    }
+
+    Connection* conn = connections.get(conn_id);
+    if (conn == nullptr || conn->closing || conn->shut || cqe.res <= 0) {
+        if (has_buffer) {
+            ring->recycle(buffer);
+        }
+    } else if (has_buffer) {
+        conn->parked.push_back(ParkedBuffer{buffer, 0, static_cast<uint32_t>(cqe.res)});
+        metrics.bytes_received.add(cqe.res);
+    }
+    if (conn == nullptr) {
+        return;
+    }
+
+    if (!(cqe.flags & IORING_CQE_F_MORE)) {
+        conn->recv_armed = false;
+        conn->recv_cancelling = false;
+        if (cqe.res == -ENOBUFS) {
+            starved.push_back(conn_id);
+        } else if (cqe.res <= 0 && cqe.res != -ECANCELED) {
+            conn->peer_closed = true;   // End of stream or a socket error
+        }
+    }
+    input_ready.push_back(conn_id);
+}
+
+// Move received buffers into the line buffer and handle the frames, as
+// read_available does for epoll. The receive stays armed while the
+// connection keeps up; a throttled connection (or one whose worker is
+// stopping, or that holds MAX_PARKED buffers) has it cancelled, so further
+// input waits in the socket as it would with epoll, and it is armed again
+// once the parked buffers are consumed.
+void Reactor::feed(Connection& conn) {
+    if (conn.closing) {
+        release_parked(conn);
+        return;
+    }
+    if (conn.shut) {
+        // Draining: input is discarded, only the client's close matters
+        release_parked(conn);
+        if (conn.peer_closed) {
+            mark_closing(conn);
+        } else if (!conn.recv_armed) {
+            arm_recv(conn);
+        }
+        return;
+    }
+
+    while (!conn.parked.empty() && reading && !conn.throttled && !conn.closing) {
+        if (input_handled >= INPUT_BATCH) {
+            input_ready.push_back(conn.id);   // The rest after this batch's sends
+            break;
+        }
+        ParkedBuffer& front = conn.parked.front();
+        size_t n = conn.inbuf.append(ring->buffer(front.id) + front.offset,
+                                     front.length - front.offset);
+        front.offset += n;
+        input_handled += n;
+        if (front.offset == front.length) {
+            ring->recycle(front.id);
+            conn.parked.erase(conn.parked.begin());
+        }
+        process_lines(conn);
+        if (n == 0) {
+            break; // Line buffer full until the welcome is sent
+        }
+    }
+    if (conn.closing) {
+        return;
+    }
+
+    if (conn.parked.empty()) {
+        if (conn.peer_closed) {
+            if (conn.state == ConnState::CHATTING) {
+                log_out() << "[SERVER] Client " << conn.username << " disconnected\n";
+            } else {
+                log_out() << "[SERVER] Client disconnected before sending username\n";
+            }
+            mark_closing(conn);
+            return;
+        }
+        // Idle connections do not keep a receive slab
+        conn.inbuf.release();
+    }
+
+    bool keeping_up = reading && !conn.throttled && conn.parked.size() < MAX_PARKED;
+    if (keeping_up && !conn.recv_armed && !conn.peer_closed) {
+        arm_recv(conn);
+    } else if (!keeping_up && conn.recv_armed && !conn.recv_cancelling) {
+        cancel(tag(OP_RECV, conn.id));
+        conn.recv_cancelling = true;
+    }
+}
+
+void Reactor::release_parked(Connection& conn) {
+    for (const ParkedBuffer& buffer : conn.parked) {
+        ring->recycle(buffer.id);
+    }
+    conn.parked.clear();
+}
+
+void Reactor::submit_send(Connection& conn) {
+    if (conn.in_flight > 0 || conn.outq.empty() || conn.closing || ring_closing) {
+        return;
+    }
+
+    // No sendfile here: a history frame is read into memory when it
+    // reaches the front of the queue
+    if (conn.outq.front()->is_file()) {
+        const Frame& file = *conn.outq.front().get();
+        FrameRef copy(Frame::allocate(file.size()));
+        size_t done = 0;
+        while (done < file.size()) {
+            ssize_t n = pread(file.region().fd, copy->buffer() + done, file.size() - done,
+                              file.region().offset + done);
+            if (n <= 0) {
+                break;
+            }
+            done += n;
+        }
+        copy->set_size(done);
+        conn.outq.front() = copy;
+        if (done <= conn.out_offset) {
+            mark_closing(conn);
+            return;
+        }
+    }
+
+    if (!conn.send_buffer) {
+        conn.send_buffer = std::make_unique<SendBuffer>();
+    }
+    SendBuffer& buffer = *conn.send_buffer;
+    buffer.iov.clear();
+    size_t limit = std::min(conn.outq.size(), SEND_BATCH);
+    for (size_t i = 0; i < limit; i++) {
+        const Frame* frame = conn.outq.at(i).get();
+        if (frame->is_file()) {
+            break;
+        }
+        size_t skip = i == 0 ? conn.out_offset : 0;
+        buffer.iov.push_back(iovec{const_cast<char*>(frame->data()) + skip, frame->size() - skip});
+    }
+    metrics.write_batch.record(buffer.iov.size());
+    buffer.msg = msghdr{};
+    buffer.msg.msg_iov = buffer.iov.data();
+    buffer.msg.msg_iovlen = buffer.iov.size();
+
+    io_uring_sqe* sqe = next_sqe(tag(OP_SEND, conn.id));
+    if (sqe == nullptr) {
+        mark_closing(conn);
+        return;
+    }
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = conn.fd;
+    sqe->addr = reinterpret_cast<uint64_t>(&buffer.msg);
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    conn.in_flight = static_cast<uint32_t>(buffer.iov.size());
+}
+
+void Reactor::send_completed(SlabId conn_id, int result) {
+    Connection* conn = connections.get(conn_id);
+    if (conn == nullptr) {
+        orphaned_sends.erase(conn_id);   // Drops the frame references
+        return;
+    }
+    conn->in_flight = 0;
+    if (result < 0) {
+        if (result != -ECANCELED) {
+            log_err() << "[SERVER] Failed to send to client " << conn->username << "\n";
+            mark_closing(*conn);
+        }
+        return; // Cancelled frames are still queued
+    }
+
+    sent(*conn, result);
+    if (!conn->outq.empty()) {
+        submit_send(*conn);
+    } else if (conn->state == ConnState::WELCOME) {
+        conn->state = ConnState::USERNAME;
+        process_lines(*conn);
+        feed(*conn);
+    }
+}
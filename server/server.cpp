@@ -4,242 +4,444 @@
  */
 
 #include "common.h"
-#include <iostream>
+#include "async_log.h"
+#include "handoff.h"
+#include "metrics.h"
+#include "reactor.h"
+#include "shm_bridge.h"
 #include <vector>
 #include <thread>
-#include <mutex>
+#include <chrono>
+#include <memory>
+#include <atomic>
 #include <algorithm>
 #include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <poll.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <signal.h>
 #include <cstring>
-#include <sstream>
 
-// Client information
-struct ClientInfo {
-    int socket_fd;
-    std::string username;
-    std::thread thread;
-    bool active;
-    
-    ClientInfo(int fd) : socket_fd(fd), active(true) {}
-};
+using Workers = std::vector<std::unique_ptr<Reactor>>;
 
-// Global server state
-std::vector<std::shared_ptr<ClientInfo>> clients;
-std::mutex clients_mutex;
-bool server_running = true;
-int server_socket = -1;
-
-// Signal handler for graceful shutdown
-void signal_handler(int signum) {
-    std::cout << "\n[SERVER] Shutting down gracefully...\n";
-    server_running = false;
-    if (server_socket != -1) {
-        close(server_socket);
+// Match "--name value" or "--name=value", advancing past a separate value
+bool parse_option(int argc, char* argv[], int& i, const std::string& name, std::string& value) {
+    std::string arg = argv[i];
+    if (arg == name && i + 1 < argc) {
+        value = argv[++i];
+        return true;
+    }
+    if (arg.compare(0, name.size() + 1, name + "=") == 0) {
+        value = arg.substr(name.size() + 1);
+        return true;
     }
+    return false;
 }
 
-// Broadcast message to all clients except sender
-void broadcast_message(const std::string& message, int sender_fd) {
-    std::lock_guard<std::mutex> lock(clients_mutex);
-    
-    for (auto& client : clients) {
-        if (client->active && client->socket_fd != sender_fd) {
-            ssize_t sent = send(client->socket_fd, message.c_str(), message.length(), MSG_NOSIGNAL);
-            if (sent == -1) {
-                std::cerr << "[SERVER] Failed to send to client " << client->username << "\n";
-                client->active = false;
-            }
-        }
+// Allow as many open descriptors as the hard limit permits
+void raise_fd_limit() {
+    rlimit limit{};
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        log_out() << "[SERVER] File descriptor limit: " << limit.rlim_cur << "\n";
     }
 }
 
-// Send online users list to specific client
-void send_user_list(int client_fd) {
-    std::lock_guard<std::mutex> lock(clients_mutex);
+// Create, bind and listen on the server socket; returns -1 on failure.
+// With reuse_port several sockets can share the port and the kernel
+// spreads incoming connections across them.
+int create_listen_socket(int port, bool reuse_port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1) {
+        log_err() << "[SERVER] Failed to create socket\n";
+        return -1;
+    }
     
-    std::stringstream ss;
-    ss << "{\"type\":\"userlist\",\"users\":[";
-    bool first = true;
-    for (const auto& client : clients) {
-        if (client->active && !client->username.empty()) {
-            if (!first) ss << ",";
-            ss << "\"" << client->username << "\"";
-            first = false;
-        }
+    // Set socket options
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (reuse_port && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) == -1) {
+        log_err() << "[SERVER] Failed to enable SO_REUSEPORT\n";
+        close(fd);
+        return -1;
+    }
+    
+    // Bind socket
+    sockaddr_in server_addr{};
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = INADDR_ANY;
+    server_addr.sin_port = htons(port);
+    
+    if (bind(fd, (sockaddr*)&server_addr, sizeof(server_addr)) == -1) {
+        log_err() << "[SERVER] Failed to bind to port " << port << "\n";
+        close(fd);
+        return -1;
+    }
+    
+    // Listen
+    if (listen(fd, SOMAXCONN) == -1) {
+        log_err() << "[SERVER] Failed to listen\n";
+        close(fd);
+        return -1;
     }
-    ss << "]}\n";
     
-    std::string msg = ss.str();
-    send(client_fd, msg.c_str(), msg.length(), MSG_NOSIGNAL);
+    return fd;
 }
 
-// Read a complete line (newline-terminated message)
-std::string read_line(int socket_fd) {
-    std::string line;
-    char c;
-    
-    while (true) {
-        ssize_t n = recv(socket_fd, &c, 1, 0);
-        if (n <= 0) {
-            return ""; // Connection closed or error
-        }
-        if (c == '\n') {
-            break;
+void start_workers(const Workers& reactors, std::vector<std::thread>& threads) {
+    for (auto& reactor : reactors) {
+        threads.emplace_back(&Reactor::run, reactor.get());
+    }
+}
+
+void join_workers(std::vector<std::thread>& threads) {
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    threads.clear();
+}
+
+// Stop input on every worker and wait until all have: from then on no
+// worker starts a broadcast another has yet to deliver
+void quiesce_workers(const Workers& reactors) {
+    for (auto& reactor : reactors) {
+        reactor->set_phase(RunPhase::QUIESCE);
+    }
+    for (auto& reactor : reactors) {
+        while (!reactor->quiesced()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
         }
-        line += c;
     }
-    
-    return line;
 }
 
-// Handle individual client connection
-void handle_client(std::shared_ptr<ClientInfo> client) {
-    std::cout << "[SERVER] New client connected (fd: " << client->socket_fd << ")\n";
-    
-    // Request username
-    std::string welcome = "{\"type\":\"welcome\",\"text\":\"Please send your username\"}\n";
-    send(client->socket_fd, welcome.c_str(), welcome.length(), 0);
-    
-    // Read username
-    std::string username_line = read_line(client->socket_fd);
-    if (username_line.empty()) {
-        std::cout << "[SERVER] Client disconnected before sending username\n";
-        close(client->socket_fd);
-        return;
+// Pass the listening sockets and every client to the successor on sock.
+// True if it took them; otherwise the workers carry on as before.
+bool hand_off(int sock, const Workers& reactors, std::vector<std::thread>& threads,
+              const std::vector<int>& listen_fds, ShmBridge* bridge, MessageLog* log) {
+    if (bridge != nullptr) {
+        bridge->stop();
     }
-    
-    // Parse username (simple JSON parse)
-    size_t user_pos = username_line.find("\"user\":\"");
-    if (user_pos != std::string::npos) {
-        size_t start = user_pos + 8;
-        size_t end = username_line.find("\"", start);
-        client->username = username_line.substr(start, end - start);
-    } else {
-        client->username = "Anonymous";
+    quiesce_workers(reactors);
+    for (auto& reactor : reactors) {
+        reactor->set_phase(RunPhase::HALT);
     }
-    
-    std::cout << "[SERVER] Client identified as: " << client->username << "\n";
-    
-    // Notify all clients about new user
-    std::string join_msg = create_json_message("SERVER", client->username + " joined the chat");
-    broadcast_message(join_msg, -1);
-    
-    // Send user list to new client
-    send_user_list(client->socket_fd);
-    
-    // Message loop
-    while (server_running && client->active) {
-        std::string message = read_line(client->socket_fd);
-        
-        if (message.empty()) {
-            // Client disconnected
-            std::cout << "[SERVER] Client " << client->username << " disconnected\n";
-            client->active = false;
-            break;
+    join_workers(threads);
+
+    HandoffState state;
+    state.listen_fds = listen_fds;
+    for (auto& reactor : reactors) {
+        reactor->export_state(state);
+    }
+    if (handoff_send(sock, state)) {
+        log_out() << "[SERVER] Handed off " << state.connections.size() << " connections\n";
+        return true;
+    }
+
+    for (auto& reactor : reactors) {
+        reactor->resume();
+    }
+    start_workers(reactors, threads);
+    if (bridge != nullptr) {
+        std::vector<Reactor*> peers;
+        for (auto& reactor : reactors) {
+            peers.push_back(reactor.get());
         }
-        
-        std::cout << "[SERVER] Message from " << client->username << ": " << message << "\n";
-        
-        // Broadcast to all other clients
-        broadcast_message(message + "\n", client->socket_fd);
+        bridge->start(peers, log);
     }
-    
-    // Cleanup
-    std::string leave_msg = create_json_message("SERVER", client->username + " left the chat");
-    broadcast_message(leave_msg, -1);
-    
-    close(client->socket_fd);
+    return false;
 }
 
 int main(int argc, char* argv[]) {
     int port = DEFAULT_PORT;
+    std::string io_mode = "epoll";
+    int workers = 1;
+    std::string log_dir;
+    std::string bridge_name;
+    int metrics_port = 0;
+    double rate_limit = 0, user_rate_limit = 0;
+    int rate_burst = 20, user_rate_burst = 40;
+    double drain_timeout = 5;
+    std::string handoff_path;
+    ReactorConfig config;
     
     // Parse command line arguments
     for (int i = 1; i < argc; i++) {
-        if (std::string(argv[i]) == "--port" && i + 1 < argc) {
-            port = std::stoi(argv[i + 1]);
-            i++;
+        std::string value;
+        if (std::string(argv[i]) == "--shm-bridge") {
+            bridge_name = DEFAULT_SHM_RING_NAME;
+        } else if (std::string(argv[i]) == "--uring-sqpoll") {
+            config.sqpoll = true;
+        } else if (std::string(argv[i]) == "--tcp-cork") {
+            config.tcp_cork = true;
+        } else if (parse_option(argc, argv, i, "--port", value)) {
+            port = std::stoi(value);
+        } else if (parse_option(argc, argv, i, "--io", value)) {
+            io_mode = value;
+        } else if (parse_option(argc, argv, i, "--workers", value)) {
+            workers = std::max(1, std::stoi(value));
+        } else if (parse_option(argc, argv, i, "--send-queue", value)) {
+            config.send_queue_limit = std::max(1, std::stoi(value));
+        } else if (parse_option(argc, argv, i, "--coalesce-us", value)) {
+            config.coalesce_us = static_cast<uint32_t>(std::max(0, std::stoi(value)));
+        } else if (parse_option(argc, argv, i, "--coalesce-bytes", value)) {
+            config.coalesce_bytes = static_cast<size_t>(std::max(1, std::stoi(value)));
+        } else if (parse_option(argc, argv, i, "--log-dir", value)) {
+            log_dir = value;
+        } else if (parse_option(argc, argv, i, "--shm-bridge", value)) {
+            bridge_name = value;
+        } else if (parse_option(argc, argv, i, "--metrics-port", value)) {
+            metrics_port = std::stoi(value);
+        } else if (parse_option(argc, argv, i, "--log-messages", value)) {
+            config.log_messages = value != "off";
+        } else if (parse_option(argc, argv, i, "--rate-limit", value)) {
+            rate_limit = std::stod(value);
+        } else if (parse_option(argc, argv, i, "--rate-burst", value)) {
+            rate_burst = std::max(1, std::stoi(value));
+        } else if (parse_option(argc, argv, i, "--user-rate-limit", value)) {
+            user_rate_limit = std::stod(value);
+        } else if (parse_option(argc, argv, i, "--user-rate-burst", value)) {
+            user_rate_burst = std::max(1, std::stoi(value));
+        } else if (parse_option(argc, argv, i, "--drain-timeout", value)) {
+            drain_timeout = std::max(0.0, std::stod(value));
+        } else if (parse_option(argc, argv, i, "--handoff", value)) {
+            handoff_path = value;
+        } else if (parse_option(argc, argv, i, "--history", value)) {
+            config.history = std::max(0, std::stoi(value));
+        } else if (parse_option(argc, argv, i, "--slow-consumer", value)) {
+            if (value == "drop-oldest") {
+                config.slow_consumer = SlowConsumerPolicy::DROP_OLDEST;
+            } else if (value == "disconnect") {
+                config.slow_consumer = SlowConsumerPolicy::DISCONNECT;
+            } else if (value == "coalesce") {
+                config.slow_consumer = SlowConsumerPolicy::COALESCE;
+            } else {
+                log_err() << "[SERVER] Unknown slow-consumer policy: " << value
+                          << " (expected drop-oldest, disconnect or coalesce)\n";
+                return 1;
+            }
         }
     }
     
-    // Setup signal handler
-    signal(SIGINT, signal_handler);
-    signal(SIGTERM, signal_handler);
+    if (io_mode == "uring") {
+        config.io = IoBackend::URING;
+    } else if (io_mode != "epoll") {
+        log_err() << "[SERVER] Unknown I/O mode: " << io_mode << " (expected epoll or uring)\n";
+        return 1;
+    }
     
-    // Create socket
-    server_socket = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_socket == -1) {
-        std::cerr << "[SERVER] Failed to create socket\n";
+    // Shutdown signals are read from a signalfd by the main thread, never
+    // handled in signal context. Blocked before any thread starts, so every
+    // thread inherits the mask.
+    sigset_t shutdown_signals;
+    sigemptyset(&shutdown_signals);
+    sigaddset(&shutdown_signals, SIGINT);
+    sigaddset(&shutdown_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &shutdown_signals, nullptr);
+    int signal_fd = signalfd(-1, &shutdown_signals, SFD_CLOEXEC);
+    if (signal_fd == -1) {
+        log_err() << "[SERVER] Failed to create signalfd\n";
         return 1;
     }
+    signal(SIGPIPE, SIG_IGN); // sendfile() has no MSG_NOSIGNAL
     
-    // Set socket options
-    int opt = 1;
-    setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    // Frames per second a connection, and all connections of one user, may send
+    UserBuckets user_buckets;
+    config.connection_rate = RateLimit::per_second(rate_limit, rate_burst);
+    config.user_rate = RateLimit::per_second(user_rate_limit, user_rate_burst);
+    if (config.user_rate.enabled()) {
+        config.user_buckets = &user_buckets;
+    }
     
-    // Bind socket
-    sockaddr_in server_addr{};
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_addr.s_addr = INADDR_ANY;
-    server_addr.sin_port = htons(port);
+    // From here on the log is written by its own thread
+    server_logger().start();
     
-    if (bind(server_socket, (sockaddr*)&server_addr, sizeof(server_addr)) == -1) {
-        std::cerr << "[SERVER] Failed to bind to port " << port << "\n";
-        close(server_socket);
-        return 1;
+    raise_fd_limit();
+    
+    // Take over from a server already running on the handoff socket. Its
+    // message log is closed before this process opens it.
+    HandoffState inherited;
+    if (!handoff_path.empty()) {
+        int sock = handoff_connect(handoff_path);
+        if (sock != -1) {
+            bool received = handoff_receive(sock, inherited);
+            if (received) {
+                handoff_wait_release(sock);
+            }
+            close(sock);
+            if (!received) {
+                return 1;
+            }
+            workers = static_cast<int>(inherited.listen_fds.size());
+            log_out() << "[SERVER] Took over " << inherited.connections.size()
+                      << " connections from the running server\n";
+        }
     }
     
-    // Listen
-    if (listen(server_socket, 10) == -1) {
-        std::cerr << "[SERVER] Failed to listen\n";
-        close(server_socket);
-        return 1;
+    // History is shared by all workers; its writer thread does the disk I/O
+    std::unique_ptr<MessageLog> log;
+    if (!log_dir.empty()) {
+        log = std::make_unique<MessageLog>(log_dir);
+        if (!log->open()) {
+            return 1;
+        }
+        config.log = log.get();
     }
     
-    std::cout << "[SERVER] Listening on port " << port << "\n";
+    // Lobby relay to local processes on the shared-memory ring
+    std::unique_ptr<ShmBridge> bridge;
+    if (!bridge_name.empty()) {
+        bridge = std::make_unique<ShmBridge>(bridge_name);
+        if (!bridge->open()) {
+            return 1;
+        }
+        config.bridge = bridge.get();
+    }
     
-    // Accept loop
-    while (server_running) {
-        sockaddr_in client_addr{};
-        socklen_t client_len = sizeof(client_addr);
-        
-        int client_fd = accept(server_socket, (sockaddr*)&client_addr, &client_len);
-        if (client_fd == -1) {
-            if (server_running) {
-                std::cerr << "[SERVER] Failed to accept connection\n";
-            }
-            continue;
+    // One listening socket, event loop and client table per worker
+    std::vector<std::unique_ptr<Reactor>> reactors;
+    std::vector<Reactor*> peers;
+    std::vector<int> listen_fds;
+    for (int i = 0; i < workers; i++) {
+        int fd = i < static_cast<int>(inherited.listen_fds.size())
+            ? inherited.listen_fds[i] : create_listen_socket(port, workers > 1);
+        if (fd == -1) {
+            for (int open_fd : listen_fds) close(open_fd);
+            return 1;
         }
+        listen_fds.push_back(fd);
         
-        // Create client info and thread
-        auto client = std::make_shared<ClientInfo>(client_fd);
-        client->thread = std::thread(handle_client, client);
-        client->thread.detach(); // Detach to allow independent cleanup
-        
-        // Add to clients list (thread-safe)
-        {
-            std::lock_guard<std::mutex> lock(clients_mutex);
-            clients.push_back(client);
+        reactors.push_back(std::make_unique<Reactor>(i, fd, config));
+        if (!reactors.back()->init()) {
+            for (int open_fd : listen_fds) close(open_fd);
+            return 1;
         }
+        peers.push_back(reactors.back().get());
     }
     
-    // Cleanup
-    std::cout << "[SERVER] Cleaning up...\n";
-    {
-        std::lock_guard<std::mutex> lock(clients_mutex);
-        for (auto& client : clients) {
-            if (client->active) {
-                close(client->socket_fd);
+    if (!inherited.listen_fds.empty()) {
+        sockaddr_in addr{};
+        socklen_t len = sizeof(addr);
+        if (getsockname(listen_fds[0], (sockaddr*)&addr, &len) == 0) {
+            port = ntohs(addr.sin_port);
+        }
+    }
+    log_out() << "[SERVER] Listening on port " << port << " (io: " << io_mode
+              << (config.io == IoBackend::URING && config.sqpoll ? "+sqpoll" : "") << ", workers: "
+              << workers << ")\n";
+    
+    std::vector<std::thread> threads;
+    for (auto& reactor : reactors) {
+        reactor->set_peers(peers);
+        reactor->adopt(inherited);
+    }
+    
+    // Where the next build of the server takes over from this one
+    int handoff_fd = -1;
+    if (!handoff_path.empty()) {
+        handoff_fd = handoff_listen(handoff_path);
+    }
+    if (bridge) {
+        bridge->start(peers, log.get());
+    }
+    
+    // Counters are summed across workers on each scrape
+    std::unique_ptr<MetricsEndpoint> endpoint;
+    if (metrics_port > 0) {
+        std::vector<const WorkerMetrics*> stats;
+        for (auto& reactor : reactors) {
+            stats.push_back(&reactor->stats());
+        }
+        ShmBridge* relay = bridge.get();
+        endpoint = std::make_unique<MetricsEndpoint>([stats, relay] {
+            return render_metrics(stats, [relay](std::string& out) {
+                if (relay != nullptr) {
+                    out += "# HELP chat_shm_bridge_dropped_total Lobby messages not published to a full ring\n"
+                           "# TYPE chat_shm_bridge_dropped_total counter\n"
+                           "chat_shm_bridge_dropped_total " +
+                           std::to_string(relay->dropped_messages()) + "\n";
+                }
+            });
+        });
+        if (!endpoint->start(metrics_port)) {
+            endpoint.reset();
+        }
+    }
+    start_workers(reactors, threads);
+    
+    // Wait for a shutdown signal or a successor
+    int successor = -1;
+    while (successor == -1) {
+        pollfd fds[2] = {{signal_fd, POLLIN, 0}, {handoff_fd, POLLIN, 0}};
+        if (poll(fds, handoff_fd != -1 ? 2 : 1, -1) == -1) {
+            if (errno == EINTR) {
+                continue;
             }
+            log_err() << "[SERVER] poll failed: " << strerror(errno) << "\n";
+            break;
         }
+        if (fds[0].revents & POLLIN) {
+            signalfd_siginfo info;
+            ssize_t ignored = read(signal_fd, &info, sizeof(info));
+            (void)ignored;
+            log_out() << "[SERVER] Shutting down gracefully...\n";
+            break;
+        }
+        if (handoff_fd != -1 && (fds[1].revents & POLLIN)) {
+            int sock = handoff_accept(handoff_fd);
+            if (sock != -1 && !hand_off(sock, reactors, threads, listen_fds, bridge.get(), log.get())) {
+                close(sock);
+                sock = -1;
+            }
+            successor = sock;
+        }
+    }
+    
+    if (successor == -1) {
+        // Deliver what was already read, write out every queue, then close
+        if (bridge) {
+            bridge->stop();
+        }
+        quiesce_workers(reactors);
+        uint64_t deadline = monotonic_ns() + static_cast<uint64_t>(drain_timeout * 1e9);
+        for (auto& reactor : reactors) {
+            reactor->set_phase(RunPhase::DRAIN, deadline);
+        }
+        join_workers(threads);
     }
     
-    close(server_socket);
-    std::cout << "[SERVER] Shutdown complete\n";
+    // Cleanup
+    log_out() << "[SERVER] Cleaning up...\n";
+    if (endpoint) {
+        endpoint->stop();
+    }
+    if (log) {
+        log->close();
+    }
+    if (successor != -1) {
+        // The successor opens the log and the metrics port once this lets go;
+        // closing our copies of the sockets leaves the connections open
+        handoff_release(successor);
+        close(successor);
+    }
+    reactors.clear();
+    for (int fd : listen_fds) {
+        close(fd);
+    }
+    if (handoff_fd != -1) {
+        close(handoff_fd);
+        if (successor == -1) {
+            unlink(handoff_path.c_str());
+        }
+    }
+    close(signal_fd);
+    log_out() << "[SERVER] Shutdown complete\n";
+    server_logger().stop();
     
     return 0;
 }
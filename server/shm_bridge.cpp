@@ -0,0 +1,98 @@
+/*
+ * MIT License
+ * Relay between the shared-memory ring and socket clients
+ */
+
+#include "shm_bridge.h"
+#include "async_log.h"
+#include "message_log.h"
+#include "reactor.h"
+#include <unistd.h>
+
+ShmBridge::ShmBridge(std::string name) : name(std::move(name)), self(getpid()) {}
+
+ShmBridge::~ShmBridge() {
+    stop();
+    if (ring != nullptr) {
+        if (reader != -1) {
+            ring->detach_reader(reader);
+        }
+        detach_shm_ring(ring);
+    }
+}
+
+bool ShmBridge::open() {
+    ring = attach_shm_ring(name.c_str());
+    if (ring == nullptr) {
+        log_err() << "[SERVER] Failed to attach shared memory ring " << name << "\n";
+        return false;
+    }
+    reader = ring->attach_reader();
+    if (reader == -1) {
+        log_err() << "[SERVER] No free reader slot in shared memory ring " << name << "\n";
+        return false;
+    }
+    log_out() << "[SERVER] Bridging lobby with shared memory ring " << name << "\n";
+    return true;
+}
+
+void ShmBridge::start(const std::vector<Reactor*>& targets, MessageLog* history) {
+    workers = targets;
+    log = history;
+    running = true;
+    thread = std::thread(&ShmBridge::run, this);
+}
+
+void ShmBridge::stop() {
+    if (thread.joinable()) {
+        running = false;
+        thread.join();
+    }
+    if (dropped.load() > 0) {
+        log_out() << "[SERVER] Shared memory bridge dropped " << dropped.load()
+                  << " messages while the ring was full\n";
+    }
+}
+
+void ShmBridge::publish(std::string_view user, std::string_view time, std::string_view text) {
+    if (!ring->try_push(user, time, text)) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+// Sleep on the ring's futex until something is published, then drain up
+// to a batch without sleeping again
+void ShmBridge::run() {
+    ChatMessage message;
+    uint64_t lost = 0;
+    int32_t origin = 0;
+
+    while (running) {
+        RingRead result = ring->read_wait(reader, message, lost, 200, &origin);
+        for (size_t batch = 0; result != RingRead::EMPTY; batch++) {
+            if (result == RingRead::LAPPED) {
+                log_err() << "[SERVER] Shared memory bridge fell behind, lost " << lost
+                          << " messages\n";
+            } else if (origin != self) {
+                relay(message);
+            }
+            if (batch + 1 == SHM_BRIDGE_BATCH) {
+                break;   // Reading on would take a record this pass never relays
+            }
+            result = ring->try_read(reader, message, lost, &origin);
+        }
+    }
+}
+
+void ShmBridge::relay(const ChatMessage& message) {
+    uint64_t timestamp = parse_epoch_ms(message.timestamp);
+    EncodedMessage encoded = Reactor::encode_chat(0, message.username, message.text,
+                                                  timestamp ? timestamp : now_epoch_ms(),
+                                                  DEFAULT_ROOM);
+    if (log != nullptr) {
+        log->append(DEFAULT_ROOM, encoded.json);
+    }
+    for (Reactor* worker : workers) {
+        worker->post(ShardEvent{ShardEvent::BROADCAST, DEFAULT_ROOM, std::string(), encoded});
+    }
+}
@@ -0,0 +1,61 @@
+/*
+ * MIT License
+ * Relay between the shared-memory ring and socket clients
+ */
+
+#ifndef SHM_BRIDGE_H
+#define SHM_BRIDGE_H
+
+#include "shm_ring.h"
+#include <atomic>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+class Reactor;
+class MessageLog;
+
+constexpr size_t SHM_BRIDGE_BATCH = 256;  // Records drained per wakeup
+
+// Joins the socket server's lobby to the shared-memory ring. Lobby messages
+// from socket clients are published to the ring by the worker that
+// received them; a bridge thread reads the ring and posts what local
+// processes wrote to every worker. Records carry the writer's pid, so the
+// bridge skips its own and nothing echoes back. Several servers may bridge
+// the same ring: each relays the others' socket traffic, never its own.
+class ShmBridge {
+public:
+    explicit ShmBridge(std::string name);
+    ~ShmBridge();
+
+    ShmBridge(const ShmBridge&) = delete;
+    ShmBridge& operator=(const ShmBridge&) = delete;
+
+    // Map the ring and claim a reader slot; false on failure
+    bool open();
+    void start(const std::vector<Reactor*>& workers, MessageLog* log);
+    void stop();
+
+    // Thread-safe and lock-free; drops the message rather than block when a
+    // BLOCK-policy ring is full
+    void publish(std::string_view user, std::string_view time, std::string_view text);
+
+    uint64_t dropped_messages() const { return dropped.load(std::memory_order_relaxed); }
+
+private:
+    std::string name;
+    ShmRing* ring = nullptr;
+    int reader = -1;
+    int32_t self;   // Our pid, as stamped on the records we write
+    std::vector<Reactor*> workers;
+    MessageLog* log = nullptr;
+    std::atomic<bool> running{false};
+    std::atomic<uint64_t> dropped{0};
+    std::thread thread;
+
+    void run();
+    void relay(const ChatMessage& message);
+};
+
+#endif // SHM_BRIDGE_H
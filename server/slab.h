@@ -0,0 +1,121 @@
+/*
+ * MIT License
+ * Generational-index slab for per-connection records
+ */
+
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+// Handle to a slab entry: slot index in the low 32 bits, the slot's
+// generation in the high 32. Generations of live entries are odd, so a
+// handle with generation 0 never names an entry and is free for use as a
+// tag (the reactor's epoll tokens for its own descriptors).
+using SlabId = uint64_t;
+
+// Fixed-size records stored in chunks that never move, so references stay
+// valid until the entry is erased. Erased slots go on a LIFO free list and
+// are reused before the slab grows; memory tracks the peak number of live
+// entries, not the number ever created. Every reuse bumps the slot's
+// generation, so handles to erased entries are detected instead of
+// silently aliasing the slot's next occupant. Not thread-safe.
+template <typename T, size_t ChunkSize = 1024>
+class Slab {
+public:
+    Slab() = default;
+    ~Slab() {
+        for_each([this](SlabId id, T&) { erase(id); });
+    }
+
+    Slab(const Slab&) = delete;
+    Slab& operator=(const Slab&) = delete;
+
+    template <typename... Args>
+    SlabId emplace(Args&&... args) {
+        uint32_t index;
+        if (free_head != NO_SLOT) {
+            index = free_head;
+            free_head = slot(index).next_free;
+        } else {
+            if (used % ChunkSize == 0) {
+                chunks.emplace_back(new Slot[ChunkSize]);
+            }
+            index = used++;
+        }
+
+        Slot& s = slot(index);
+        new (s.storage) T(std::forward<Args>(args)...);
+        s.generation++;
+        count++;
+        return make_id(index, s.generation);
+    }
+
+    // Entry named by id, or nullptr if it was erased
+    T* get(SlabId id) {
+        uint32_t index = static_cast<uint32_t>(id);
+        if (index >= used) {
+            return nullptr;
+        }
+        Slot& s = slot(index);
+        return s.generation == static_cast<uint32_t>(id >> 32) && (s.generation & 1)
+            ? s.value() : nullptr;
+    }
+
+    // O(1); stale ids are ignored
+    void erase(SlabId id) {
+        T* value = get(id);
+        if (value == nullptr) {
+            return;
+        }
+        uint32_t index = static_cast<uint32_t>(id);
+        Slot& s = slot(index);
+        value->~T();
+        s.generation++;
+        s.next_free = free_head;
+        free_head = index;
+        count--;
+    }
+
+    template <typename Fn>
+    void for_each(Fn fn) {
+        for (uint32_t index = 0; index < used; index++) {
+            Slot& s = slot(index);
+            if (s.generation & 1) {
+                fn(make_id(index, s.generation), *s.value());
+            }
+        }
+    }
+
+    size_t size() const { return count; }
+    size_t capacity() const { return chunks.size() * ChunkSize; }
+
+private:
+    static constexpr uint32_t NO_SLOT = UINT32_MAX;
+
+    struct Slot {
+        alignas(T) unsigned char storage[sizeof(T)];
+        uint32_t generation = 0;       // Odd while the slot holds an entry
+        uint32_t next_free = NO_SLOT;
+
+        T* value() { return std::launder(reinterpret_cast<T*>(storage)); }
+    };
+
+    static SlabId make_id(uint32_t index, uint32_t generation) {
+        return (SlabId(generation) << 32) | index;
+    }
+
+    Slot& slot(uint32_t index) { return chunks[index / ChunkSize][index % ChunkSize]; }
+
+    std::vector<std::unique_ptr<Slot[]>> chunks;
+    uint32_t free_head = NO_SLOT;
+    uint32_t used = 0;    // Slots ever handed out; the rest of the last chunk is untouched
+    size_t count = 0;
+};
+
+#endif // SLAB_H
@@ -0,0 +1,237 @@
+/*
+ * MIT License
+ * Minimal io_uring driver over the raw system calls
+ */
+
+#include "uring.h"
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+int io_uring_setup(unsigned entries, io_uring_params* params) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int io_uring_register(int fd, unsigned opcode, void* arg, unsigned count) {
+    return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, count));
+}
+
+} // namespace
+
+Uring::~Uring() {
+    if (buf_ring != nullptr) {
+        munmap(buf_ring, buf_ring_len);
+    }
+    free(buffer_memory);
+    if (sqes != nullptr) {
+        munmap(sqes, sqes_len);
+    }
+    if (cq_map != nullptr && cq_map != sq_map) {
+        munmap(cq_map, cq_map_len);
+    }
+    if (sq_map != nullptr) {
+        munmap(sq_map, sq_map_len);
+    }
+    if (ring_fd != -1) {
+        close(ring_fd);
+    }
+}
+
+bool Uring::init(unsigned entries, bool use_sqpoll) {
+    io_uring_params params{};
+    // Multishot receives post many completions per submission
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = entries * 4;
+    if (use_sqpoll) {
+        params.flags |= IORING_SETUP_SQPOLL;
+        params.sq_thread_idle = 1000;
+    }
+    ring_fd = io_uring_setup(entries, &params);
+    if (ring_fd == -1) {
+        return false;
+    }
+    sqpoll = use_sqpoll;
+    if (!(params.features & IORING_FEAT_EXT_ARG) || !(params.features & IORING_FEAT_NODROP)) {
+        errno = ENOSYS;
+        return false;
+    }
+
+    sq_map_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_map_len = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        sq_map_len = cq_map_len = std::max(sq_map_len, cq_map_len);
+    }
+    sq_map = mmap(nullptr, sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  ring_fd, IORING_OFF_SQ_RING);
+    if (sq_map == MAP_FAILED) {
+        sq_map = nullptr;
+        return false;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        cq_map = sq_map;
+    } else {
+        cq_map = mmap(nullptr, cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring_fd, IORING_OFF_CQ_RING);
+        if (cq_map == MAP_FAILED) {
+            cq_map = nullptr;
+            return false;
+        }
+    }
+    sqes_len = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqe_map = mmap(nullptr, sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         ring_fd, IORING_OFF_SQES);
+    if (sqe_map == MAP_FAILED) {
+        return false;
+    }
+    sqes = static_cast<io_uring_sqe*>(sqe_map);
+
+    char* sq = static_cast<char*>(sq_map);
+    sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_flags = reinterpret_cast<unsigned*>(sq + params.sq_off.flags);
+    sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sq_entries = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_entries);
+    // Submission slot i always holds entry i
+    unsigned* array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    for (unsigned i = 0; i < sq_entries; i++) {
+        array[i] = i;
+    }
+    sqe_tail = submitted = *sq_tail;
+
+    char* cq = static_cast<char*>(cq_map);
+    cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    return true;
+}
+
+io_uring_sqe* Uring::get_sqe() {
+    for (int attempt = 0; attempt < 2; attempt++) {
+        unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+        if (sqe_tail - head < sq_entries) {
+            io_uring_sqe* sqe = &sqes[sqe_tail & sq_mask];
+            sqe_tail++;
+            std::memset(sqe, 0, sizeof(*sqe));
+            return sqe;
+        }
+        // Full: hand the queued entries to the kernel and try once more
+        unsigned pending = flush_sq();
+        if (sqpoll) {
+            enter(0, 0, IORING_ENTER_SQ_WAIT, -1);
+        } else if (enter(pending, 0, 0, -1) < 0) {
+            return nullptr;
+        }
+    }
+    return nullptr;
+}
+
+bool Uring::submit_and_wait(int64_t timeout_ns) {
+    unsigned pending = flush_sq();
+    unsigned flags = 0;
+    if (sqpoll) {
+        // The kernel thread takes submissions unless it went to sleep
+        if (pending > 0 && (__atomic_load_n(sq_flags, __ATOMIC_RELAXED) & IORING_SQ_NEED_WAKEUP)) {
+            flags |= IORING_ENTER_SQ_WAKEUP;
+        }
+        pending = 0;
+    }
+    bool ready = completions_ready();
+    if (ready && pending == 0 && flags == 0) {
+        return true;
+    }
+    if (timeout_ns == 0 && pending == 0 && flags == 0) {
+        return true;
+    }
+
+    unsigned wait = ready || timeout_ns == 0 ? 0 : 1;
+    int ret = enter(pending, wait, flags | (wait ? IORING_ENTER_GETEVENTS : 0), timeout_ns);
+    return ret >= 0 || errno == ETIME || errno == EINTR || errno == EBUSY || errno == EAGAIN;
+}
+
+bool Uring::submit() {
+    unsigned pending = flush_sq();
+    unsigned flags = IORING_ENTER_GETEVENTS;
+    if (sqpoll) {
+        if (pending > 0 && (__atomic_load_n(sq_flags, __ATOMIC_RELAXED) & IORING_SQ_NEED_WAKEUP)) {
+            flags |= IORING_ENTER_SQ_WAKEUP;
+        }
+        pending = 0;
+    }
+    int ret = enter(pending, 0, flags, -1);
+    return ret >= 0 || errno == EINTR || errno == EBUSY || errno == EAGAIN;
+}
+
+unsigned Uring::flush_sq() {
+    unsigned pending = sqe_tail - submitted;
+    if (pending > 0) {
+        __atomic_store_n(sq_tail, sqe_tail, __ATOMIC_RELEASE);
+        submitted = sqe_tail;
+    }
+    return pending;
+}
+
+int Uring::enter(unsigned to_submit, unsigned min_complete, unsigned flags, int64_t timeout_ns) {
+    __kernel_timespec ts{};
+    io_uring_getevents_arg arg{};
+    void* argp = nullptr;
+    size_t argsz = 0;
+    if (timeout_ns >= 0 && (flags & IORING_ENTER_GETEVENTS)) {
+        ts.tv_sec = timeout_ns / 1000000000;
+        ts.tv_nsec = timeout_ns % 1000000000;
+        arg.ts = reinterpret_cast<uint64_t>(&ts);
+        argp = &arg;
+        argsz = sizeof(arg);
+        flags |= IORING_ENTER_EXT_ARG;
+    }
+    syscalls++;
+    return static_cast<int>(syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags,
+                                    argp, argsz));
+}
+
+bool Uring::setup_buffers(uint16_t group, unsigned count, unsigned size) {
+    buf_ring_len = count * sizeof(io_uring_buf);
+    void* ring = mmap(nullptr, buf_ring_len, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED) {
+        return false;
+    }
+    buf_ring = static_cast<io_uring_buf_ring*>(ring);
+    buffer_memory = static_cast<char*>(aligned_alloc(4096, size_t(count) * size));
+    if (buffer_memory == nullptr) {
+        return false;
+    }
+
+    io_uring_buf_reg reg{};
+    reg.ring_addr = reinterpret_cast<uint64_t>(buf_ring);
+    reg.ring_entries = count;
+    reg.bgid = group;
+    if (io_uring_register(ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1) {
+        return false;
+    }
+
+    buffer_size = size;
+    buffer_mask = count - 1;
+    for (unsigned id = 0; id < count; id++) {
+        recycle(static_cast<uint16_t>(id));
+    }
+    return true;
+}
+
+void Uring::recycle(uint16_t id) {
+    // Not buf_ring->bufs: in C++ the header's flexible-array wrapper puts
+    // it 8 bytes in, while the kernel reads the slots from offset 0
+    io_uring_buf& slot = reinterpret_cast<io_uring_buf*>(buf_ring)[buffer_tail & buffer_mask];
+    slot.addr = reinterpret_cast<uint64_t>(buffer(id));
+    slot.len = buffer_size;
+    slot.bid = id;
+    buffer_tail++;
+    __atomic_store_n(&buf_ring->tail, buffer_tail, __ATOMIC_RELEASE);
+    buffers_free++;
+}
@@ -0,0 +1,114 @@
+/*
+ * MIT License
+ * Minimal io_uring driver over the raw system calls
+ */
+
+#ifndef URING_H
+#define URING_H
+
+#include <linux/io_uring.h>
+#include <cstddef>
+#include <cstdint>
+
+// One io_uring instance, its submission and completion rings mapped into
+// this process and driven with io_uring_setup/io_uring_enter directly, so
+// there is no dependency on liburing. Also owns one provided-buffer ring
+// that multishot receives pick their buffers from.
+//
+// Not thread-safe: each reactor has its own.
+class Uring {
+public:
+    Uring() = default;
+    ~Uring();
+
+    Uring(const Uring&) = delete;
+    Uring& operator=(const Uring&) = delete;
+
+    // With sqpoll a kernel thread picks submissions up, so a busy loop
+    // submits without entering the kernel at all
+    bool init(unsigned entries, bool sqpoll);
+
+    // Zeroed submission entry. Submits what is queued when the ring is full;
+    // nullptr only if the kernel refuses to take any.
+    io_uring_sqe* get_sqe();
+
+    // Submit what is queued and wait up to timeout_ns (-1 for no limit) for
+    // a completion. Does not enter the kernel when completions are ready and
+    // nothing needs submitting. False on a hard error.
+    bool submit_and_wait(int64_t timeout_ns);
+
+    // Submit what is queued without waiting. Always enters the kernel,
+    // which is where requests that had to wait (for socket space, say)
+    // post their completions.
+    bool submit();
+
+    // Call fn for each ready completion, then hand the entries back
+    template <typename Fn>
+    unsigned for_each_completion(Fn fn) {
+        unsigned head = *cq_head;
+        unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        unsigned seen = 0;
+        for (; head != tail; head++, seen++) {
+            fn(cqes[head & cq_mask]);
+        }
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+        return seen;
+    }
+
+    // Provided buffers for receives: count (a power of two) buffers of size
+    // bytes in group. A completion names its buffer; recycle() returns it.
+    bool setup_buffers(uint16_t group, unsigned count, unsigned size);
+    char* buffer(uint16_t id) { return buffer_memory + size_t(id) * buffer_size; }
+    void recycle(uint16_t id);
+    void consumed() { buffers_free--; }
+    unsigned free_buffers() const { return buffers_free; }
+
+    // io_uring_enter calls since the last call
+    uint64_t take_syscalls() {
+        uint64_t n = syscalls;
+        syscalls = 0;
+        return n;
+    }
+
+private:
+    int ring_fd = -1;
+    bool sqpoll = false;
+
+    void* sq_map = nullptr;
+    size_t sq_map_len = 0;
+    void* cq_map = nullptr;
+    size_t cq_map_len = 0;
+    io_uring_sqe* sqes = nullptr;
+    size_t sqes_len = 0;
+
+    unsigned* sq_head = nullptr;
+    unsigned* sq_tail = nullptr;
+    unsigned* sq_flags = nullptr;
+    unsigned sq_mask = 0;
+    unsigned sq_entries = 0;
+    unsigned sqe_tail = 0;      // Entries handed out; published to the kernel on submit
+    unsigned submitted = 0;     // Entries published
+
+    unsigned* cq_head = nullptr;
+    unsigned* cq_tail = nullptr;
+    unsigned cq_mask = 0;
+    io_uring_cqe* cqes = nullptr;
+
+    io_uring_buf_ring* buf_ring = nullptr;
+    size_t buf_ring_len = 0;
+    char* buffer_memory = nullptr;
+    unsigned buffer_size = 0;
+    unsigned buffer_mask = 0;
+    uint16_t buffer_tail = 0;
+    unsigned buffers_free = 0;
+
+    uint64_t syscalls = 0;
+
+    unsigned flush_sq();
+    int enter(unsigned to_submit, unsigned min_complete, unsigned flags, int64_t timeout_ns);
+    bool completions_ready() const {
+        return __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE) != *cq_head;
+    }
+};
+
+#endif // URING_H
@@ -0,0 +1,175 @@
+/*
+ * MIT License
+ * Size-class block pools with per-thread caches
+ */
+
+#ifndef BLOCK_POOL_H
+#define BLOCK_POOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <vector>
+
+// Memory for objects made and dropped once per message: wire frames, queue
+// nodes, receive buffers. Requests are rounded up to a power of two from
+// 64 bytes to 8 KB, and each size class keeps freed blocks on a list per
+// thread, so allocating or freeing is a pointer pop or push with no lock
+// and no call into malloc. Larger requests go to operator new.
+//
+// A block may be freed on another thread than the one that allocated it
+// (a frame is released by whichever worker drops the last reference); it
+// joins the freeing thread's list. A list that grows past THREAD_LIMIT
+// hands a batch to a shared list under a mutex, and an empty one takes a
+// batch from there before carving a new chunk. Memory follows the peak
+// number of live blocks and is not returned to the system.
+namespace block_pool {
+
+constexpr size_t MIN_BLOCK = 64;
+constexpr int CLASSES = 8;
+constexpr size_t MAX_BLOCK = MIN_BLOCK << (CLASSES - 1);
+constexpr size_t CHUNK_SIZE = 64 * 1024;
+constexpr uint32_t BATCH = 32;              // Blocks moved to or from the shared list
+constexpr uint32_t THREAD_LIMIT = 4 * BATCH;
+
+// Size class of a request; -1 if it is too large for the pools
+inline int size_class(size_t bytes) {
+    if (bytes > MAX_BLOCK) {
+        return -1;
+    }
+    return bytes <= MIN_BLOCK ? 0 : 64 - __builtin_clzll(bytes - 1) - 6;
+}
+
+inline size_t class_size(int size_class) {
+    return MIN_BLOCK << size_class;
+}
+
+namespace detail {
+
+struct FreeBlock {
+    FreeBlock* next;
+};
+
+struct FreeList {
+    FreeBlock* head = nullptr;
+    uint32_t count = 0;
+
+    void push(FreeBlock* block) {
+        block->next = head;
+        head = block;
+        count++;
+    }
+    FreeBlock* pop() {
+        FreeBlock* block = head;
+        head = block->next;
+        count--;
+        return block;
+    }
+};
+
+struct Shared {
+    std::mutex mutex;
+    FreeList lists[CLASSES];
+    std::vector<void*> chunks;
+};
+
+// Never destroyed: blocks may be freed by static destructors
+inline Shared& shared() {
+    static Shared* pools = new Shared;
+    return *pools;
+}
+
+// Trivially destructible, so the lists stay valid while the thread exits
+struct ThreadCache {
+    FreeList lists[CLASSES];
+    bool exited = false;   // Past thread exit: everything goes to the shared lists
+};
+
+inline ThreadCache& thread_cache() {
+    thread_local ThreadCache cache;
+    return cache;
+}
+
+inline void give_back(FreeList& from, int size_class, uint32_t count) {
+    Shared& pools = shared();
+    std::lock_guard<std::mutex> lock(pools.mutex);
+    while (count-- > 0 && from.head != nullptr) {
+        pools.lists[size_class].push(from.pop());
+    }
+}
+
+// Hands a thread's cached blocks back when it exits
+struct ExitFlush {
+    ~ExitFlush() {
+        ThreadCache& cache = thread_cache();
+        for (int c = 0; c < CLASSES; c++) {
+            give_back(cache.lists[c], c, cache.lists[c].count);
+        }
+        cache.exited = true;
+    }
+};
+
+// Slow path: a batch from the shared list, carving a fresh chunk into it
+// when it is empty
+inline void refill(ThreadCache& cache, int size_class) {
+    thread_local ExitFlush flush;
+    (void)flush;
+
+    FreeList& to = cache.lists[size_class];
+    Shared& pools = shared();
+    std::lock_guard<std::mutex> lock(pools.mutex);
+    FreeList& from = pools.lists[size_class];
+    if (from.head == nullptr) {
+        size_t size = class_size(size_class);
+        char* chunk = static_cast<char*>(::operator new(CHUNK_SIZE));
+        pools.chunks.push_back(chunk);
+        for (size_t offset = CHUNK_SIZE; offset >= size; offset -= size) {
+            from.push(reinterpret_cast<FreeBlock*>(chunk + offset - size));
+        }
+    }
+    for (uint32_t i = 0; i < BATCH && from.head != nullptr; i++) {
+        to.push(from.pop());
+    }
+}
+
+} // namespace detail
+
+inline void* allocate(size_t bytes) {
+    int c = size_class(bytes);
+    if (c < 0) {
+        return ::operator new(bytes);
+    }
+    detail::ThreadCache& cache = detail::thread_cache();
+    if (cache.exited) {
+        detail::Shared& pools = detail::shared();
+        std::lock_guard<std::mutex> lock(pools.mutex);
+        if (pools.lists[c].head != nullptr) {
+            return pools.lists[c].pop();
+        }
+        return ::operator new(class_size(c));
+    }
+    if (cache.lists[c].head == nullptr) {
+        detail::refill(cache, c);
+    }
+    return cache.lists[c].pop();
+}
+
+// bytes must be the size the block was allocated with
+inline void free(void* block, size_t bytes) {
+    int c = size_class(bytes);
+    if (c < 0) {
+        ::operator delete(block);
+        return;
+    }
+    detail::ThreadCache& cache = detail::thread_cache();
+    detail::FreeList& list = cache.lists[c];
+    list.push(static_cast<detail::FreeBlock*>(block));
+    if (cache.exited || list.count > THREAD_LIMIT) {
+        detail::give_back(list, c, cache.exited ? list.count : BATCH);
+    }
+}
+
+} // namespace block_pool
+
+#endif // BLOCK_POOL_H
@@ -0,0 +1,50 @@
+/*
+ * MIT License
+ * Preset compression dictionary for chat traffic
+ */
+
+#ifndef CHAT_DICTIONARY_H
+#define CHAT_DICTIONARY_H
+
+#include <string_view>
+
+// Primes the LZ4 and deflate compressors on both ends of a connection, so
+// a single chat line finds matches before any of its own text has been
+// seen. It holds the control objects' fixed text and common words and
+// phrases of English chat, the most frequent last: deflate codes nearer
+// matches in fewer bits. Both ends must use exactly these bytes, so
+// changing them changes the protocol; deflate streams carry its Adler-32
+// (chat_dictionary_id()), so a mismatch is detected.
+constexpr std::string_view CHAT_DICTIONARY =
+    "{\"type\":\"skipped\",\"count\":{\"type\":\"presence_remove\",\"seq\":"
+    "{\"type\":\"presence_add\",\"seq\":{\"type\":\"userlist\",\"room\":\"lobby\",\"seq\":"
+    "\"users\":[\"{\"type\":\"history\",{\"type\":\"join\",\"room\":\""
+    "{\"type\":\"leave\",\"room\":\"\"since\":\"\"time\":\"20"
+    "Unfortunately the application crashed again after the update, "
+    "could you please check the server configuration and the database connection? "
+    "I think the problem is with the network, everything was working yesterday. "
+    "Does anyone know how to install the latest version on Linux or Windows? "
+    "Thanks for your help, I really appreciate it. Let me know what you think about "
+    "the new design, the meeting is tomorrow morning at 10 and we should discuss "
+    "the project deadline. Sorry, I was busy with work, I will send the file later today. "
+    "Good morning everyone! Hello, how are you doing? I'm fine, thank you. "
+    "What are you doing this weekend? Did you see the game last night? "
+    "That sounds like a great idea, I agree with you. Yes, of course. No problem. "
+    "Have a nice day! See you later. I don't know, maybe we can try again. "
+    "It's not working, can you help me? I have a question about this. "
+    "Where is the link? Here it is: https://www. Please, wait a minute. "
+    "joined the chat left the chat SERVER lobby "
+    "the and you that this have for with not but what just was are can "
+    "lol ok okay yeah yes no thanks hi hey good great nice ";
+
+// Adler-32 of CHAT_DICTIONARY, as zlib reports it
+constexpr unsigned long chat_dictionary_id() {
+    unsigned long a = 1, b = 0;
+    for (char c : CHAT_DICTIONARY) {
+        a = (a + static_cast<unsigned char>(c)) % 65521;
+        b = (b + a) % 65521;
+    }
+    return (b << 16) | a;
+}
+
+#endif // CHAT_DICTIONARY_H
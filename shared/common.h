@@ -6,6 +6,7 @@
 #ifndef COMMON_H
 #define COMMON_H
 
+#include "timestamp.h"
 #include <cstring>
 #include <ctime>
 #include <string>
@@ -14,13 +15,21 @@
 // Message protocol constants
 constexpr int MAX_USERNAME_LEN = 32;
 constexpr int MAX_TIMESTAMP_LEN = 32;
+static_assert(MAX_TIMESTAMP_LEN >= int(timestamp::TEXT_SIZE), "timestamp buffers too small");
 constexpr int MAX_MESSAGE_TEXT_LEN = 512;
+constexpr int MAX_ROOM_NAME_LEN = 32;
 constexpr int SHARED_MEMORY_CAPACITY = 64;
+// Longest accepted protocol line: a full message with room for JSON escaping
+constexpr int MAX_FRAME_LEN = 2 * MAX_MESSAGE_TEXT_LEN + MAX_USERNAME_LEN + MAX_TIMESTAMP_LEN + 64;
 constexpr int DEFAULT_PORT = 5000;
 constexpr const char* DEFAULT_SHM_NAME = "/os_chat_shm";
 constexpr const char* SEM_MUTEX_NAME = "/os_chat_mutex";
 constexpr const char* SEM_FULL_NAME = "/os_chat_full";
 constexpr const char* SEM_EMPTY_NAME = "/os_chat_empty";
+constexpr const char* DEFAULT_ROOM = "lobby";  // Every client joins it on login
+constexpr const char* WELCOME_MESSAGE =
+    "{\"type\":\"welcome\",\"text\":\"Please send your username\",\"protocols\":[\"json\",\"bin1\"],"
+    "\"compression\":[\"lz4\",\"deflate\"]}\n";
 
 // Message structure for shared memory
 struct ChatMessage {
@@ -55,21 +64,33 @@ struct SharedMemoryLayout {
                           capacity(SHARED_MEMORY_CAPACITY), active_users(0) {}
 };
 
-// Utility function to get current timestamp
+// Current time in the protocol's format, written to out (MAX_TIMESTAMP_LEN
+// bytes); returns its length
+inline size_t get_timestamp(char* out) {
+    return timestamp::format_now(out);
+}
+
 inline std::string get_timestamp() {
-    time_t now = time(nullptr);
     char buf[MAX_TIMESTAMP_LEN];
-    strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", gmtime(&now));
-    return std::string(buf);
+    return std::string(buf, get_timestamp(buf));
 }
 
 // JSON message format helper
 inline std::string create_json_message(const std::string& user, 
                                       const std::string& text,
                                       const std::string& time = "") {
-    std::string timestamp = time.empty() ? get_timestamp() : time;
-    return "{\"user\":\"" + user + "\",\"time\":\"" + timestamp + 
-           "\",\"text\":\"" + text + "\"}\n";
+    char now[MAX_TIMESTAMP_LEN];
+    size_t now_len = time.empty() ? get_timestamp(now) : 0;
+    std::string json;
+    json.reserve(user.size() + time.size() + now_len + text.size() + 32);
+    json.append("{\"user\":\"").append(user).append("\",\"time\":\"");
+    if (time.empty()) {
+        json.append(now, now_len);
+    } else {
+        json.append(time);
+    }
+    json.append("\",\"text\":\"").append(text).append("\"}\n");
+    return json;
 }
 
 #endif // COMMON_H
@@ -0,0 +1,123 @@
+/*
+ * MIT License
+ * HDR histogram for latency measurements
+ */
+
+#ifndef HDR_HISTOGRAM_H
+#define HDR_HISTOGRAM_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// High-dynamic-range histogram in the style of HdrHistogram: values from 1
+// to highest are counted in log-linear buckets, so every recorded value is
+// kept to the requested number of significant decimal digits however large
+// it is. Recording is a few shifts and an increment, with no allocation.
+// Not thread-safe; give each thread its own and merge them.
+class HdrHistogram {
+public:
+    explicit HdrHistogram(uint64_t highest = 3600ull * 1000 * 1000 * 1000,
+                          int significant_digits = 3) {
+        uint64_t largest_single_unit = 2 * static_cast<uint64_t>(std::pow(10, significant_digits));
+        int magnitude = 0;
+        while ((1ull << magnitude) < largest_single_unit) {
+            magnitude++;
+        }
+        sub_bucket_half_magnitude = magnitude - 1;
+        sub_bucket_count = 1ull << magnitude;
+        sub_bucket_half_count = sub_bucket_count / 2;
+
+        int buckets = 1;
+        for (uint64_t reach = sub_bucket_count; reach <= highest; reach <<= 1) {
+            buckets++;
+        }
+        highest_trackable = highest;
+        counts.assign((buckets + 1) * sub_bucket_half_count, 0);
+    }
+
+    // Values above the trackable range are clamped to it
+    void record(uint64_t value, uint64_t count = 1) {
+        value = std::min(value, highest_trackable);
+        counts[index_of(value)] += count;
+        total += count;
+        sum += static_cast<double>(value) * count;
+        min_value = std::min(min_value, value);
+        max_value = std::max(max_value, value);
+    }
+
+    void merge(const HdrHistogram& other) {
+        for (size_t i = 0; i < counts.size() && i < other.counts.size(); i++) {
+            counts[i] += other.counts[i];
+        }
+        total += other.total;
+        sum += other.sum;
+        min_value = std::min(min_value, other.min_value);
+        max_value = std::max(max_value, other.max_value);
+    }
+
+    void reset() {
+        std::fill(counts.begin(), counts.end(), 0);
+        total = 0;
+        sum = 0;
+        min_value = UINT64_MAX;
+        max_value = 0;
+    }
+
+    uint64_t count() const { return total; }
+    uint64_t min() const { return total ? min_value : 0; }
+    uint64_t max() const { return max_value; }
+    double mean() const { return total ? sum / total : 0; }
+
+    // Smallest value that percentile percent of recorded values do not
+    // exceed, reported as the top of its bucket
+    uint64_t value_at_percentile(double percentile) const {
+        if (total == 0) {
+            return 0;
+        }
+        double fraction = std::min(std::max(percentile, 0.0), 100.0) / 100;
+        uint64_t wanted = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(fraction * total)));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts.size(); i++) {
+            seen += counts[i];
+            if (seen >= wanted) {
+                return std::min(highest_equivalent(i), max_value);
+            }
+        }
+        return max_value;
+    }
+
+private:
+    int sub_bucket_half_magnitude;
+    uint64_t sub_bucket_count;
+    uint64_t sub_bucket_half_count;
+    uint64_t highest_trackable;
+    std::vector<uint64_t> counts;
+    uint64_t total = 0;
+    double sum = 0;
+    uint64_t min_value = UINT64_MAX;
+    uint64_t max_value = 0;
+
+    // Bucket b holds values in [sub_bucket_count << (b - 1), sub_bucket_count << b),
+    // each of its slots 1 << b wide; bucket 0 also holds everything below
+    size_t index_of(uint64_t value) const {
+        int ceiling = 64 - __builtin_clzll(value | (sub_bucket_count - 1));
+        int bucket = ceiling - (sub_bucket_half_magnitude + 1);
+        uint64_t sub_bucket = value >> bucket;
+        return ((static_cast<size_t>(bucket) + 1) << sub_bucket_half_magnitude) +
+               (sub_bucket - sub_bucket_half_count);
+    }
+
+    uint64_t highest_equivalent(size_t index) const {
+        int bucket = static_cast<int>(index >> sub_bucket_half_magnitude) - 1;
+        uint64_t sub_bucket = (index & (sub_bucket_half_count - 1)) + sub_bucket_half_count;
+        if (bucket < 0) {
+            sub_bucket -= sub_bucket_half_count;
+            bucket = 0;
+        }
+        return (sub_bucket << bucket) + (1ull << bucket) - 1;
+    }
+};
+
+#endif // HDR_HISTOGRAM_H
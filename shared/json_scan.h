@@ -0,0 +1,644 @@
+/*
+ * MIT License
+ * Vectorized JSON tokenizer for chat protocol frames
+ */
+
+#ifndef JSON_SCAN_H
+#define JSON_SCAN_H
+
+#include "common.h"
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define JSON_SCAN_X86 1
+#endif
+
+inline int json_hex_digit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// The four hex digits at pos as a number; -1 if they are not there
+inline long json_hex4(std::string_view text, size_t pos) {
+    if (pos + 4 > text.size()) {
+        return -1;
+    }
+    long code = 0;
+    for (size_t k = pos; k < pos + 4; k++) {
+        int digit = json_hex_digit(text[k]);
+        if (digit < 0) {
+            return -1;
+        }
+        code = code * 16 + digit;
+    }
+    return code;
+}
+
+inline bool json_high_surrogate(long code) { return code >= 0xD800 && code <= 0xDBFF; }
+inline bool json_low_surrogate(long code) { return code >= 0xDC00 && code <= 0xDFFF; }
+
+// Fields of one chat protocol object. Views point into the scanned frame
+// and are still JSON-escaped; json_unescape() decodes them when needed.
+// users is the raw body of the "users" array, iterate it with
+// json_next_array_string().
+struct ChatFields {
+    std::string_view user;
+    std::string_view time;
+    std::string_view text;
+    std::string_view type;
+    std::string_view proto;
+    std::string_view compress;
+    std::string_view room;
+    std::string_view since;
+    std::string_view count;   // Number, as written
+    std::string_view users;
+    bool has_user = false;
+    bool has_text = false;
+    bool has_users = false;
+};
+
+// Why a frame was rejected
+enum class JsonError {
+    NONE,
+    TOO_LONG,      // Longer than the scanner accepts
+    UNTERMINATED,  // String still open at the end of the frame
+    CONTROL_CHAR,  // Raw control character inside a string
+    BAD_ESCAPE,    // Unknown escape or malformed \u sequence
+    DUPLICATE_KEY, // A schema key given twice, or a key with escapes
+    SYNTAX         // Anything that is not a flat chat object
+};
+
+inline const char* json_error_name(JsonError error) {
+    switch (error) {
+    case JsonError::NONE: return "ok";
+    case JsonError::TOO_LONG: return "too long";
+    case JsonError::UNTERMINATED: return "unterminated string";
+    case JsonError::CONTROL_CHAR: return "control character in string";
+    case JsonError::BAD_ESCAPE: return "bad escape";
+    case JsonError::DUPLICATE_KEY: return "duplicate key";
+    case JsonError::SYNTAX: return "syntax error";
+    }
+    return "unknown";
+}
+
+// Two-stage tokenizer in the style of simdjson. Stage 1 classifies 64
+// bytes at a time with SSE2 compares or AVX2 table lookups into bitmasks
+// of quotes, backslashes, structural characters and whitespace, resolves
+// escaped quotes and string interiors with carry-propagated bit arithmetic,
+// checks escapes and control characters, and writes the offset of every
+// structural token to an index. Stage 2 walks
+// that index to validate the object and pick out the chat fields, so
+// string contents are never visited byte by byte.
+//
+// The chat schema is a single flat object whose values are strings,
+// numbers, literals or arrays of strings. A scanner owns its index and is
+// reused frame after frame without allocating; it is not thread-safe.
+class JsonScanner {
+public:
+    static constexpr size_t MAX_SCAN_LEN = MAX_FRAME_LEN;
+
+    JsonError parse(std::string_view frame, ChatFields& fields) {
+        fields = ChatFields();
+        if (frame.size() > MAX_SCAN_LEN) {
+            return JsonError::TOO_LONG;
+        }
+        JsonError error = index(frame);
+        if (error != JsonError::NONE) {
+            return error;
+        }
+        return walk(frame, fields);
+    }
+
+private:
+    // A structural token per input byte at most, plus the end sentinel
+    uint32_t tokens[MAX_SCAN_LEN + 1];
+    size_t token_count = 0;
+
+    // Per-block classification bitmasks; bit i is byte i of the block
+    struct Block {
+        uint64_t quote;
+        uint64_t backslash;
+        uint64_t op;          // { } [ ] : ,
+        uint64_t whitespace;
+        uint64_t control;     // Bytes below 0x20
+    };
+
+    // --- Stage 1 -----------------------------------------------------------------
+
+    static void classify_scalar(const uint8_t* in, Block& block) {
+        block = Block{};
+        for (size_t i = 0; i < 64; i++) {
+            uint8_t c = in[i];
+            uint64_t bit = uint64_t(1) << i;
+            if (c == '"') block.quote |= bit;
+            if (c == '\\') block.backslash |= bit;
+            if ((c | 0x20) == '{' || (c | 0x20) == '}' || c == ':' || c == ',') block.op |= bit;
+            if (c == ' ' || c == '\t' || c == '\n' || c == '\r') block.whitespace |= bit;
+            if (c < 0x20) block.control |= bit;
+        }
+    }
+
+    static bool plain_scalar(const uint8_t* in) {
+        for (size_t i = 0; i < 64; i++) {
+            if (in[i] == '"' || in[i] == '\\' || in[i] < 0x20) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+#ifdef JSON_SCAN_X86
+    static bool plain_sse2(const uint8_t* in) {
+        const __m128i quote = _mm_set1_epi8('"');
+        const __m128i backslash = _mm_set1_epi8('\\');
+        const __m128i below_space = _mm_set1_epi8(0x1F);
+        __m128i special = _mm_setzero_si128();
+        for (int part = 0; part < 4; part++) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 16 * part));
+            special = _mm_or_si128(special, _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+                _mm_cmpeq_epi8(_mm_max_epu8(v, below_space), below_space)));
+        }
+        return _mm_movemask_epi8(special) == 0;
+    }
+
+    __attribute__((target("avx2")))
+    static bool plain_avx2(const uint8_t* in) {
+        const __m256i quote = _mm256_set1_epi8('"');
+        const __m256i backslash = _mm256_set1_epi8('\\');
+        const __m256i below_space = _mm256_set1_epi8(0x1F);
+        __m256i special = _mm256_setzero_si256();
+        for (int part = 0; part < 2; part++) {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + 32 * part));
+            special = _mm256_or_si256(special, _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, backslash)),
+                _mm256_cmpeq_epi8(_mm256_max_epu8(v, below_space), below_space)));
+        }
+        return _mm256_testz_si256(special, special);
+    }
+
+    static void classify_sse2(const uint8_t* in, Block& block) {
+        block = Block{};
+        const __m128i quote = _mm_set1_epi8('"');
+        const __m128i backslash = _mm_set1_epi8('\\');
+        const __m128i case_bit = _mm_set1_epi8(0x20);   // Folds [ ] onto { }
+        const __m128i open = _mm_set1_epi8('{');
+        const __m128i close = _mm_set1_epi8('}');
+        const __m128i colon = _mm_set1_epi8(':');
+        const __m128i comma = _mm_set1_epi8(',');
+        const __m128i space = _mm_set1_epi8(' ');
+        const __m128i tab = _mm_set1_epi8('\t');
+        const __m128i lf = _mm_set1_epi8('\n');
+        const __m128i cr = _mm_set1_epi8('\r');
+        const __m128i below_space = _mm_set1_epi8(0x1F);
+
+        for (int part = 0; part < 4; part++) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 16 * part));
+            __m128i folded = _mm_or_si128(v, case_bit);
+            __m128i op = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(folded, open), _mm_cmpeq_epi8(folded, close)),
+                _mm_or_si128(_mm_cmpeq_epi8(v, colon), _mm_cmpeq_epi8(v, comma)));
+            __m128i ws = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, tab)),
+                _mm_or_si128(_mm_cmpeq_epi8(v, lf), _mm_cmpeq_epi8(v, cr)));
+            __m128i control = _mm_cmpeq_epi8(_mm_max_epu8(v, below_space), below_space);
+
+            int shift = 16 * part;
+            block.quote |= uint64_t(uint16_t(_mm_movemask_epi8(_mm_cmpeq_epi8(v, quote)))) << shift;
+            block.backslash |=
+                uint64_t(uint16_t(_mm_movemask_epi8(_mm_cmpeq_epi8(v, backslash)))) << shift;
+            block.op |= uint64_t(uint16_t(_mm_movemask_epi8(op))) << shift;
+            block.whitespace |= uint64_t(uint16_t(_mm_movemask_epi8(ws))) << shift;
+            block.control |= uint64_t(uint16_t(_mm_movemask_epi8(control))) << shift;
+        }
+    }
+
+    // Whitespace and operators come from 16-entry tables indexed by the low
+    // nibble (vpshufb), as in simdjson: a byte is whitespace when the table
+    // returns the byte itself, an operator when it returns the byte | 0x20.
+    // Stray control bytes that alias ':' or ',' are caught by stage 2.
+    __attribute__((target("avx2")))
+    static void classify_avx2(const uint8_t* in, Block& block) {
+        block = Block{};
+        const __m256i whitespace_table = _mm256_setr_epi8(
+            ' ', 100, 100, 100, 17, 100, 113, 2, 100, '\t', '\n', 112, 100, '\r', 100, 100,
+            ' ', 100, 100, 100, 17, 100, 113, 2, 100, '\t', '\n', 112, 100, '\r', 100, 100);
+        const __m256i op_table = _mm256_setr_epi8(
+            0, 0, 0, 0, 0, 0, 0, 0, 0, 0, ':', '{', ',', '}', 0, 0,
+            0, 0, 0, 0, 0, 0, 0, 0, 0, 0, ':', '{', ',', '}', 0, 0);
+        const __m256i quote = _mm256_set1_epi8('"');
+        const __m256i backslash = _mm256_set1_epi8('\\');
+        const __m256i case_bit = _mm256_set1_epi8(0x20);
+        const __m256i below_space = _mm256_set1_epi8(0x1F);
+
+        for (int part = 0; part < 2; part++) {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + 32 * part));
+            __m256i ws = _mm256_cmpeq_epi8(v, _mm256_shuffle_epi8(whitespace_table, v));
+            __m256i op = _mm256_cmpeq_epi8(_mm256_or_si256(v, case_bit),
+                                           _mm256_shuffle_epi8(op_table, v));
+            __m256i control = _mm256_cmpeq_epi8(_mm256_max_epu8(v, below_space), below_space);
+
+            int shift = 32 * part;
+            block.quote |=
+                uint64_t(uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, quote)))) << shift;
+            block.backslash |=
+                uint64_t(uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, backslash)))) << shift;
+            block.op |= uint64_t(uint32_t(_mm256_movemask_epi8(op))) << shift;
+            block.whitespace |= uint64_t(uint32_t(_mm256_movemask_epi8(ws))) << shift;
+            block.control |= uint64_t(uint32_t(_mm256_movemask_epi8(control))) << shift;
+        }
+    }
+#endif
+
+    static void classify(const uint8_t* in, Block& block) {
+#ifdef JSON_SCAN_X86
+        static const bool has_avx2 = __builtin_cpu_supports("avx2");
+        if (has_avx2) {
+            classify_avx2(in, block);
+        } else {
+            classify_sse2(in, block);
+        }
+#else
+        classify_scalar(in, block);
+#endif
+    }
+
+    // No quote, backslash or control byte in the block. Inside a string,
+    // such a block holds no token and nothing to check.
+    static bool plain(const uint8_t* in) {
+#ifdef JSON_SCAN_X86
+        static const bool has_avx2 = __builtin_cpu_supports("avx2");
+        return has_avx2 ? plain_avx2(in) : plain_sse2(in);
+#else
+        return plain_scalar(in);
+#endif
+    }
+
+    // Bits of characters preceded by an odd run of backslashes. carry holds
+    // whether the previous block ended inside such a run.
+    static uint64_t escaped_bits(uint64_t backslash, uint64_t& carry) {
+        const uint64_t even_bits = 0x5555555555555555ULL;
+        backslash &= ~carry;
+        uint64_t follows_escape = (backslash << 1) | carry;
+        uint64_t odd_starts = backslash & ~even_bits & ~follows_escape;
+        uint64_t sequences_on_even;
+        carry = __builtin_add_overflow(odd_starts, backslash, &sequences_on_even) ? 1 : 0;
+        uint64_t invert_mask = sequences_on_even << 1;
+        return (even_bits ^ invert_mask) & follows_escape;
+    }
+
+    // Bit i set when an odd number of bits at or below i are set
+    static uint64_t prefix_xor(uint64_t bits) {
+        bits ^= bits << 1;
+        bits ^= bits << 2;
+        bits ^= bits << 4;
+        bits ^= bits << 8;
+        bits ^= bits << 16;
+        bits ^= bits << 32;
+        return bits;
+    }
+
+    JsonError index(std::string_view frame) {
+        const uint8_t* data = reinterpret_cast<const uint8_t*>(frame.data());
+        size_t size = frame.size();
+        uint64_t escape_carry = 0;
+        uint64_t in_string_carry = 0;   // All ones while a string spans blocks
+        uint64_t scalar_carry = 0;      // Previous block ended inside a scalar
+        size_t low_surrogate = 0;       // Where a \u escape of a low surrogate may be
+        token_count = 0;
+
+        for (size_t base = 0; base < size; base += 64) {
+            Block block;
+            if (size - base >= 64) {
+                // Most of a long text: skipped after one cheap test
+                if (in_string_carry && !escape_carry && plain(data + base)) {
+                    scalar_carry = 0;
+                    continue;
+                }
+                classify(data + base, block);
+            } else {
+                uint8_t tail[64];
+                std::memset(tail, ' ', sizeof(tail));
+                std::memcpy(tail, data + base, size - base);
+                classify(tail, block);
+            }
+
+            uint64_t escaped = escaped_bits(block.backslash, escape_carry);
+            uint64_t quotes = block.quote & ~escaped;
+            // Opening quote and string interior; the closing quote is outside
+            uint64_t in_string = prefix_xor(quotes) ^ in_string_carry;
+            in_string_carry = uint64_t(int64_t(in_string) >> 63);
+
+            if (block.control & in_string & ~quotes) {
+                return JsonError::CONTROL_CHAR;
+            }
+            // \" and \\ are always valid; the rarer escapes are checked one by one
+            uint64_t other_escapes = escaped & in_string & ~(block.quote | block.backslash);
+            for (uint64_t bits = other_escapes; bits; bits &= bits - 1) {
+                if (!valid_escape(frame, base + __builtin_ctzll(bits), low_surrogate)) {
+                    return JsonError::BAD_ESCAPE;
+                }
+            }
+
+            // Anything outside strings that is not punctuation or whitespace
+            // belongs to a number or literal; index where each one starts
+            uint64_t scalar = ~(block.op | block.whitespace | quotes | in_string);
+            uint64_t scalar_starts = scalar & ~((scalar << 1) | scalar_carry);
+            scalar_carry = scalar >> 63;
+
+            uint64_t structural = (block.op & ~in_string) | quotes | scalar_starts;
+            while (structural) {
+                tokens[token_count++] = uint32_t(base + __builtin_ctzll(structural));
+                structural &= structural - 1;
+            }
+        }
+
+        if (in_string_carry) {
+            return JsonError::UNTERMINATED;
+        }
+        tokens[token_count] = uint32_t(size); // Sentinel
+        return JsonError::NONE;
+    }
+
+    // --- Stage 2 -----------------------------------------------------------------
+
+    // Character at pos follows a backslash: one of "\/bfnrt or u + 4 hex
+    // digits. A UTF-16 surrogate is only valid as a high one escaped right
+    // before a low one; low_surrogate is set to where that low one's u is.
+    static bool valid_escape(std::string_view frame, size_t pos, size_t& low_surrogate) {
+        char e = frame[pos];
+        if (e == 'u') {
+            long code = json_hex4(frame, pos + 1);
+            if (json_high_surrogate(code)) {
+                if (frame.substr(pos + 5, 2) != "\\u" ||
+                    !json_low_surrogate(json_hex4(frame, pos + 7))) {
+                    return false;
+                }
+                low_surrogate = pos + 6;
+                return true;
+            }
+            if (json_low_surrogate(code)) {
+                return pos == low_surrogate;
+            }
+            return code >= 0;
+        }
+        return e != '\0' && std::strchr("\"\\/bfnrt", e) != nullptr;
+    }
+
+    // A number or true/false/null starting at start; its end in end
+    static bool valid_scalar(std::string_view frame, size_t start, size_t& end) {
+        end = start;
+        while (end < frame.size() &&
+               std::strchr(" \t\r\n{}[]:,\"", frame[end]) == nullptr) {
+            end++;
+        }
+        std::string_view word = frame.substr(start, end - start);
+        if (word == "true" || word == "false" || word == "null") {
+            return true;
+        }
+
+        size_t i = 0;
+        if (i < word.size() && word[i] == '-') i++;
+        size_t digits = i;
+        while (i < word.size() && std::isdigit(static_cast<unsigned char>(word[i]))) i++;
+        if (i == digits || (word[digits] == '0' && i - digits > 1)) {
+            return false;
+        }
+        if (i < word.size() && word[i] == '.') {
+            size_t fraction = ++i;
+            while (i < word.size() && std::isdigit(static_cast<unsigned char>(word[i]))) i++;
+            if (i == fraction) return false;
+        }
+        if (i < word.size() && (word[i] == 'e' || word[i] == 'E')) {
+            i++;
+            if (i < word.size() && (word[i] == '+' || word[i] == '-')) i++;
+            size_t exponent = i;
+            while (i < word.size() && std::isdigit(static_cast<unsigned char>(word[i]))) i++;
+            if (i == exponent) return false;
+        }
+        return i == word.size();
+    }
+
+    // String token pair at tokens[t], tokens[t + 1]; advances t past it
+    bool read_string(std::string_view frame, size_t& t, std::string_view& out) const {
+        if (t + 1 >= token_count || frame[tokens[t]] != '"' || frame[tokens[t + 1]] != '"') {
+            return false;
+        }
+        size_t start = tokens[t] + 1;
+        out = frame.substr(start, tokens[t + 1] - start);
+        t += 2;
+        return true;
+    }
+
+    JsonError walk(std::string_view frame, ChatFields& fields) const {
+        uint32_t seen = 0;   // Schema keys so far, by schema_key()
+        size_t t = 0;
+        if (token_count == 0 || frame[tokens[0]] != '{') {
+            return JsonError::SYNTAX;
+        }
+        t++;
+
+        if (t < token_count && frame[tokens[t]] == '}') {
+            t++;
+        } else {
+            while (true) {
+                std::string_view key;
+                if (!read_string(frame, t, key) || t >= token_count || frame[tokens[t]] != ':') {
+                    return JsonError::SYNTAX;
+                }
+                // Receivers would read the last of two "user" keys, or decode an
+                // escaped one, while the server checked another
+                int bit = schema_key(key);
+                if (key.find('\\') != std::string_view::npos ||
+                    (bit >= 0 && (seen & (1u << bit)) != 0)) {
+                    return JsonError::DUPLICATE_KEY;
+                }
+                if (bit >= 0) {
+                    seen |= 1u << bit;
+                }
+                t++;
+                if (t >= token_count) {
+                    return JsonError::SYNTAX;
+                }
+
+                std::string_view value;
+                char c = frame[tokens[t]];
+                if (c == '"') {
+                    read_string(frame, t, value);
+                    assign(fields, key, value);
+                } else if (c == '[') {
+                    size_t open = tokens[t++];
+                    if (t < token_count && frame[tokens[t]] != ']') {
+                        while (true) {
+                            std::string_view item;
+                            if (!read_string(frame, t, item) || t >= token_count) {
+                                return JsonError::SYNTAX;
+                            }
+                            if (frame[tokens[t]] == ']') {
+                                break;
+                            }
+                            if (frame[tokens[t]] != ',') {
+                                return JsonError::SYNTAX;
+                            }
+                            t++;
+                        }
+                    }
+                    if (t >= token_count) {
+                        return JsonError::SYNTAX;
+                    }
+                    size_t close = tokens[t++];
+                    if (key == "users") {
+                        fields.users = frame.substr(open + 1, close - open - 1);
+                        fields.has_users = true;
+                    }
+                } else if (std::strchr("{}]:,", c) == nullptr) {
+                    size_t end;
+                    if (!valid_scalar(frame, tokens[t], end)) {
+                        return JsonError::SYNTAX;
+                    }
+                    if (key == "count") {
+                        fields.count = frame.substr(tokens[t], end - tokens[t]);
+                    }
+                    t++;
+                } else {
+                    return JsonError::SYNTAX; // Nested objects are not part of the schema
+                }
+
+                if (t >= token_count) {
+                    return JsonError::SYNTAX;
+                }
+                if (frame[tokens[t]] == '}') {
+                    t++;
+                    break;
+                }
+                if (frame[tokens[t]] != ',') {
+                    return JsonError::SYNTAX;
+                }
+                t++;
+            }
+        }
+
+        // Only whitespace may follow the object
+        return t == token_count ? JsonError::NONE : JsonError::SYNTAX;
+    }
+
+    // Index of key among the fields ChatFields holds; -1 for other keys
+    static int schema_key(std::string_view key) {
+        static constexpr std::string_view keys[] = {
+            "user", "time", "text", "type", "proto", "compress", "room", "since", "count", "users"
+        };
+        for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+            if (key == keys[i]) {
+                return static_cast<int>(i);
+            }
+        }
+        return -1;
+    }
+
+    static void assign(ChatFields& fields, std::string_view key, std::string_view value) {
+        if (key == "user") {
+            fields.user = value;
+            fields.has_user = true;
+        } else if (key == "text") {
+            fields.text = value;
+            fields.has_text = true;
+        } else if (key == "time") {
+            fields.time = value;
+        } else if (key == "type") {
+            fields.type = value;
+        } else if (key == "proto") {
+            fields.proto = value;
+        } else if (key == "compress") {
+            fields.compress = value;
+        } else if (key == "room") {
+            fields.room = value;
+        } else if (key == "since") {
+            fields.since = value;
+        }
+    }
+};
+
+// Decode a string view produced by JsonScanner (escapes already validated)
+// into UTF-8; a surrogate pair becomes one four-byte sequence
+inline void json_unescape(std::string_view raw, std::string& out) {
+    out.clear();
+    size_t pos = 0;
+    while (true) {
+        size_t slash = raw.find('\\', pos);
+        out.append(raw.substr(pos, slash == std::string_view::npos ? raw.size() - pos : slash - pos));
+        if (slash == std::string_view::npos) {
+            return;
+        }
+
+        char e = raw[slash + 1];
+        pos = slash + 2;
+        switch (e) {
+        case 'n': out += '\n'; break;
+        case 'r': out += '\r'; break;
+        case 't': out += '\t'; break;
+        case 'b': out += '\b'; break;
+        case 'f': out += '\f'; break;
+        case 'u': {
+            unsigned long code = json_hex4(raw, pos);
+            pos += 4;
+            if (json_high_surrogate(code)) {
+                code = 0x10000 + ((code - 0xD800) << 10) + (json_hex4(raw, pos + 2) - 0xDC00);
+                pos += 6;
+            }
+            if (code < 0x80) {
+                out += static_cast<char>(code);
+            } else if (code < 0x800) {
+                out += static_cast<char>(0xC0 | (code >> 6));
+                out += static_cast<char>(0x80 | (code & 0x3F));
+            } else if (code < 0x10000) {
+                out += static_cast<char>(0xE0 | (code >> 12));
+                out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+                out += static_cast<char>(0x80 | (code & 0x3F));
+            } else {
+                out += static_cast<char>(0xF0 | (code >> 18));
+                out += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+                out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+                out += static_cast<char>(0x80 | (code & 0x3F));
+            }
+            break;
+        }
+        default: out += e; break;  // \" \\ \/
+        }
+    }
+}
+
+// Next string of a "users" array body; false when there are no more.
+// pos starts at 0 and is advanced past the string returned.
+inline bool json_next_array_string(std::string_view body, size_t& pos, std::string_view& item) {
+    size_t open = body.find('"', pos);
+    if (open == std::string_view::npos) {
+        return false;
+    }
+    size_t close = open + 1;
+    while (true) {
+        close = body.find('"', close);
+        if (close == std::string_view::npos) {
+            return false;
+        }
+        size_t slashes = 0;
+        while (close - slashes > open + 1 && body[close - slashes - 1] == '\\') {
+            slashes++;
+        }
+        if (slashes % 2 == 0) {
+            break;
+        }
+        close++;
+    }
+    item = body.substr(open + 1, close - open - 1);
+    pos = close + 1;
+    return true;
+}
+
+#endif // JSON_SCAN_H
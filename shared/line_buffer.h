@@ -0,0 +1,160 @@
+/*
+ * MIT License
+ * Buffered newline framing for stream sockets
+ */
+
+#ifndef LINE_BUFFER_H
+#define LINE_BUFFER_H
+
+#include "block_pool.h"
+#include "common.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <string_view>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+// Per-connection receive buffer. Each fill() pulls whatever the socket has
+// in one recv() into a fixed slab sized for one maximum frame plus a read
+// chunk; next_line() then splits complete frames out with memchr, so a
+// message costs one syscall per read instead of one per byte. Partial and
+// pipelined frames are kept across calls. The slab comes from the block
+// pools, so giving it back while idle and taking it again is cheap.
+//
+// Frames longer than max_line are reported once as TOO_LONG and the rest
+// of that line is discarded up to its newline.
+class LineBuffer {
+public:
+    enum Status { LINE, NEED_MORE, TOO_LONG };
+
+    explicit LineBuffer(size_t max_line = MAX_FRAME_LEN, size_t read_chunk = 4096)
+        : capacity(max_line + read_chunk), begin(0), end(0), scan(0),
+          discarding(false), max_line(max_line) {}
+    ~LineBuffer() { release_storage(); }
+
+    LineBuffer(const LineBuffer&) = delete;
+    LineBuffer& operator=(const LineBuffer&) = delete;
+
+    // One recv() into the free tail of the slab; same return convention as
+    // recv(). Fails with ENOBUFS when unconsumed frames fill the slab.
+    ssize_t fill(int fd, int flags = 0) {
+        if (!reserve_tail()) {
+            errno = ENOBUFS;
+            return -1;
+        }
+        ssize_t n = recv(fd, storage + end, capacity - end, flags);
+        if (n > 0) {
+            end += n;
+        }
+        return n;
+    }
+
+    // Append bytes that arrived by other means; returns how many fit
+    size_t append(const char* data, size_t len) {
+        if (!reserve_tail()) {
+            return 0;
+        }
+        size_t n = std::min(len, capacity - end);
+        std::memcpy(storage + end, data, n);
+        end += n;
+        return n;
+    }
+
+    // Next complete frame without its newline. The view stays valid until
+    // the next fill(), append() or release().
+    Status next_line(std::string_view& line) {
+        char* data = storage;
+
+        while (true) {
+            char* nl = static_cast<char*>(std::memchr(data + scan, '\n', end - scan));
+            if (nl == nullptr) {
+                scan = end;
+                if (discarding) {
+                    begin = end = scan = 0;
+                } else if (end - begin > max_line) {
+                    discarding = true;
+                    begin = end = scan = 0;
+                    return TOO_LONG;
+                }
+                return NEED_MORE;
+            }
+
+            size_t pos = nl - data;
+            size_t start = begin;
+            begin = scan = pos + 1;
+            if (begin == end) {
+                begin = end = scan = 0; // Rewind; data stays in place for the view
+            }
+
+            if (discarding) {
+                discarding = false;
+                continue;
+            }
+            if (pos - start > max_line) {
+                return TOO_LONG;
+            }
+
+            line = std::string_view(data + start, pos - start);
+            return LINE;
+        }
+    }
+
+    // Unconsumed bytes, for framing by length prefix rather than newline.
+    // Valid until the next fill(), append(), consume() or release().
+    std::string_view peek() const {
+        return storage ? std::string_view(storage + begin, end - begin) : std::string_view();
+    }
+
+    // Drop n bytes from the front of peek()
+    void consume(size_t n) {
+        begin += n;
+        scan = std::max(scan, begin);
+        if (begin == end) {
+            begin = end = scan = 0;
+        }
+    }
+
+    bool empty() const { return begin == end && !discarding; }
+    size_t buffered() const { return end - begin; }
+
+    // Give the slab back while the connection is idle
+    void release() {
+        if (begin == end) {
+            release_storage();
+            begin = end = scan = 0;
+        }
+    }
+
+private:
+    char* storage = nullptr;
+    size_t capacity;
+    size_t begin;      // First unconsumed byte
+    size_t end;        // One past the last received byte
+    size_t scan;       // Bytes before this offset contain no newline
+    bool discarding;   // Dropping the tail of an oversized frame
+    size_t max_line;
+
+    void release_storage() {
+        if (storage != nullptr) {
+            block_pool::free(storage, capacity);
+            storage = nullptr;
+        }
+    }
+
+    // Make room at the end of the slab, moving a partial frame to the front
+    bool reserve_tail() {
+        if (storage == nullptr) {
+            storage = static_cast<char*>(block_pool::allocate(capacity));
+        }
+        if (begin > 0 && end > max_line) {
+            std::memmove(storage, storage + begin, end - begin);
+            end -= begin;
+            scan -= begin;
+            begin = 0;
+        }
+        return end < capacity;
+    }
+};
+
+#endif // LINE_BUFFER_H
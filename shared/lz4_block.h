@@ -0,0 +1,237 @@
+/*
+ * MIT License
+ * LZ4 block compression with a preset dictionary
+ */
+
+#ifndef LZ4_BLOCK_H
+#define LZ4_BLOCK_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+// The LZ4 block format (token, literals, 16-bit offset, match length), so
+// a block decodes with liblz4's LZ4_decompress_safe_usingDict() given the
+// same dictionary. Matches may reach back into the dictionary as if it
+// came right before the input, which is what makes short chat lines
+// compress at all. The compressor is greedy with a single hash probe:
+// fast rather than tight, for frames of a few hundred bytes.
+namespace lz4 {
+
+constexpr size_t MIN_MATCH = 4;
+constexpr size_t LAST_LITERALS = 5;   // A block always ends with this many literals
+constexpr size_t MF_LIMIT = 12;       // and its last match starts at least this far from the end
+constexpr size_t MAX_OFFSET = 65535;
+constexpr int HASH_BITS = 12;
+
+// Largest block compress() can produce for n input bytes
+inline size_t compress_bound(size_t n) {
+    return n + n / 255 + 16;
+}
+
+namespace detail {
+
+inline uint32_t read32(const char* p) {
+    uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+inline uint32_t hash(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - HASH_BITS);
+}
+
+inline char* put_length(char* out, size_t rest) {
+    while (rest >= 255) {
+        *out++ = char(255);
+        rest -= 255;
+    }
+    *out++ = char(rest);
+    return out;
+}
+
+// One sequence; a match_length of 0 ends the block with literals only
+inline char* put_sequence(char* out, const char* literals, size_t literal_length,
+                          size_t offset, size_t match_length) {
+    char* token = out++;
+    uint8_t bits = uint8_t(std::min<size_t>(literal_length, 15) << 4);
+    if (literal_length >= 15) {
+        out = put_length(out, literal_length - 15);
+    }
+    std::memcpy(out, literals, literal_length);
+    out += literal_length;
+    if (match_length > 0) {
+        *out++ = char(offset);
+        *out++ = char(offset >> 8);
+        size_t extra = match_length - MIN_MATCH;
+        bits |= uint8_t(std::min<size_t>(extra, 15));
+        if (extra >= 15) {
+            out = put_length(out, extra - 15);
+        }
+    }
+    *token = char(bits);
+    return out;
+}
+
+inline bool get_length(const char* in, size_t n, size_t& pos, size_t& length) {
+    uint8_t byte;
+    do {
+        if (pos >= n) {
+            return false;
+        }
+        byte = static_cast<uint8_t>(in[pos++]);
+        length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+// Positions of the dictionary's 4-byte sequences (plus 1; 0 is empty),
+// hashed once per thread and dictionary
+struct DictTable {
+    const char* dict = nullptr;
+    size_t size = 0;
+    uint16_t positions[1 << HASH_BITS];
+};
+
+// Positions hashed by earlier calls are told apart from this call's by an
+// offset that grows with every call, so the table is never cleared
+struct HashTable {
+    uint32_t base = 0;
+    uint32_t positions[1 << HASH_BITS] = {};
+};
+
+} // namespace detail
+
+// Compress src[0, n) into out, which holds compress_bound(n) bytes, with
+// matches allowed into dict (at most MAX_OFFSET bytes); returns the size
+inline size_t compress(const char* src, size_t n, char* out, std::string_view dict = {}) {
+    using namespace detail;
+    thread_local std::string window;     // dict then src, so matches may span both
+    thread_local HashTable table;
+    thread_local DictTable dict_table;
+
+    if (dict.size() > MAX_OFFSET) {
+        dict = dict.substr(dict.size() - MAX_OFFSET);
+    }
+    if (dict_table.dict != dict.data() || dict_table.size != dict.size()) {
+        dict_table.dict = dict.data();
+        dict_table.size = dict.size();
+        std::fill(std::begin(dict_table.positions), std::end(dict_table.positions), 0);
+        for (size_t i = 0; i + MIN_MATCH <= dict.size(); i++) {
+            dict_table.positions[hash(read32(dict.data() + i))] = uint16_t(i + 1);
+        }
+    }
+    window.assign(dict.data(), dict.size());
+    window.append(src, n);
+    if (table.base > UINT32_MAX - window.size() - 1) {
+        table = HashTable();
+    }
+
+    const char* w = window.data();
+    size_t end = window.size();
+    size_t anchor = dict.size();
+    size_t ip = anchor;
+    char* op = out;
+    while (ip + MF_LIMIT <= end) {
+        uint32_t sequence = read32(w + ip);
+        uint32_t h = hash(sequence);
+        size_t candidate = SIZE_MAX;
+        uint32_t entry = table.positions[h];
+        if (entry > table.base) {
+            size_t at = entry - table.base - 1;
+            if (ip - at <= MAX_OFFSET && read32(w + at) == sequence) {
+                candidate = at;
+            }
+        }
+        table.positions[h] = uint32_t(table.base + ip + 1);
+        if (candidate == SIZE_MAX && dict_table.positions[h] != 0) {
+            size_t at = dict_table.positions[h] - 1u;
+            if (ip - at <= MAX_OFFSET && read32(w + at) == sequence) {
+                candidate = at;
+            }
+        }
+        if (candidate == SIZE_MAX) {
+            ip += 1 + ((ip - anchor) >> 6);   // Skip ahead faster through data that does not match
+            continue;
+        }
+
+        while (ip > anchor && candidate > 0 && w[ip - 1] == w[candidate - 1]) {
+            ip--;
+            candidate--;
+        }
+        size_t length = MIN_MATCH;
+        while (ip + length < end - LAST_LITERALS && w[ip + length] == w[candidate + length]) {
+            length++;
+        }
+        op = put_sequence(op, w + anchor, ip - anchor, ip - candidate, length);
+        ip += length;
+        anchor = ip;
+        if (ip + MIN_MATCH <= end) {
+            table.positions[hash(read32(w + ip - 2))] = uint32_t(table.base + ip - 2 + 1);
+        }
+    }
+    op = put_sequence(op, w + anchor, end - anchor, 0, 0);
+    table.base += uint32_t(end + 1);
+    return size_t(op - out);
+}
+
+// Decode a block made with the same dict into out, which holds capacity
+// bytes; returns the decoded size, or -1 if the block is malformed
+inline long decompress(const char* src, size_t n, char* out, size_t capacity,
+                       std::string_view dict = {}) {
+    size_t ip = 0;
+    size_t op = 0;
+    while (ip < n) {
+        uint8_t token = static_cast<uint8_t>(src[ip++]);
+        size_t literals = token >> 4;
+        if (literals == 15 && !detail::get_length(src, n, ip, literals)) {
+            return -1;
+        }
+        if (literals > n - ip || literals > capacity - op) {
+            return -1;
+        }
+        std::memcpy(out + op, src + ip, literals);
+        ip += literals;
+        op += literals;
+        if (ip == n) {
+            break;   // The last sequence has no match
+        }
+
+        if (n - ip < 2) {
+            return -1;
+        }
+        size_t offset = static_cast<uint8_t>(src[ip]) | size_t(static_cast<uint8_t>(src[ip + 1])) << 8;
+        ip += 2;
+        size_t length = token & 15;
+        if (length == 15 && !detail::get_length(src, n, ip, length)) {
+            return -1;
+        }
+        length += MIN_MATCH;
+        if (offset == 0 || offset > op + dict.size() || length > capacity - op) {
+            return -1;
+        }
+        if (offset > op) {
+            // Starts in the dictionary, and may run on into the output
+            size_t from_dict = std::min(offset - op, length);
+            std::memcpy(out + op, dict.data() + dict.size() - (offset - op), from_dict);
+            op += from_dict;
+            length -= from_dict;
+        }
+        if (offset >= length) {
+            std::memcpy(out + op, out + op - offset, length);
+        } else {
+            for (size_t i = 0; i < length; i++) {
+                out[op + i] = out[op + i - offset];   // Overlapping: repeats the last offset bytes
+            }
+        }
+        op += length;
+    }
+    return long(op);
+}
+
+} // namespace lz4
+
+#endif // LZ4_BLOCK_H
@@ -0,0 +1,53 @@
+/*
+ * MIT License
+ * Client-side sequencing of room presence updates
+ */
+
+#ifndef PRESENCE_H
+#define PRESENCE_H
+
+#include <cstdint>
+
+// Tracks where a client's copy of a room's user list stands. The server
+// sends {"type":"userlist","seq":N,...} when the client joins (or asks for
+// a resync) and then {"type":"presence_add"|"presence_remove","seq":N+1,...}
+// for every change. A delta is applied only if it is the next one; a jump
+// means frames were lost (e.g. dropped by the server's slow-consumer
+// policy), and the client should send {"type":"resync","room":...}.
+class PresenceSequence {
+public:
+    enum class Result {
+        APPLY,   // Next delta: apply it to the list
+        STALE,   // Already covered by the snapshot, or a resync is pending
+        GAP      // Deltas were missed: request a resync once
+    };
+
+    // A snapshot replaces the list and restarts the sequence
+    void reset(uint64_t snapshot_seq) {
+        seq = snapshot_seq;
+        synced = true;
+        resync_requested = false;
+    }
+
+    Result accept(uint64_t delta_seq) {
+        if (synced && delta_seq == seq + 1) {
+            seq = delta_seq;
+            return Result::APPLY;
+        }
+        if ((synced && delta_seq <= seq) || resync_requested) {
+            return Result::STALE;
+        }
+        synced = false;
+        resync_requested = true;
+        return Result::GAP;
+    }
+
+    bool in_sync() const { return synced; }
+
+private:
+    uint64_t seq = 0;
+    bool synced = false;
+    bool resync_requested = false;
+};
+
+#endif // PRESENCE_H
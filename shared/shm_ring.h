@@ -0,0 +1,446 @@
+/*
+ * MIT License
+ * Lock-free shared-memory broadcast ring
+ */
+
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include "common.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <new>
+#include <string_view>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+constexpr const char* DEFAULT_SHM_RING_NAME = "/os_chat_ring";
+constexpr uint64_t SHM_RING_BYTES = 512 * 1024;  // Record area, power of two
+constexpr uint32_t SHM_RING_MAX_READERS = 32;
+constexpr uint32_t SHM_RING_READY = 0x52494E48;  // "RINH": variable-length records
+constexpr size_t CACHE_LINE_SIZE = 64;
+constexpr size_t RECORD_ALIGN = 8;
+constexpr uint32_t SHM_RING_SECTORS = 8;  // Resume points for lapped readers
+constexpr uint64_t SHM_RING_SECTOR_BYTES = SHM_RING_BYTES / SHM_RING_SECTORS;
+
+static_assert((SHM_RING_BYTES & (SHM_RING_BYTES - 1)) == 0,
+              "ring size must be a power of two");
+static_assert(std::atomic<uint32_t>::is_always_lock_free &&
+              std::atomic<uint64_t>::is_always_lock_free,
+              "ring atomics must be address-free to work across processes");
+
+// What a writer does when the slowest reader is a full lap behind
+enum class ShmRingPolicy : uint32_t {
+    LAP = 0,    // Overwrite; the lapped reader is told how many messages it lost
+    BLOCK = 1   // Wait until the slowest reader frees the space
+};
+
+// Result of a read attempt
+enum class RingRead {
+    MESSAGE,  // A message was copied out
+    EMPTY,    // Reader is caught up
+    LAPPED    // Reader fell a lap behind and was moved forward
+};
+
+// Header of one record in the ring. Records are 8-byte aligned and never
+// straddle the end of the ring: a writer that does not fit before the wrap
+// fills the rest with a padding record (or, when fewer than a header's
+// bytes are left, both sides skip them) and starts at offset 0. The stamp
+// is 2*pos + 1 while the record at absolute byte position pos is being
+// written and 2*pos + 2 once it is published.
+struct RecordHeader {
+    enum Type : uint16_t { MESSAGE = 1, PADDING = 2 };
+
+    std::atomic<uint64_t> stamp;
+    uint32_t length;    // Whole record including header and alignment
+    uint16_t type;
+    uint8_t user_len;
+    uint8_t time_len;
+    uint32_t text_len;
+    int32_t origin;     // pid of the writer
+    // Followed by user, time and text bytes (not NUL-terminated)
+};
+
+static_assert(sizeof(RecordHeader) % RECORD_ALIGN == 0, "records must stay aligned");
+
+// Reader table entry; each attached reader owns one
+struct alignas(CACHE_LINE_SIZE) RingReader {
+    std::atomic<uint32_t> active;
+    int32_t pid;
+    std::atomic<uint64_t> cursor;  // Byte position of the next record to read
+    std::atomic<uint64_t> seen;    // Messages read or lost so far, for lap accounting
+    std::atomic<uint64_t> lost;    // Messages this reader lost to laps
+};
+
+// First record at or after a sector boundary, and how many messages were
+// claimed before it. Records have no fixed stride, so this is how a lapped
+// reader finds a record boundary to resume from.
+struct RingMark {
+    std::atomic<uint64_t> pos;
+    std::atomic<uint64_t> seq;
+};
+
+// Broadcast log in a shared memory segment. Writers from any process are
+// sequenced by one atomic head counter that hands out byte ranges; every
+// attached reader walks the log with its own cursor, so all participants
+// see every message. Nothing on the fast path takes a lock. Readers park
+// on a futex only when caught up.
+//
+// Records are variable-length, so a short chat line takes a few dozen
+// bytes rather than a full ChatMessage, and readers copy only the bytes in
+// use. A writer stalled mid-record for a full lap can still be overrun;
+// readers detect that through the head counter and report a lap.
+struct ShmRing {
+    alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> init_state;  // 0, 1 (initializing), READY
+    uint32_t capacity;
+    ShmRingPolicy policy;
+
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> head;      // Next byte position to claim
+    std::atomic<uint64_t> messages;                           // Records claimed so far
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> gate;      // Cached slowest cursor (BLOCK)
+
+    // Futex word bumped on every publish, plus the number of parked readers
+    alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> signal;
+    std::atomic<uint32_t> waiters;
+
+    RingReader readers[SHM_RING_MAX_READERS];
+    RingMark marks[SHM_RING_SECTORS];
+    alignas(CACHE_LINE_SIZE) char data[SHM_RING_BYTES];
+
+    // Initialize a freshly created (zero-filled) segment exactly once; the
+    // first process to attach picks the policy. False if the segment was
+    // left behind by an incompatible build.
+    bool init(ShmRingPolicy write_policy) {
+        uint32_t expected = 0;
+        if (init_state.compare_exchange_strong(expected, 1)) {
+            capacity = static_cast<uint32_t>(SHM_RING_BYTES);
+            policy = write_policy;
+            head.store(0, std::memory_order_relaxed);
+            messages.store(0, std::memory_order_relaxed);
+            for (uint32_t i = 0; i < SHM_RING_SECTORS; i++) {
+                marks[i].pos.store(0, std::memory_order_relaxed);
+                marks[i].seq.store(0, std::memory_order_relaxed);
+            }
+            gate.store(0, std::memory_order_relaxed);
+            signal.store(0, std::memory_order_relaxed);
+            waiters.store(0, std::memory_order_relaxed);
+            for (uint32_t i = 0; i < SHM_RING_MAX_READERS; i++) {
+                readers[i].active.store(0, std::memory_order_relaxed);
+            }
+            init_state.store(SHM_RING_READY, std::memory_order_release);
+            return true;
+        }
+        while (expected == 1) {
+            sched_yield();
+            expected = init_state.load(std::memory_order_acquire);
+        }
+        return expected == SHM_RING_READY;
+    }
+
+    // --- Writers -------------------------------------------------------------
+
+    // Publish a message; false only under BLOCK when the slowest reader is a
+    // full lap behind. Fields are truncated to what a ChatMessage can hold.
+    bool try_push(std::string_view user, std::string_view time, std::string_view text) {
+        size_t user_len = std::min<size_t>(user.size(), MAX_USERNAME_LEN - 1);
+        size_t time_len = std::min<size_t>(time.size(), MAX_TIMESTAMP_LEN - 1);
+        size_t text_len = std::min<size_t>(text.size(), MAX_MESSAGE_TEXT_LEN - 1);
+        uint64_t length = align(sizeof(RecordHeader) + user_len + time_len + text_len);
+
+        uint64_t pos = head.load(std::memory_order_relaxed);
+        uint64_t start;
+        uint64_t end;
+        do {
+            uint64_t room = SHM_RING_BYTES - (pos & (SHM_RING_BYTES - 1));
+            start = room < length ? pos + room : pos;
+            end = start + length;
+            if (policy == ShmRingPolicy::BLOCK &&
+                end - gate.load(std::memory_order_acquire) > SHM_RING_BYTES) {
+                uint64_t slowest = slowest_cursor(pos);
+                gate.store(slowest, std::memory_order_release);
+                if (end - slowest > SHM_RING_BYTES) {
+                    return false;
+                }
+            }
+        } while (!head.compare_exchange_weak(pos, end, std::memory_order_acq_rel));
+        uint64_t seq = messages.fetch_add(1, std::memory_order_relaxed);
+
+        uint64_t boundary = (pos + SHM_RING_SECTOR_BYTES - 1) & ~(SHM_RING_SECTOR_BYTES - 1);
+        if (boundary < end) {
+            RingMark& mark = marks[(boundary / SHM_RING_SECTOR_BYTES) % SHM_RING_SECTORS];
+            mark.seq.store(seq, std::memory_order_relaxed);
+            mark.pos.store(start, std::memory_order_release);
+        }
+
+        if (start != pos && start - pos >= sizeof(RecordHeader)) {
+            write_record(pos, start - pos, RecordHeader::PADDING, {}, {}, {});
+        }
+        write_record(start, length, RecordHeader::MESSAGE, user.substr(0, user_len),
+                     time.substr(0, time_len), text.substr(0, text_len));
+
+        signal.fetch_add(1, std::memory_order_release);
+        if (waiters.load() > 0) {
+            futex(FUTEX_WAKE, INT_MAX, nullptr);
+        }
+        return true;
+    }
+
+    // Publish a message, yielding while back-pressure applies
+    void push(std::string_view user, std::string_view time, std::string_view text) {
+        while (!try_push(user, time, text)) {
+            sched_yield();
+        }
+    }
+
+    // --- Readers -------------------------------------------------------------
+
+    // Claim a reader table entry positioned at the current head; -1 if full
+    int attach_reader() {
+        for (uint32_t i = 0; i < SHM_RING_MAX_READERS; i++) {
+            RingReader& reader = readers[i];
+            uint32_t state = reader.active.load(std::memory_order_acquire);
+            if (state == 1 && !process_alive(reader.pid)) {
+                reader.active.compare_exchange_strong(state, 0);
+                state = 0;
+            }
+            if (state == 0 && reader.active.compare_exchange_strong(state, 1)) {
+                reader.pid = getpid();
+                reader.lost.store(0, std::memory_order_relaxed);
+                reader.seen.store(messages.load(std::memory_order_acquire),
+                                  std::memory_order_relaxed);
+                reader.cursor.store(head.load(std::memory_order_acquire),
+                                    std::memory_order_release);
+                return static_cast<int>(i);
+            }
+        }
+        return -1;
+    }
+
+    void detach_reader(int id) {
+        readers[id].active.store(0, std::memory_order_release);
+    }
+
+    // Copy the used bytes of the reader's next message into out, and the
+    // writer's pid into origin if given. On LAPPED the reader has been moved
+    // to the oldest sector still safe to read and lost says (approximately,
+    // with concurrent writers) how many messages it missed.
+    RingRead try_read(int id, ChatMessage& out, uint64_t& lost, int32_t* origin = nullptr) {
+        RingReader& reader = readers[id];
+        uint64_t cursor = reader.cursor.load(std::memory_order_relaxed);
+
+        while (true) {
+            uint64_t offset = cursor & (SHM_RING_BYTES - 1);
+            uint64_t room = SHM_RING_BYTES - offset;
+            if (room < sizeof(RecordHeader)) {
+                cursor += room; // Too small for a record; writers skip it too
+                continue;
+            }
+            if (overrun(cursor)) {
+                return lapped(reader, lost);
+            }
+
+            RecordHeader* record = reinterpret_cast<RecordHeader*>(data + offset);
+            if (record->stamp.load(std::memory_order_acquire) != 2 * cursor + 2) {
+                reader.cursor.store(cursor, std::memory_order_release);
+                return RingRead::EMPTY; // Claimed but not yet published
+            }
+
+            uint32_t length = record->length;
+            uint16_t type = record->type;
+            if (length < sizeof(RecordHeader) || length > room || length % RECORD_ALIGN != 0) {
+                return lapped(reader, lost); // Header was overwritten under us
+            }
+            if (type == RecordHeader::MESSAGE) {
+                const char* bytes = reinterpret_cast<const char*>(record + 1);
+                size_t user_len = std::min<size_t>(record->user_len, MAX_USERNAME_LEN - 1);
+                size_t time_len = std::min<size_t>(record->time_len, MAX_TIMESTAMP_LEN - 1);
+                size_t text_len = std::min<size_t>(record->text_len, MAX_MESSAGE_TEXT_LEN - 1);
+                if (sizeof(RecordHeader) + user_len + time_len + text_len > length) {
+                    return lapped(reader, lost);
+                }
+                copy_field(out.username, bytes, user_len);
+                copy_field(out.timestamp, bytes + user_len, time_len);
+                copy_field(out.text, bytes + user_len + time_len, text_len);
+                out.valid = true;
+                if (origin != nullptr) {
+                    *origin = record->origin;
+                }
+            }
+
+            // The copy is only good if no writer claimed these bytes meanwhile
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (overrun(cursor)) {
+                return lapped(reader, lost);
+            }
+
+            cursor += length;
+            if (type == RecordHeader::MESSAGE) {
+                reader.seen.fetch_add(1, std::memory_order_relaxed);
+                reader.cursor.store(cursor, std::memory_order_release);
+                return RingRead::MESSAGE;
+            }
+        }
+    }
+
+    // Like try_read, but sleeps on the futex while caught up. timeout_ms < 0
+    // waits forever; EMPTY on timeout.
+    RingRead read_wait(int id, ChatMessage& out, uint64_t& lost, int timeout_ms,
+                       int32_t* origin = nullptr) {
+        timespec timeout{timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+
+        while (true) {
+            uint32_t seen = signal.load(std::memory_order_acquire);
+            RingRead result = try_read(id, out, lost, origin);
+            if (result != RingRead::EMPTY) {
+                return result;
+            }
+
+            waiters.fetch_add(1);
+            // Returns at once if a writer bumped signal after we read it
+            long rc = futex(FUTEX_WAIT, seen, timeout_ms < 0 ? nullptr : &timeout);
+            waiters.fetch_sub(1);
+
+            if (rc == -1 && errno == ETIMEDOUT) {
+                return try_read(id, out, lost, origin);
+            }
+        }
+    }
+
+private:
+    // Shared (not process-private) futex on the signal word
+    long futex(int op, uint32_t value, const timespec* timeout) {
+        return syscall(SYS_futex, reinterpret_cast<uint32_t*>(&signal), op, value, timeout,
+                       nullptr, 0);
+    }
+
+    static uint64_t align(uint64_t n) {
+        return (n + RECORD_ALIGN - 1) & ~uint64_t(RECORD_ALIGN - 1);
+    }
+
+    static void copy_field(char* dest, const char* src, size_t len) {
+        std::memcpy(dest, src, len);
+        dest[len] = '\0';
+    }
+
+    void write_record(uint64_t pos, uint64_t length, uint16_t type, std::string_view user,
+                      std::string_view time, std::string_view text) {
+        RecordHeader* record = reinterpret_cast<RecordHeader*>(data + (pos & (SHM_RING_BYTES - 1)));
+        record->stamp.store(2 * pos + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        record->length = static_cast<uint32_t>(length);
+        record->type = type;
+        record->user_len = static_cast<uint8_t>(user.size());
+        record->time_len = static_cast<uint8_t>(time.size());
+        record->text_len = static_cast<uint32_t>(text.size());
+        record->origin = getpid();
+        char* bytes = reinterpret_cast<char*>(record + 1);
+        std::memcpy(bytes, user.data(), user.size());
+        std::memcpy(bytes + user.size(), time.data(), time.size());
+        std::memcpy(bytes + user.size() + time.size(), text.data(), text.size());
+
+        record->stamp.store(2 * pos + 2, std::memory_order_release);
+    }
+
+    // True once writers have claimed the next lap's copy of byte position pos
+    bool overrun(uint64_t pos) const {
+        return head.load(std::memory_order_acquire) - pos > SHM_RING_BYTES;
+    }
+
+    // Move a lapped reader to the oldest sector mark that leaves a sector of
+    // slack before writers reach it again (the live edge if none does), and
+    // account for what it missed
+    RingRead lapped(RingReader& reader, uint64_t& lost) {
+        uint64_t newest = head.load(std::memory_order_acquire);
+        uint64_t resume = newest;
+        uint64_t resume_seq = messages.load(std::memory_order_acquire);
+        uint64_t oldest_safe = newest - SHM_RING_BYTES + SHM_RING_SECTOR_BYTES;
+        for (uint32_t i = 0; i < SHM_RING_SECTORS; i++) {
+            uint64_t pos = marks[i].pos.load(std::memory_order_acquire);
+            if (pos >= oldest_safe && pos < resume && newest >= SHM_RING_BYTES) {
+                resume = pos;
+                resume_seq = marks[i].seq.load(std::memory_order_relaxed);
+            }
+        }
+
+        uint64_t seen = reader.seen.load(std::memory_order_relaxed);
+        lost = resume_seq > seen ? resume_seq - seen : 0;
+        reader.seen.store(std::max(resume_seq, seen), std::memory_order_relaxed);
+        reader.lost.fetch_add(lost, std::memory_order_relaxed);
+        reader.cursor.store(resume, std::memory_order_release);
+        return RingRead::LAPPED;
+    }
+
+    static bool process_alive(int32_t pid) {
+        return kill(pid, 0) == 0 || errno != ESRCH;
+    }
+
+    // Lowest cursor among live readers (pos if there are none); readers of
+    // processes that died are released so they cannot stall writers
+    uint64_t slowest_cursor(uint64_t pos) {
+        uint64_t slowest = pos;
+        for (uint32_t i = 0; i < SHM_RING_MAX_READERS; i++) {
+            RingReader& reader = readers[i];
+            if (reader.active.load(std::memory_order_acquire) != 1) {
+                continue;
+            }
+            if (!process_alive(reader.pid)) {
+                reader.active.store(0, std::memory_order_release);
+                continue;
+            }
+            uint64_t cursor = reader.cursor.load(std::memory_order_acquire);
+            if (cursor < slowest) {
+                slowest = cursor;
+            }
+        }
+        return slowest;
+    }
+};
+
+// Map the ring segment, creating and initializing it on first use.
+// Returns nullptr on failure.
+inline ShmRing* attach_shm_ring(const char* name = DEFAULT_SHM_RING_NAME,
+                                ShmRingPolicy policy = ShmRingPolicy::LAP) {
+    int fd = shm_open(name, O_CREAT | O_RDWR, 0666);
+    if (fd == -1) {
+        return nullptr;
+    }
+
+    struct stat st{};
+    if (fstat(fd, &st) == -1 ||
+        (st.st_size < static_cast<off_t>(sizeof(ShmRing)) &&
+         ftruncate(fd, sizeof(ShmRing)) == -1)) {
+        close(fd);
+        return nullptr;
+    }
+
+    void* mem = mmap(nullptr, sizeof(ShmRing), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED) {
+        return nullptr;
+    }
+
+    ShmRing* ring = static_cast<ShmRing*>(mem);
+    if (!ring->init(policy)) {
+        munmap(mem, sizeof(ShmRing));
+        return nullptr;
+    }
+    return ring;
+}
+
+inline void detach_shm_ring(ShmRing* ring) {
+    munmap(ring, sizeof(ShmRing));
+}
+
+#endif // SHM_RING_H
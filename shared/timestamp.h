@@ -0,0 +1,117 @@
+/*
+ * MIT License
+ * Cached wall-clock timestamps
+ */
+
+#ifndef TIMESTAMP_H
+#define TIMESTAMP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+
+// Wall-clock reads and ISO-8601 text for message timestamps. The clocks
+// are read through the vDSO, so no system call is made. Each thread keeps
+// the formatted date, hour and minute of the last minute it formatted:
+// within that minute only the seconds (and any fraction) are written, and
+// a new minute costs one gmtime_r. Text goes into a caller's buffer of at
+// least TEXT_SIZE bytes and is NUL-terminated; nothing allocates.
+namespace timestamp {
+
+enum class Precision {
+    SECONDS,   // 2024-01-02T03:04:05, the JSON protocol's format
+    MILLIS,    // 2024-01-02T03:04:05.678
+    MICROS     // 2024-01-02T03:04:05.678901
+};
+
+constexpr size_t TEXT_SIZE = 27;   // Longest text and its NUL
+
+inline uint64_t read_us(clockid_t clock) {
+    timespec ts;
+    clock_gettime(clock, &ts);
+    return uint64_t(ts.tv_sec) * 1000000 + uint64_t(ts.tv_nsec) / 1000;
+}
+
+// Microseconds since the epoch
+inline uint64_t epoch_us() {
+    return read_us(CLOCK_REALTIME);
+}
+
+inline uint64_t epoch_ms() {
+    return epoch_us() / 1000;
+}
+
+// As of the last timer tick, so up to a few milliseconds behind, but
+// cheaper still; enough for second precision
+inline uint64_t coarse_epoch_us() {
+    return read_us(CLOCK_REALTIME_COARSE);
+}
+
+namespace detail {
+
+constexpr size_t PREFIX_SIZE = 18;   // "2024-01-02T03:04:" and its NUL
+
+struct MinuteCache {
+    uint64_t minute = UINT64_MAX;
+    char prefix[PREFIX_SIZE];
+    size_t length = 0;
+};
+
+inline MinuteCache& minute_cache() {
+    thread_local MinuteCache cache;
+    return cache;
+}
+
+inline void put_digits(char* out, uint64_t value, int digits) {
+    for (int i = digits - 1; i >= 0; i--) {
+        out[i] = char('0' + value % 10);
+        value /= 10;
+    }
+}
+
+} // namespace detail
+
+// Text of a time in microseconds since the epoch; returns its length
+inline size_t format_us(uint64_t us, char* out, Precision precision = Precision::SECONDS) {
+    uint64_t seconds = us / 1000000;
+    detail::MinuteCache& cache = detail::minute_cache();
+    if (cache.minute != seconds / 60) {
+        cache.minute = seconds / 60;
+        time_t start = time_t(cache.minute * 60);
+        tm parts;
+        gmtime_r(&start, &parts);
+        // 0, and so no date, past year 9999
+        cache.length = strftime(cache.prefix, sizeof(cache.prefix), "%Y-%m-%dT%H:%M:", &parts);
+    }
+
+    size_t n = cache.length;
+    std::memcpy(out, cache.prefix, n);
+    detail::put_digits(out + n, seconds % 60, 2);
+    n += 2;
+    if (precision == Precision::MILLIS) {
+        out[n++] = '.';
+        detail::put_digits(out + n, us / 1000 % 1000, 3);
+        n += 3;
+    } else if (precision == Precision::MICROS) {
+        out[n++] = '.';
+        detail::put_digits(out + n, us % 1000000, 6);
+        n += 6;
+    }
+    out[n] = '\0';
+    return n;
+}
+
+inline size_t format_ms(uint64_t ms, char* out, Precision precision = Precision::SECONDS) {
+    return format_us(ms * 1000, out, precision);
+}
+
+// Text of the current time; second precision reads the coarse clock
+inline size_t format_now(char* out, Precision precision = Precision::SECONDS) {
+    uint64_t now = precision == Precision::SECONDS ? coarse_epoch_us() : epoch_us();
+    return format_us(now, out, precision);
+}
+
+} // namespace timestamp
+
+#endif // TIMESTAMP_H
@@ -0,0 +1,209 @@
+/*
+ * MIT License
+ * Binary wire format and JSON translation helpers
+ */
+
+#ifndef WIRE_PROTOCOL_H
+#define WIRE_PROTOCOL_H
+
+#include "common.h"
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <string_view>
+
+// Name a client puts in "proto" of its username line to switch to binary
+// framing; the server lists it in the welcome frame.
+constexpr const char* BINARY_PROTOCOL_NAME = "bin1";
+
+// Fixed header in front of every binary frame, little-endian on the wire:
+//
+//   u32 length     payload bytes after the header
+//   u8  type       BinaryType
+//   u8  flags      BINARY_FLAG_LZ4 or 0
+//   u8  name_len   leading payload bytes holding the sender's username
+//   u8  room_len   payload bytes after the name holding the room
+//   u32 user_id    server-assigned sender id (0 for the server itself)
+//   u64 timestamp  milliseconds since the Unix epoch
+//
+// The payload is the username, the room and the text, none terminated.
+// Clients may leave name_len and user_id zero; the server fills them in
+// from the connection. A zero room_len means the sender's current room.
+constexpr size_t BINARY_HEADER_SIZE = 20;
+constexpr size_t MAX_BINARY_PAYLOAD = MAX_USERNAME_LEN + MAX_FRAME_LEN;
+
+enum class BinaryType : uint8_t {
+    CHAT = 1,     // Chat line: name + room + text
+    CONTROL = 2,  // JSON control object (userlist, join, ...) as text
+    BATCH = 3     // Compressed run of whole frames (history replay), server to client
+};
+
+// --- Compression ---------------------------------------------------------------
+//
+// A binary client may also ask for compression in its username line,
+// "compress":"lz4", "deflate" or "lz4,deflate"; the server lists what it
+// supports in the welcome frame. Only the server compresses, and both
+// codecs are primed with CHAT_DICTIONARY (chat_dictionary.h).
+//
+// lz4: a CHAT or CONTROL frame whose payload is at least LZ4_MIN_PAYLOAD
+// bytes, and shrinks, has BINARY_FLAG_LZ4 set. Its payload is then a u32
+// decompressed length and an LZ4 block; name_len and room_len describe the
+// decompressed payload. Smaller frames are sent as they are.
+//
+// deflate: replayed history arrives in BATCH frames instead of one frame
+// per message. The payload is a u32 decompressed length and a complete
+// zlib stream (with the dictionary) of up to REPLAY_BATCH_BYTES of
+// ordinary frames. Each BATCH stands alone.
+constexpr const char* LZ4_COMPRESSION_NAME = "lz4";
+constexpr const char* DEFLATE_COMPRESSION_NAME = "deflate";
+constexpr uint8_t BINARY_FLAG_LZ4 = 0x01;
+constexpr size_t COMPRESSED_LENGTH_SIZE = 4;   // u32 decompressed length before the data
+constexpr size_t LZ4_MIN_PAYLOAD = 128;
+constexpr size_t REPLAY_BATCH_BYTES = 64 * 1024;
+
+struct BinaryHeader {
+    uint32_t length;
+    uint8_t type;
+    uint8_t flags;
+    uint8_t name_len;
+    uint8_t room_len;
+    uint32_t user_id;
+    uint64_t timestamp;
+};
+
+inline void store_le(char* out, uint64_t value, size_t bytes) {
+    for (size_t i = 0; i < bytes; i++) {
+        out[i] = static_cast<char>(value >> (8 * i));
+    }
+}
+
+inline uint64_t load_le(const char* in, size_t bytes) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < bytes; i++) {
+        value |= uint64_t(static_cast<uint8_t>(in[i])) << (8 * i);
+    }
+    return value;
+}
+
+inline void encode_binary_header(char* out, const BinaryHeader& header) {
+    store_le(out, header.length, 4);
+    out[4] = static_cast<char>(header.type);
+    out[5] = static_cast<char>(header.flags);
+    out[6] = static_cast<char>(header.name_len);
+    out[7] = static_cast<char>(header.room_len);
+    store_le(out + 8, header.user_id, 4);
+    store_le(out + 12, header.timestamp, 8);
+}
+
+inline BinaryHeader decode_binary_header(const char* in) {
+    BinaryHeader header;
+    header.length = static_cast<uint32_t>(load_le(in, 4));
+    header.type = static_cast<uint8_t>(in[4]);
+    header.flags = static_cast<uint8_t>(in[5]);
+    header.name_len = static_cast<uint8_t>(in[6]);
+    header.room_len = static_cast<uint8_t>(in[7]);
+    header.user_id = static_cast<uint32_t>(load_le(in + 8, 4));
+    header.timestamp = load_le(in + 12, 8);
+    return header;
+}
+
+// Bytes a complete frame with this name, room and text occupies
+inline size_t binary_frame_size(std::string_view name, std::string_view room,
+                                std::string_view text) {
+    return BINARY_HEADER_SIZE + name.size() + room.size() + text.size();
+}
+
+// Encode header and payload into out, which must hold binary_frame_size() bytes
+inline size_t encode_binary_frame(char* out, BinaryType type, uint32_t user_id,
+                                  uint64_t timestamp, std::string_view name,
+                                  std::string_view room, std::string_view text) {
+    BinaryHeader header{};
+    header.length = static_cast<uint32_t>(name.size() + room.size() + text.size());
+    header.type = static_cast<uint8_t>(type);
+    header.name_len = static_cast<uint8_t>(name.size());
+    header.room_len = static_cast<uint8_t>(room.size());
+    header.user_id = user_id;
+    header.timestamp = timestamp;
+    encode_binary_header(out, header);
+    char* payload = out + BINARY_HEADER_SIZE;
+    std::memcpy(payload, name.data(), name.size());
+    std::memcpy(payload + name.size(), room.data(), room.size());
+    std::memcpy(payload + name.size() + room.size(), text.data(), text.size());
+    return BINARY_HEADER_SIZE + header.length;
+}
+
+// --- Timestamps ---------------------------------------------------------------
+
+inline uint64_t now_epoch_ms() {
+    return timestamp::epoch_ms();
+}
+
+// ISO-8601 text as used by the JSON protocol (second precision), written
+// to out, which holds MAX_TIMESTAMP_LEN bytes; returns its length
+inline size_t format_epoch_ms(uint64_t ms, char* out) {
+    return timestamp::format_ms(ms, out);
+}
+
+inline std::string format_epoch_ms(uint64_t ms) {
+    char buf[MAX_TIMESTAMP_LEN];
+    return std::string(buf, format_epoch_ms(ms, buf));
+}
+
+// Inverse of format_epoch_ms, also taking a fraction of a second and a
+// trailing Z; 0 if time is anything else
+inline uint64_t parse_epoch_ms(std::string_view time) {
+    if (time.size() >= MAX_TIMESTAMP_LEN) {
+        return 0;
+    }
+    char copy[MAX_TIMESTAMP_LEN];
+    std::memcpy(copy, time.data(), time.size());
+    copy[time.size()] = '\0';
+    tm parts{};
+    const char* end = strptime(copy, "%Y-%m-%dT%H:%M:%S", &parts);
+    if (end == nullptr) {
+        return 0;
+    }
+
+    uint64_t ms = 0;
+    if (*end == '.') {
+        const char* digits = ++end;
+        for (uint64_t scale = 100; *end >= '0' && *end <= '9'; end++, scale /= 10) {
+            ms += (*end - '0') * scale;
+        }
+        if (end == digits) {
+            return 0;
+        }
+    }
+    if (*end == 'Z') {
+        end++;
+    }
+    if (*end != '\0') {
+        return 0;
+    }
+    return uint64_t(timegm(&parts)) * 1000 + ms;
+}
+
+// Append text as the body of a JSON string literal
+inline void append_json_escaped(std::string& out, std::string_view text) {
+    static const char hex[] = "0123456789abcdef";
+    for (char c : text) {
+        switch (c) {
+        case '"':  out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20) {
+                out += "\\u00";
+                out += hex[(c >> 4) & 0xF];
+                out += hex[c & 0xF];
+            } else {
+                out += c;
+            }
+        }
+    }
+}
+
+#endif // WIRE_PROTOCOL_H
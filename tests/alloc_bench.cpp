@@ -0,0 +1,195 @@
+/*
+ * MIT License
+ * Benchmark: size-class block pools vs the default allocator
+ *
+ * Checks size classes, block reuse and cross-thread frees first, then
+ * times two patterns from the server: a worker making and dropping
+ * message-sized blocks on its own thread, and blocks made on one thread
+ * and freed on another, as frames fanned out to peer workers are.
+ */
+
+#include "block_pool.h"
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+static volatile size_t sink = 0;
+
+static int check_pool() {
+    int failures = 0;
+    auto fail = [&](const char* what) {
+        std::cout << "FAIL: " << what << "\n";
+        failures++;
+    };
+
+    if (block_pool::size_class(1) != 0 || block_pool::size_class(64) != 0 ||
+        block_pool::size_class(65) != 1 || block_pool::size_class(8192) != 7 ||
+        block_pool::size_class(8193) != -1) {
+        fail("size classes");
+    }
+
+    // A freed block is the next one handed out for its class
+    void* a = block_pool::allocate(100);
+    std::memset(a, 0xab, 100);
+    block_pool::free(a, 100);
+    void* b = block_pool::allocate(128);
+    if (a != b) {
+        fail("freed block not reused");
+    }
+    block_pool::free(b, 128);
+
+    // Oversized requests still work
+    void* big = block_pool::allocate(100000);
+    std::memset(big, 0, 100000);
+    block_pool::free(big, 100000);
+
+    // Blocks freed by another thread come back through the shared lists
+    std::vector<void*> blocks;
+    for (int i = 0; i < 10000; i++) {
+        blocks.push_back(block_pool::allocate(256));
+    }
+    std::thread([&] {
+        for (void* block : blocks) {
+            block_pool::free(block, 256);
+        }
+    }).join();
+    std::vector<void*> again;
+    for (int i = 0; i < 10000; i++) {
+        again.push_back(block_pool::allocate(256));
+    }
+    std::sort(blocks.begin(), blocks.end());
+    size_t reused = 0;
+    for (void* block : again) {
+        reused += std::binary_search(blocks.begin(), blocks.end(), block);
+        block_pool::free(block, 256);
+    }
+    if (reused < 9000) {
+        fail("blocks freed on an exited thread not reused");
+    }
+
+    std::cout << (failures == 0 ? "All pool checks passed\n" : "Pool checks FAILED\n");
+    return failures;
+}
+
+struct Allocator {
+    const char* name;
+    void* (*allocate)(size_t);
+    void (*free)(void*, size_t);
+};
+
+// Each step frees a random live block and makes one of a random size,
+// keeping `live` blocks around like queued frames
+static double churn(const Allocator& allocator, size_t steps, size_t live) {
+    std::mt19937 rng(42);
+    auto random_size = [&] { return size_t(64 + rng() % 1024); };
+    std::vector<std::pair<void*, size_t>> blocks;
+    for (size_t i = 0; i < live; i++) {
+        size_t size = random_size();
+        blocks.emplace_back(allocator.allocate(size), size);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < steps; i++) {
+        auto& slot = blocks[rng() % live];
+        allocator.free(slot.first, slot.second);
+        slot.second = random_size();
+        slot.first = allocator.allocate(slot.second);
+        static_cast<char*>(slot.first)[0] = char(i);
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    for (auto& slot : blocks) {
+        allocator.free(slot.first, slot.second);
+    }
+    return elapsed * 1e9 / steps;
+}
+
+// One thread allocates, another frees, handing blocks over in batches
+static double handoff(const Allocator& allocator, size_t count) {
+    constexpr size_t HANDOFF = 64;
+    constexpr size_t SIZE = 512;
+    std::mutex mutex;
+    std::vector<void*> shared;
+    bool done = false;
+
+    auto start = std::chrono::steady_clock::now();
+    std::thread consumer([&] {
+        std::vector<void*> batch;
+        for (;;) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                batch.swap(shared);
+                if (batch.empty() && done) {
+                    return;
+                }
+            }
+            for (void* block : batch) {
+                sink = sink + static_cast<char*>(block)[0];
+                allocator.free(block, SIZE);
+            }
+            batch.clear();
+        }
+    });
+
+    std::vector<void*> batch;
+    for (size_t i = 0; i < count; i++) {
+        void* block = allocator.allocate(SIZE);
+        static_cast<char*>(block)[0] = char(i);
+        batch.push_back(block);
+        if (batch.size() == HANDOFF) {
+            std::lock_guard<std::mutex> lock(mutex);
+            shared.insert(shared.end(), batch.begin(), batch.end());
+            batch.clear();
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        shared.insert(shared.end(), batch.begin(), batch.end());
+        done = true;
+    }
+    consumer.join();
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return elapsed * 1e9 / count;
+}
+
+int main(int argc, char* argv[]) {
+    size_t steps = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 5000000;
+    if (check_pool() != 0) {
+        return 1;
+    }
+
+    const Allocator allocators[] = {
+        {"block pool", block_pool::allocate, block_pool::free},
+        {"new/delete", [](size_t size) { return ::operator new(size); },
+         [](void* block, size_t) { ::operator delete(block); }},
+    };
+
+    std::cout << "\nSame-thread churn (" << steps << " steps, 64-1087 byte blocks)\n";
+    std::cout << std::left << std::setw(14) << "allocator"
+              << std::right << std::setw(10) << "live"
+              << std::setw(12) << "ns/step" << "\n";
+    for (size_t live : {64, 4096, 65536}) {
+        for (const Allocator& allocator : allocators) {
+            std::cout << std::left << std::setw(14) << allocator.name
+                      << std::right << std::setw(10) << live
+                      << std::setw(12) << std::fixed << std::setprecision(1)
+                      << churn(allocator, steps, live) << "\n";
+        }
+    }
+
+    std::cout << "\nCross-thread handoff (" << steps << " blocks of 512 bytes)\n";
+    std::cout << std::left << std::setw(14) << "allocator"
+              << std::right << std::setw(12) << "ns/block" << "\n";
+    for (const Allocator& allocator : allocators) {
+        std::cout << std::left << std::setw(14) << allocator.name
+                  << std::right << std::setw(12) << std::fixed << std::setprecision(1)
+                  << handoff(allocator, steps) << "\n";
+    }
+    return 0;
+}
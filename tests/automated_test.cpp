@@ -28,7 +28,7 @@ void test_shm_system() {
     std::system("./build/tests/shm_test_client charlie 'Charlie joining the chat' &");
     std::this_thread::sleep_for(std::chrono::seconds(1));
     
-    std::cout << "Shared memory test completed. Check /dev/shm/os_chat_shm\n";
+    std::cout << "Shared memory test completed. Check /dev/shm/os_chat_ring\n";
 }
 
 int main() {
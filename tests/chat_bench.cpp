@@ -0,0 +1,566 @@
+/*
+ * MIT License
+ * Load generator and fan-out latency benchmark for the socket server
+ *
+ * Usage: chat_bench [--host=ADDR] [--port=N] [--clients=N] [--threads=N]
+ *                   [--senders=N] [--rate=MSGS_PER_SEC] [--size=BYTES]
+ *                   [--rooms=N] [--flooders=N] [--warmup=SECONDS] [--duration=SECONDS]
+ *                   [--metrics-port=N]
+ *
+ * Opens the requested number of clients over TCP, each going through the
+ * welcome/username handshake, and spreads them over a few epoll threads.
+ * With --rooms above 1, client i also joins room bench-(i % rooms) and
+ * chats there. The first --senders clients publish at a combined --rate;
+ * every message carries the time it was scheduled to go out, so a stalled
+ * server shows up as latency rather than as a lower send rate. Each
+ * delivery's latency goes into an HDR histogram. --flooders adds clients
+ * that send to the lobby as fast as the server reads, to show what an
+ * abusive sender costs everyone else. With --metrics-port, the server's
+ * system call and heap allocation counters are read at both ends of the
+ * measurement, to report them per delivery and per message. The TCP
+ * segments carrying server data are counted from the clients' TCP_INFO
+ * over the same span, to show how many deliveries share a packet. A JSON
+ * summary is printed on stdout, so runs can be saved and compared; progress
+ * goes to stderr.
+ */
+
+#include "common.h"
+#include "hdr_histogram.h"
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <linux/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+// Marks benchmark messages; followed by the scheduled send time in hex
+constexpr const char* MARKER = "\"text\":\"~t=";
+constexpr size_t MARKER_LEN = 11;
+constexpr size_t STAMP_DIGITS = 16;
+
+struct Options {
+    std::string host = "127.0.0.1";
+    int port = DEFAULT_PORT;
+    int clients = 1000;
+    int threads = 4;
+    int senders = 10;
+    double rate = 1000;
+    size_t size = 64;
+    int rooms = 1;
+    int flooders = 0;
+    double warmup = 2;
+    double duration = 10;
+    int metrics_port = 0;
+};
+
+enum class Phase { CONNECT, SEND, DRAIN, STOP };
+
+std::atomic<Phase> phase{Phase::CONNECT};
+std::atomic<int> ready_clients{0};
+std::atomic<int> failed_clients{0};
+uint64_t send_start = 0;     // Set before the SEND phase begins
+uint64_t measure_start = 0;  // Messages scheduled in [measure_start, measure_end)
+uint64_t measure_end = 0;    // are counted
+
+uint64_t now_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+bool parse_option(const std::string& arg, const std::string& name, std::string& value) {
+    if (arg.compare(0, name.size() + 1, name + "=") == 0) {
+        value = arg.substr(name.size() + 1);
+        return true;
+    }
+    return false;
+}
+
+struct Client {
+    int fd = -1;
+    int room = 0;
+    bool welcomed = false;
+    bool sender = false;
+    bool flooder = false;
+    std::string in;    // Partial line
+    std::string out;   // Bytes the kernel has not taken yet
+};
+
+// One epoll loop with its share of the clients and its own counters
+class Worker {
+public:
+    Worker(const Options& options, int index) : options(options), index(index) {}
+
+    // Clients in a room, senders included; flooders stay in the lobby
+    int room_size(int room) const {
+        int members = options.clients / options.rooms;
+        members += room < options.clients % options.rooms ? 1 : 0;
+        return options.rooms == 1 ? members + options.flooders : members;
+    }
+
+    void run(const sockaddr_in& address) {
+        epoll_fd = epoll_create1(0);
+        for (int i = index; i < options.clients + options.flooders; i += options.threads) {
+            Client client;
+            client.room = i % options.rooms;
+            client.sender = i < options.senders;
+            client.flooder = i >= options.clients;
+            client.fd = socket(AF_INET, SOCK_STREAM, 0);
+            if (client.fd == -1 ||
+                connect(client.fd, reinterpret_cast<const sockaddr*>(&address),
+                        sizeof(address)) == -1) {
+                failed_clients++;
+                if (client.fd != -1) {
+                    close(client.fd);
+                }
+                continue;
+            }
+            int one = 1;
+            setsockopt(client.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            fcntl(client.fd, F_SETFL, fcntl(client.fd, F_GETFL) | O_NONBLOCK);
+            clients.push_back(std::move(client));
+        }
+        for (size_t i = 0; i < clients.size(); i++) {
+            epoll_event ev{};
+            ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+            ev.data.u64 = i;
+            epoll_ctl(epoll_fd, EPOLL_CTL_ADD, clients[i].fd, &ev);
+            if (clients[i].sender) {
+                senders.push_back(i);
+            }
+            if (clients[i].flooder) {
+                flooders.push_back(i);
+            }
+        }
+
+        std::string text(std::max(options.size, MARKER_LEN + STAMP_DIGITS), 'x');
+        uint64_t interval = 0;
+        uint64_t next_send = 0;
+        size_t next_sender = 0;
+        std::vector<epoll_event> events(256);
+
+        while (phase.load(std::memory_order_relaxed) != Phase::STOP) {
+            Phase current = phase.load(std::memory_order_acquire);
+            int timeout = 50;
+            if (current == Phase::SEND && !senders.empty()) {
+                if (interval == 0) {
+                    // This thread's share of the rate, staggered across threads
+                    double share = options.rate * senders.size() / options.senders;
+                    interval = static_cast<uint64_t>(1e9 / share);
+                    next_send = send_start + interval * index / options.threads;
+                }
+                uint64_t now = now_ns();
+                while (next_send <= now) {
+                    send_message(clients[senders[next_sender++ % senders.size()]], next_send, text);
+                    next_send += interval;
+                }
+                timeout = static_cast<int>((next_send - now) / 1000000);
+            }
+            if (current == Phase::SEND && snapshots < 2) {
+                // Segment counts at both ends of the measurement
+                uint64_t boundary = snapshots == 0 ? measure_start : measure_end;
+                uint64_t now = now_ns();
+                if (now >= boundary) {
+                    segments = received_segments() - segments;
+                    snapshots++;
+                } else {
+                    timeout = std::min<int>(timeout, (boundary - now) / 1000000 + 1);
+                }
+            }
+            if (current == Phase::SEND) {
+                for (size_t i : flooders) {
+                    flood(clients[i]);
+                }
+                timeout = flooders.empty() ? timeout : std::min(timeout, 1);
+            }
+
+            int n = epoll_wait(epoll_fd, events.data(), events.size(), timeout);
+            for (int i = 0; i < n; i++) {
+                Client& client = clients[events[i].data.u64];
+                if (events[i].events & EPOLLOUT) {
+                    flush(client);
+                }
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                    read_client(client);
+                }
+            }
+        }
+
+        for (Client& client : clients) {
+            close(client.fd);
+        }
+        close(epoll_fd);
+    }
+
+    HdrHistogram latency{60ull * 1000 * 1000 * 1000};   // Nanoseconds
+    uint64_t sent = 0;        // Measured messages sent
+    uint64_t expected = 0;    // Deliveries those messages should produce
+    uint64_t delivered = 0;   // Measured deliveries received
+    uint64_t bytes = 0;       // All bytes received during the measurement
+    uint64_t segments = 0;    // TCP segments with data received during the measurement
+    uint64_t disconnects = 0;
+
+private:
+    const Options& options;
+    int index;
+    int epoll_fd = -1;
+    std::vector<Client> clients;
+    std::vector<size_t> senders;
+    std::vector<size_t> flooders;
+    int snapshots = 0;        // Of the segment counts, at measure_start and measure_end
+
+    uint64_t received_segments() const {
+        uint64_t total = 0;
+        for (const Client& client : clients) {
+            tcp_info info{};
+            socklen_t length = sizeof(info);
+            if (client.fd != -1 &&
+                getsockopt(client.fd, IPPROTO_TCP, TCP_INFO, &info, &length) == 0) {
+                total += info.tcpi_data_segs_in;
+            }
+        }
+        return total;
+    }
+
+    // Keep a flooder's socket full; the server decides how fast it drains
+    void flood(Client& client) {
+        while (client.fd != -1 && client.out.size() < 16384) {
+            client.out += "{\"user\":\"flood\",\"text\":\"~flood\"}\n";
+        }
+        flush(client);
+    }
+
+    void send_message(Client& client, uint64_t scheduled, std::string& text) {
+        if (client.fd == -1) {
+            return;
+        }
+        static const char digits[] = "0123456789abcdef";
+        for (size_t i = 0; i < STAMP_DIGITS; i++) {
+            text[3 + i] = digits[(scheduled >> (4 * (STAMP_DIGITS - 1 - i))) & 0xF];
+        }
+        text[0] = '~';
+        text[1] = 't';
+        text[2] = '=';
+
+        client.out += "{\"user\":\"bench\",";
+        if (options.rooms > 1) {
+            client.out += "\"room\":\"bench-" + std::to_string(client.room) + "\",";
+        }
+        client.out += "\"text\":\"" + text + "\"}\n";
+        if (scheduled >= measure_start && scheduled < measure_end) {
+            sent++;
+            expected += room_size(client.room) - 1;
+        }
+        flush(client);
+    }
+
+    void flush(Client& client) {
+        while (!client.out.empty()) {
+            ssize_t n = send(client.fd, client.out.data(), client.out.size(), MSG_NOSIGNAL);
+            if (n <= 0) {
+                if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                    return;   // EPOLLOUT resumes
+                }
+                drop(client);
+                return;
+            }
+            client.out.erase(0, n);
+        }
+    }
+
+    void read_client(Client& client) {
+        char buffer[65536];
+        while (client.fd != -1) {
+            ssize_t n = recv(client.fd, buffer, sizeof(buffer), 0);
+            if (n == 0 || (n == -1 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+                drop(client);
+                return;
+            }
+            if (n == -1) {
+                return;
+            }
+            uint64_t now = now_ns();
+            if (phase.load(std::memory_order_relaxed) != Phase::CONNECT &&
+                now >= measure_start && now < measure_end) {
+                bytes += n;
+            }
+            client.in.append(buffer, n);
+            size_t start = 0;
+            size_t end;
+            while ((end = client.in.find('\n', start)) != std::string::npos) {
+                handle_line(client, std::string_view(client.in).substr(start, end - start), now);
+                start = end + 1;
+            }
+            client.in.erase(0, start);
+        }
+    }
+
+    void handle_line(Client& client, std::string_view line, uint64_t now) {
+        if (!client.welcomed) {
+            // Answer the welcome with a username, then move to the bench room
+            client.welcomed = true;
+            size_t id = &client - clients.data();
+            std::string name = client.flooder ? "flood" : "bench";
+            client.out += "{\"user\":\"" + name + std::to_string(index + id * options.threads) +
+                          "\"}\n";
+            if (options.rooms > 1 && !client.flooder) {
+                client.out += "{\"type\":\"join\",\"room\":\"bench-" +
+                              std::to_string(client.room) + "\"}\n";
+            }
+            flush(client);
+            ready_clients++;
+            return;
+        }
+
+        size_t marker = line.find(MARKER);
+        if (marker == std::string_view::npos || line.size() < marker + MARKER_LEN + STAMP_DIGITS) {
+            return;   // Joins, presence and other server traffic
+        }
+        uint64_t scheduled = 0;
+        for (size_t i = 0; i < STAMP_DIGITS; i++) {
+            char c = line[marker + MARKER_LEN + i];
+            scheduled = (scheduled << 4) | (c <= '9' ? c - '0' : c - 'a' + 10);
+        }
+        if (scheduled >= measure_start && scheduled < measure_end) {
+            delivered++;
+            latency.record(now - scheduled);
+        }
+    }
+
+    void drop(Client& client) {
+        close(client.fd);
+        client.fd = -1;
+        client.out.clear();
+        disconnects++;
+    }
+};
+
+void raise_fd_limit() {
+    rlimit limit{};
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+void sleep_seconds(double seconds) {
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+}
+
+// The server's metrics page; empty if unavailable
+std::string fetch_metrics(const sockaddr_in& server, int port) {
+    sockaddr_in address = server;
+    address.sin_port = htons(port);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1) {
+        return std::string();
+    }
+    std::string response;
+    const char request[] = "GET /metrics HTTP/1.0\r\n\r\n";
+    if (connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0 &&
+        send(fd, request, sizeof(request) - 1, MSG_NOSIGNAL) > 0) {
+        char buffer[16384];
+        ssize_t n;
+        while ((n = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+            response.append(buffer, n);
+        }
+    }
+    close(fd);
+    return response;
+}
+
+// Value of a counter on a metrics page; -1 if it is not there
+double counter_value(const std::string& metrics, const std::string& name) {
+    size_t pos = metrics.find("\n" + name + " ");
+    if (pos == std::string::npos) {
+        return -1;
+    }
+    return std::strtod(metrics.c_str() + pos + name.size() + 2, nullptr);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        std::string value;
+        if (parse_option(arg, "--host", value)) {
+            options.host = value;
+        } else if (parse_option(arg, "--port", value)) {
+            options.port = std::stoi(value);
+        } else if (parse_option(arg, "--clients", value)) {
+            options.clients = std::max(2, std::stoi(value));
+        } else if (parse_option(arg, "--threads", value)) {
+            options.threads = std::max(1, std::stoi(value));
+        } else if (parse_option(arg, "--senders", value)) {
+            options.senders = std::max(1, std::stoi(value));
+        } else if (parse_option(arg, "--rate", value)) {
+            options.rate = std::max(1.0, std::stod(value));
+        } else if (parse_option(arg, "--size", value)) {
+            options.size = std::min<size_t>(std::stoul(value), MAX_MESSAGE_TEXT_LEN - 1);
+        } else if (parse_option(arg, "--rooms", value)) {
+            options.rooms = std::max(1, std::stoi(value));
+        } else if (parse_option(arg, "--flooders", value)) {
+            options.flooders = std::max(0, std::stoi(value));
+        } else if (parse_option(arg, "--warmup", value)) {
+            options.warmup = std::max(0.0, std::stod(value));
+        } else if (parse_option(arg, "--duration", value)) {
+            options.duration = std::max(0.1, std::stod(value));
+        } else if (parse_option(arg, "--metrics-port", value)) {
+            options.metrics_port = std::stoi(value);
+        } else {
+            std::cerr << "Unknown option: " << arg << "\n";
+            return 1;
+        }
+    }
+    options.senders = std::min(options.senders, options.clients);
+    options.threads = std::min(options.threads, options.clients);
+    options.rooms = std::min(options.rooms, options.clients);
+
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(options.port);
+    if (inet_pton(AF_INET, options.host.c_str(), &address.sin_addr) != 1) {
+        std::cerr << "Invalid address: " << options.host << "\n";
+        return 1;
+    }
+    raise_fd_limit();
+
+    // Connect and log in everyone before any load
+    uint64_t connect_begin = now_ns();
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < options.threads; i++) {
+        workers.push_back(std::make_unique<Worker>(options, i));
+    }
+    for (auto& worker : workers) {
+        threads.emplace_back(&Worker::run, worker.get(), std::cref(address));
+    }
+    int population = options.clients + options.flooders;
+    while (ready_clients + failed_clients < population) {
+        if (now_ns() - connect_begin > 60ull * 1000000000) {
+            std::cerr << "Timed out: " << ready_clients << " of " << population
+                      << " clients logged in\n";
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    double connect_ms = (now_ns() - connect_begin) / 1e6;
+    std::cerr << ready_clients << " clients logged in after " << std::fixed
+              << std::setprecision(0) << connect_ms << " ms\n";
+    if (failed_clients > 0) {
+        std::cerr << failed_clients << " clients failed to connect\n";
+    }
+
+    // Let the join announcements settle, then load
+    sleep_seconds(1);
+    send_start = now_ns();
+    measure_start = send_start + static_cast<uint64_t>(options.warmup * 1e9);
+    measure_end = measure_start + static_cast<uint64_t>(options.duration * 1e9);
+    phase.store(Phase::SEND, std::memory_order_release);
+    std::cerr << "Sending for " << options.warmup << " s warmup + " << options.duration
+              << " s measured\n";
+    sleep_seconds(options.warmup);
+    std::string metrics_begin, metrics_end;
+    if (options.metrics_port > 0) {
+        metrics_begin = fetch_metrics(address, options.metrics_port);
+    }
+    sleep_seconds(options.duration);
+    if (options.metrics_port > 0) {
+        metrics_end = fetch_metrics(address, options.metrics_port);
+    }
+    phase.store(Phase::DRAIN, std::memory_order_release);
+    sleep_seconds(2);   // Deliveries still in flight
+    phase.store(Phase::STOP, std::memory_order_release);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    HdrHistogram latency{60ull * 1000 * 1000 * 1000};
+    uint64_t sent = 0, expected = 0, delivered = 0, bytes = 0, segments = 0, disconnects = 0;
+    for (auto& worker : workers) {
+        latency.merge(worker->latency);
+        sent += worker->sent;
+        expected += worker->expected;
+        delivered += worker->delivered;
+        bytes += worker->bytes;
+        segments += worker->segments;
+        disconnects += worker->disconnects;
+    }
+
+    auto us = [&](uint64_t ns) { return ns / 1000.0; };
+    std::ostringstream json;
+    json << std::fixed << std::setprecision(1)
+         << "{\n"
+         << "  \"config\": {\"clients\": " << options.clients << ", \"threads\": " << options.threads
+         << ", \"senders\": " << options.senders << ", \"rate\": " << options.rate
+         << ", \"size\": " << options.size << ", \"rooms\": " << options.rooms
+         << ", \"flooders\": " << options.flooders
+         << ", \"warmup_s\": " << options.warmup << ", \"duration_s\": " << options.duration << "},\n"
+         << "  \"connect_ms\": " << connect_ms << ",\n"
+         << "  \"clients_ready\": " << ready_clients.load() << ",\n"
+         << "  \"disconnects\": " << disconnects << ",\n"
+         << "  \"sent\": " << sent << ",\n"
+         << "  \"expected_deliveries\": " << expected << ",\n"
+         << "  \"delivered\": " << delivered << ",\n"
+         << "  \"delivery_ratio\": " << std::setprecision(4)
+         << (expected ? static_cast<double>(delivered) / expected : 0) << ",\n"
+         << std::setprecision(1)
+         << "  \"sent_per_sec\": " << sent / options.duration << ",\n"
+         << "  \"delivered_per_sec\": " << delivered / options.duration << ",\n"
+         << "  \"received_mb_per_sec\": " << bytes / options.duration / 1e6 << ",\n"
+         << std::setprecision(0)
+         << "  \"server_segments\": " << segments << ",\n"
+         << "  \"segments_per_sec\": " << segments / options.duration << ",\n"
+         << std::setprecision(2)
+         << "  \"deliveries_per_segment\": "
+         << (segments ? static_cast<double>(delivered) / segments : 0) << ",\n";
+    // Server counters over the measurement
+    auto counter_delta = [&](const std::string& name) {
+        double begin = counter_value(metrics_begin, name);
+        double end = counter_value(metrics_end, name);
+        return begin >= 0 && end >= 0 ? end - begin : -1;
+    };
+    double syscalls = counter_delta("chat_syscalls_total");
+    double allocations = counter_delta("chat_heap_allocations_total");
+    if (syscalls >= 0) {
+        json << std::setprecision(0)
+             << "  \"server_syscalls\": " << syscalls << ",\n"
+             << std::setprecision(3)
+             << "  \"syscalls_per_delivery\": " << (delivered ? syscalls / delivered : 0) << ",\n";
+    }
+    if (allocations >= 0) {
+        json << std::setprecision(0)
+             << "  \"server_allocations\": " << allocations << ",\n"
+             << std::setprecision(3)
+             << "  \"allocations_per_message\": " << (sent ? allocations / sent : 0) << ",\n";
+    }
+    json << std::setprecision(1);
+    json << "  \"latency_us\": {\"min\": " << us(latency.min())
+         << ", \"p50\": " << us(latency.value_at_percentile(50))
+         << ", \"p90\": " << us(latency.value_at_percentile(90))
+         << ", \"p99\": " << us(latency.value_at_percentile(99))
+         << ", \"p999\": " << us(latency.value_at_percentile(99.9))
+         << ", \"max\": " << us(latency.max())
+         << ", \"mean\": " << us(static_cast<uint64_t>(latency.mean())) << "}\n"
+         << "}\n";
+    std::cout << json.str();
+    return ready_clients == population ? 0 : 1;
+}
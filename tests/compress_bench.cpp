@@ -0,0 +1,322 @@
+/*
+ * MIT License
+ * Benchmark: compression ratio and CPU cost for binary-protocol frames
+ *
+ * Usage: compress_bench [file]
+ *
+ * Checks the LZ4 block codec on edge cases and random data first. Then
+ * encodes chat messages as binary frames and reports, with and without
+ * the preset dictionary, what LZ4 makes of single frames (as broadcast)
+ * and what deflate makes of history replay batches: bytes on the wire
+ * against the uncompressed frames, and the time to compress and to
+ * decompress. Messages are the lines of file (the "text" of JSON lines, as
+ * in a message log segment), or else generated from a word list with
+ * lengths up to MAX_MESSAGE_TEXT_LEN.
+ */
+
+#include "common.h"
+#include "compress.h"
+#include "chat_dictionary.h"
+#include "json_scan.h"
+#include "lz4_block.h"
+#include "wire_protocol.h"
+#include <zlib.h>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+static int check_lz4() {
+    int failures = 0;
+    std::mt19937 rng(42);
+    auto round_trip = [&](const std::string& input, std::string_view dict, const char* what) {
+        std::string packed(lz4::compress_bound(input.size()), '\0');
+        packed.resize(lz4::compress(input.data(), input.size(), &packed[0], dict));
+        std::string output(input.size(), '\0');
+        long n = lz4::decompress(packed.data(), packed.size(), &output[0], output.size(), dict);
+        if (n != long(input.size()) || output != input) {
+            std::cout << "FAIL: " << what << " (" << input.size() << " bytes) did not round-trip\n";
+            failures++;
+        }
+    };
+
+    for (size_t size = 0; size < 300; size++) {
+        std::string random(size, '\0');
+        std::string repeated(size, '\0');
+        for (size_t i = 0; i < size; i++) {
+            random[i] = char(rng());
+            repeated[i] = "abcab"[i % 5];
+        }
+        round_trip(random, {}, "random");
+        round_trip(repeated, {}, "repeated");
+        round_trip(repeated, CHAT_DICTIONARY, "repeated with dictionary");
+        round_trip(std::string(CHAT_DICTIONARY.substr(0, size)), CHAT_DICTIONARY, "dictionary text");
+    }
+    std::string big(200000, '\0');
+    for (size_t i = 0; i < big.size(); i++) {
+        big[i] = char('a' + rng() % 4);
+    }
+    round_trip(big, CHAT_DICTIONARY, "long input");
+
+    // Damaged blocks are rejected without writing past the output
+    std::string text = "hello hello hello hello hello, the server configuration is fine";
+    std::string packed(lz4::compress_bound(text.size()), '\0');
+    packed.resize(lz4::compress(text.data(), text.size(), &packed[0], CHAT_DICTIONARY));
+    for (size_t i = 0; i < packed.size(); i++) {
+        for (int bit = 0; bit < 8; bit++) {
+            std::string damaged = packed;
+            damaged[i] = char(damaged[i] ^ (1 << bit));
+            std::vector<char> output(text.size());
+            lz4::decompress(damaged.data(), damaged.size(), output.data(), output.size(),
+                            CHAT_DICTIONARY);
+        }
+    }
+    if (lz4::decompress(packed.data(), packed.size() - 1, &text[0], text.size(),
+                        CHAT_DICTIONARY) == long(text.size())) {
+        std::cout << "FAIL: truncated block accepted\n";
+        failures++;
+    }
+
+    std::cout << (failures == 0 ? "All LZ4 checks passed\n" : "LZ4 checks FAILED\n");
+    return failures;
+}
+
+static std::vector<std::string> generated_messages(size_t count) {
+    static const char* words[] = {
+        "the", "I", "you", "to", "a", "and", "is", "it", "that", "of", "in", "we", "for", "on",
+        "this", "have", "be", "do", "not", "with", "can", "just", "what", "so", "but", "are",
+        "was", "my", "me", "if", "at", "will", "get", "know", "think", "like", "now", "yes",
+        "no", "ok", "lol", "thanks", "good", "today", "tomorrow", "meeting", "server", "build",
+        "test", "deploy", "fixed", "broken", "review", "branch", "merge", "commit", "release",
+        "please", "check", "again", "still", "working", "problem", "error", "log", "file",
+        "send", "later", "soon", "maybe", "really", "great", "sorry", "help", "question",
+        "should", "would", "could", "there", "their", "about", "after", "before", "because",
+        "update", "version", "linux", "windows", "network", "database", "deadline", "weekend",
+        "coffee", "lunch", "anyone", "everyone", "someone", "here", "where", "when", "why",
+        "how", "who", "which", "time", "people", "thing", "something", "nothing", "team",
+        "client", "socket", "thread", "memory", "queue", "latency", "message", "history"};
+    constexpr size_t WORDS = sizeof(words) / sizeof(words[0]);
+    std::mt19937 rng(7);
+    std::vector<std::string> messages;
+    for (size_t i = 0; i < count; i++) {
+        // Mostly short lines, with a long tail up to the limit
+        size_t length = std::min<size_t>(10 + size_t(std::exponential_distribution<>(1 / 90.0)(rng)),
+                                         MAX_MESSAGE_TEXT_LEN);
+        std::string text;
+        while (text.size() < length) {
+            // Zipf-like: early words are far more common
+            size_t word = size_t(WORDS * std::pow(std::uniform_real_distribution<>(0, 1)(rng), 2.5));
+            text += text.empty() ? "" : " ";
+            text += words[std::min(word, WORDS - 1)];
+        }
+        text.resize(length);
+        messages.push_back(text);
+    }
+    return messages;
+}
+
+static std::vector<std::string> file_messages(const char* path) {
+    std::ifstream in(path);
+    std::vector<std::string> messages;
+    JsonScanner scanner;
+    std::string line;
+    while (std::getline(in, line)) {
+        ChatFields fields;
+        if (scanner.parse(line, fields) == JsonError::NONE && fields.has_text) {
+            std::string text;
+            json_unescape(fields.text, text);
+            line = text;
+        }
+        if (!line.empty()) {
+            messages.push_back(line.substr(0, MAX_MESSAGE_TEXT_LEN));
+        }
+    }
+    return messages;
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void print_row(const char* name, size_t raw, size_t wire, double pack_ns, double unpack_ns) {
+    std::cout << std::left << std::setw(30) << name << std::right << std::fixed
+              << std::setprecision(1) << std::setw(12) << raw / 1024.0 << std::setw(12)
+              << wire / 1024.0 << std::setprecision(3) << std::setw(8) << double(wire) / raw
+              << std::setprecision(0) << std::setw(12) << pack_ns << std::setw(12) << unpack_ns
+              << "\n";
+}
+
+// Every frame as broadcast: payloads of min_payload bytes or more are
+// LZ4-compressed if that makes them smaller, the rest go as they are
+static void bench_lz4(const std::vector<std::string>& frames, std::string_view dict,
+                      size_t min_payload, const char* name) {
+    std::vector<std::string> packed(frames.size());
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < 10; round++) {
+        for (size_t i = 0; i < frames.size(); i++) {
+            BinaryHeader header = decode_binary_header(frames[i].data());
+            if (header.length < min_payload) {
+                continue;
+            }
+            std::string& out = packed[i];
+            out.resize(COMPRESSED_LENGTH_SIZE + lz4::compress_bound(header.length));
+            out.resize(COMPRESSED_LENGTH_SIZE +
+                       lz4::compress(frames[i].data() + BINARY_HEADER_SIZE, header.length,
+                                     &out[COMPRESSED_LENGTH_SIZE], dict));
+        }
+    }
+    double pack = seconds_since(start) / 10;
+
+    size_t raw = 0;
+    size_t wire = 0;
+    std::string output(MAX_BINARY_PAYLOAD, '\0');
+    start = std::chrono::steady_clock::now();
+    for (int round = 0; round < 10; round++) {
+        for (size_t i = 0; i < frames.size(); i++) {
+            const std::string& in = packed[i];
+            bool compressed = !in.empty() && in.size() < frames[i].size() - BINARY_HEADER_SIZE;
+            if (round == 0) {
+                raw += frames[i].size();
+                wire += compressed ? BINARY_HEADER_SIZE + in.size() : frames[i].size();
+            }
+            if (!compressed) {
+                continue;
+            }
+            long n = lz4::decompress(in.data() + COMPRESSED_LENGTH_SIZE,
+                                     in.size() - COMPRESSED_LENGTH_SIZE, &output[0],
+                                     output.size(), dict);
+            if (n != long(frames[i].size() - BINARY_HEADER_SIZE) ||
+                output.compare(0, n, frames[i], BINARY_HEADER_SIZE, n) != 0) {
+                std::cout << "FAIL: frame did not decompress\n";
+                return;
+            }
+        }
+    }
+    double unpack = seconds_since(start) / 10;
+    print_row(name, raw, wire, pack * 1e9 / frames.size(), unpack * 1e9 / frames.size());
+}
+
+// History replay: frames packed into zlib streams of REPLAY_BATCH_BYTES
+static void bench_deflate(const std::vector<std::string>& frames, bool dictionary,
+                          const char* name) {
+    std::vector<std::string> batches;
+    std::string raw_batch;
+    size_t raw = 0;
+    for (const std::string& frame : frames) {
+        raw += frame.size();
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    if (dictionary) {
+        ReplayBatcher batcher;
+        for (const std::string& frame : frames) {
+            BinaryHeader header = decode_binary_header(frame.data());
+            std::string_view payload(frame.data() + BINARY_HEADER_SIZE, header.length);
+            batcher.add(BinaryType(header.type), header.user_id, header.timestamp,
+                        payload.substr(0, header.name_len),
+                        payload.substr(header.name_len, header.room_len),
+                        payload.substr(header.name_len + header.room_len));
+            if (batcher.full()) {
+                FrameRef batch = batcher.finish();
+                batches.emplace_back(batch->data() + BINARY_HEADER_SIZE,
+                                     batch->size() - BINARY_HEADER_SIZE);
+            }
+        }
+        FrameRef batch = batcher.finish();
+        batches.emplace_back(batch->data() + BINARY_HEADER_SIZE, batch->size() - BINARY_HEADER_SIZE);
+    } else {
+        // The same batches without the dictionary, with zlib's one-shot API
+        for (size_t i = 0; i <= frames.size(); i++) {
+            if (i < frames.size()) {
+                raw_batch += frames[i];
+            }
+            if ((i == frames.size() && !raw_batch.empty()) || raw_batch.size() >= REPLAY_BATCH_BYTES) {
+                uLongf size = compressBound(raw_batch.size());
+                std::string out(COMPRESSED_LENGTH_SIZE + size, '\0');
+                store_le(&out[0], raw_batch.size(), COMPRESSED_LENGTH_SIZE);
+                compress2(reinterpret_cast<Bytef*>(&out[COMPRESSED_LENGTH_SIZE]), &size,
+                          reinterpret_cast<const Bytef*>(raw_batch.data()), raw_batch.size(),
+                          REPLAY_DEFLATE_LEVEL);
+                out.resize(COMPRESSED_LENGTH_SIZE + size);
+                batches.push_back(std::move(out));
+                raw_batch.clear();
+            }
+        }
+    }
+    double pack = seconds_since(start);
+
+    size_t wire = 0;
+    size_t unpacked = 0;
+    std::string output;
+    start = std::chrono::steady_clock::now();
+    for (const std::string& batch : batches) {
+        wire += BINARY_HEADER_SIZE + batch.size();
+        output.resize(load_le(batch.data(), COMPRESSED_LENGTH_SIZE));
+        z_stream z{};
+        inflateInit(&z);
+        z.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(batch.data()) + COMPRESSED_LENGTH_SIZE);
+        z.avail_in = uInt(batch.size() - COMPRESSED_LENGTH_SIZE);
+        z.next_out = reinterpret_cast<Bytef*>(&output[0]);
+        z.avail_out = uInt(output.size());
+        int result = inflate(&z, Z_FINISH);
+        if (result == Z_NEED_DICT) {
+            if (z.adler != chat_dictionary_id()) {
+                std::cout << "FAIL: unexpected dictionary id\n";
+            }
+            inflateSetDictionary(&z, reinterpret_cast<const Bytef*>(CHAT_DICTIONARY.data()),
+                                 uInt(CHAT_DICTIONARY.size()));
+            result = inflate(&z, Z_FINISH);
+        }
+        inflateEnd(&z);
+        if (result != Z_STREAM_END) {
+            std::cout << "FAIL: batch did not inflate\n";
+            return;
+        }
+        unpacked += output.size();
+    }
+    double unpack = seconds_since(start);
+    if (unpacked != raw) {
+        std::cout << "FAIL: batches hold " << unpacked << " bytes, expected " << raw << "\n";
+    }
+    print_row(name, raw, wire, pack * 1e9 / frames.size(), unpack * 1e9 / frames.size());
+}
+
+int main(int argc, char* argv[]) {
+    if (check_lz4() != 0) {
+        return 1;
+    }
+
+    std::vector<std::string> messages = argc > 1 ? file_messages(argv[1]) : generated_messages(50000);
+    if (messages.empty()) {
+        std::cerr << "No messages in " << argv[1] << "\n";
+        return 1;
+    }
+    std::vector<std::string> frames;
+    size_t large = 0;
+    std::mt19937 rng(3);
+    for (const std::string& text : messages) {
+        std::string name = "user" + std::to_string(rng() % 500);
+        std::string frame(binary_frame_size(name, "lobby", text), '\0');
+        encode_binary_frame(&frame[0], BinaryType::CHAT, uint32_t(rng() % 500),
+                            1700000000000ull + frames.size() * 1000, name, "lobby", text);
+        large += frame.size() - BINARY_HEADER_SIZE >= LZ4_MIN_PAYLOAD;
+        frames.push_back(std::move(frame));
+    }
+
+    std::cout << "\n" << frames.size() << " messages" << (argc > 1 ? " from " : " generated")
+              << (argc > 1 ? argv[1] : "") << ", " << large << " with payloads of "
+              << LZ4_MIN_PAYLOAD << " bytes or more\n";
+    std::cout << std::left << std::setw(30) << "case" << std::right << std::setw(12) << "raw KB"
+              << std::setw(12) << "wire KB" << std::setw(8) << "ratio" << std::setw(12)
+              << "pack ns/msg" << std::setw(12) << "unpack ns" << "\n";
+    bench_lz4(frames, {}, LZ4_MIN_PAYLOAD, "lz4, no dictionary");
+    bench_lz4(frames, CHAT_DICTIONARY, LZ4_MIN_PAYLOAD, "lz4, as the server sends");
+    bench_lz4(frames, CHAT_DICTIONARY, 0, "lz4, small frames too");
+    bench_deflate(frames, false, "deflate replay, no dictionary");
+    bench_deflate(frames, true, "deflate replay");
+    return 0;
+}
@@ -0,0 +1,120 @@
+/*
+ * MIT License
+ * Benchmark: GUI receive hand-off and bounded scrollback
+ *
+ * Usage: gui_pipeline_bench [rate] [seconds] [producers]
+ *
+ * Receive threads push parsed messages into the BatchQueue while a
+ * stand-in for the UI thread wakes once per 16 ms frame, takes the batch
+ * and appends it to the scrollback ring, as MainWindow::renderIncoming
+ * does with the model. Reports how long each frame's hand-off holds the
+ * UI thread and how long a push holds a receive thread, first at the
+ * given rate (5000 msg/s by default), then with producers flat out.
+ * Only the Qt-independent part of the pipeline is measured; painting is
+ * bounded separately by the view laying out visible rows only.
+ */
+
+#include "MessagePipeline.h"
+#include "hdr_histogram.h"
+#include <iostream>
+#include <iomanip>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+struct Line {
+    std::string user;
+    std::string time;
+    std::string text;
+};
+
+static uint64_t elapsed_ns(Clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+}
+
+static void run_case(const char* name, double rate, double seconds, int producers) {
+    BatchQueue<Line> queue(5000);
+    ScrollbackRing<Line> scrollback(5000);
+    std::atomic<bool> running{true};
+    std::atomic<uint64_t> pushed{0};
+    std::vector<HdrHistogram> push_ns(producers);
+
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; p++) {
+        threads.emplace_back([&, p] {
+            auto interval = std::chrono::nanoseconds(
+                rate > 0 ? static_cast<int64_t>(1e9 * producers / rate) : 0);
+            auto next = Clock::now();
+            uint64_t n = 0;
+            while (running.load(std::memory_order_relaxed)) {
+                if (rate > 0) {
+                    next += interval;
+                    std::this_thread::sleep_until(next);
+                }
+                Line line{"user" + std::to_string(p), "2024-01-02T03:04:05",
+                          "message number " + std::to_string(n++) + " with some chat text"};
+                auto start = Clock::now();
+                queue.push(std::move(line));
+                push_ns[p].record(elapsed_ns(start));
+                pushed.fetch_add(1, std::memory_order_relaxed);
+            }
+        });
+    }
+
+    // The UI thread: one hand-off per frame
+    HdrHistogram frame_ns;
+    HdrHistogram batch_sizes;
+    std::vector<Line> batch;
+    auto end = Clock::now() + std::chrono::duration<double>(seconds);
+    auto next_frame = Clock::now();
+    uint64_t rendered = 0;
+    while (Clock::now() < end) {
+        next_frame += std::chrono::milliseconds(16);
+        std::this_thread::sleep_until(next_frame);
+
+        auto start = Clock::now();
+        batch.clear();
+        queue.take(batch);
+        for (Line& line : batch) {
+            scrollback.push(std::move(line));
+        }
+        frame_ns.record(elapsed_ns(start));
+        batch_sizes.record(batch.size());
+        rendered += batch.size();
+    }
+    running = false;
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    HdrHistogram push_all;
+    for (const HdrHistogram& histogram : push_ns) {
+        push_all.merge(histogram);
+    }
+    std::cout << std::left << std::setw(12) << name << std::right << std::fixed
+              << std::setprecision(0) << std::setw(9) << pushed.load() / seconds << " msg/s in, "
+              << std::setw(9) << rendered / seconds << " msg/s shown, "
+              << "batch p50 " << batch_sizes.value_at_percentile(50)
+              << ", frame hand-off p50/p99/max " << std::setprecision(1)
+              << frame_ns.value_at_percentile(50) / 1e3 << "/"
+              << frame_ns.value_at_percentile(99) / 1e3 << "/" << frame_ns.max() / 1e3
+              << " us, push p99 " << push_all.value_at_percentile(99) / 1e3 << " us, dropped "
+              << queue.droppedCount() << "\n";
+}
+
+int main(int argc, char* argv[]) {
+    double rate = argc > 1 ? std::atof(argv[1]) : 5000;
+    double seconds = argc > 2 ? std::atof(argv[2]) : 3;
+    int producers = argc > 3 ? std::atoi(argv[3]) : 2;
+
+    std::cout << "GUI pipeline benchmark: " << producers << " receive threads, 16 ms frames, "
+              << "5000-message scrollback\n\n";
+    run_case("paced", rate, seconds, producers);
+    run_case("flat out", 0, seconds, producers);
+    return 0;
+}
@@ -0,0 +1,179 @@
+/*
+ * MIT License
+ * Benchmark: vectorized JSON tokenizer vs substring matching
+ *
+ * Checks a table of accepted and rejected frames first, then reports the
+ * throughput of JsonScanner and of the find()-based field extraction the
+ * server used before, on chat frames of several sizes, with plain text and
+ * with text full of escaped quotes. The old extraction validates nothing
+ * and stops at the first escaped quote, so on escaped text it reads only
+ * the start of the message.
+ */
+
+#include "common.h"
+#include "json_scan.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+#include <string>
+
+static volatile size_t sink = 0;
+
+// The server's original field extraction
+static std::string legacy_field(const std::string& line, const std::string& key) {
+    std::string pattern = "\"" + key + "\":\"";
+    size_t pos = line.find(pattern);
+    if (pos == std::string::npos) {
+        return "";
+    }
+    size_t start = pos + pattern.size();
+    size_t end = line.find("\"", start);
+    return line.substr(start, end - start);
+}
+
+static int check_cases(JsonScanner& scanner) {
+    struct Case {
+        const char* frame;
+        bool valid;
+    };
+    const Case cases[] = {
+        {R"({"user":"alice"})", true},
+        {R"({"user":"alice","proto":"bin1"})", true},
+        {R"( { "user" : "a" , "time" : "t" , "text" : "hi" } )", true},
+        {R"({"user":"a","text":"say \"hi\" \\ \/ \n é"})", true},
+        {R"({"type":"userlist","users":["a","b\"c",""]})", true},
+        {R"({"type":"skipped","count":12,"ok":true,"x":null,"f":-1.5e3})", true},
+        {R"({})", true},
+        {R"({"user":"alice")", false},
+        {R"({"user":"alice})", false},
+        {R"({"user":"a" "text":"b"})", false},
+        {R"({"user":"a",})", false},
+        {R"({"user":alice})", false},
+        {R"({"user":"a"} x)", false},
+        {R"({"user":"a"}{"user":"b"})", false},
+        {R"({"a":{"b":"c"}})", false},
+        {R"({"a":"\x"})", false},
+        {R"({"a":"\u12g4"})", false},
+        {R"({"a":"\u00e9 \uD83D\uDE00 \u0000"})", true},
+        {R"({"a":"\\uDC00"})", true},
+        {R"({"a":"\uD83D"})", false},
+        {R"({"a":"\uD83Dx\uDE00"})", false},
+        {R"({"a":"\uD83D\u0041"})", false},
+        {R"({"a":"\uDE00"})", false},
+        {R"({"a":"\uDE00\uD83D"})", false},
+        {R"({"a":01})", false},
+        {R"({"user":"admin","text":"hi","user":"alice"})", false},
+        {R"({"user":"alice","text":"hi","us\u0065r":"admin"})", false},
+        {R"({"users":[],"users":[]})", false},
+        {R"({"x":"a","x":"b"})", true},
+        {R"(["user","a"])", false},
+        {R"(user alice)", false},
+        {"{\"a\":\"tab\there\"}", false},
+    };
+
+    int failures = 0;
+    ChatFields fields;
+    for (const Case& c : cases) {
+        bool valid = scanner.parse(c.frame, fields) == JsonError::NONE;
+        if (valid != c.valid) {
+            std::cout << "FAIL: " << c.frame << " expected " << (c.valid ? "valid" : "invalid") << "\n";
+            failures++;
+        }
+    }
+
+    // Fields come back as views into the frame, escapes intact
+    std::string frame = R"({"user":"bob","time":"2024-01-02T03:04:05","text":"a \"quoted\" word"})";
+    std::string text;
+    if (scanner.parse(frame, fields) != JsonError::NONE || fields.user != "bob" ||
+        fields.time != "2024-01-02T03:04:05" || fields.text != R"(a \"quoted\" word)") {
+        std::cout << "FAIL: field extraction\n";
+        failures++;
+    }
+    json_unescape(fields.text, text);
+    if (text != "a \"quoted\" word") {
+        std::cout << "FAIL: unescape\n";
+        failures++;
+    }
+
+    // UTF-8 out, a surrogate pair as one four-byte sequence
+    frame = R"({"text":"\u00e9\u20ac\uD83D\uDE00\u0000"})";
+    if (scanner.parse(frame, fields) != JsonError::NONE) {
+        std::cout << "FAIL: \\u escapes rejected\n";
+        failures++;
+    }
+    json_unescape(fields.text, text);
+    if (text != std::string("\xC3\xA9\xE2\x82\xAC\xF0\x9F\x98\x80\0", 10)) {
+        std::cout << "FAIL: \\u unescape\n";
+        failures++;
+    }
+
+    // A string spanning a 64-byte block boundary with an escape on the edge
+    std::string long_text(62, 'x');
+    long_text += "\\\"";
+    long_text += std::string(70, 'y');
+    frame = "{\"user\":\"a\",\"text\":\"" + long_text + "\"}";
+    if (scanner.parse(frame, fields) != JsonError::NONE || fields.text != long_text) {
+        std::cout << "FAIL: block boundary\n";
+        failures++;
+    }
+
+    std::cout << (failures == 0 ? "All validation cases passed\n" : "Validation FAILED\n");
+    return failures;
+}
+
+int main(int argc, char* argv[]) {
+    size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 500000;
+    auto scanner = std::make_unique<JsonScanner>();
+    if (check_cases(*scanner) != 0) {
+        return 1;
+    }
+
+    std::cout << "\nJSON scan benchmark (" << count << " frames per case)\n";
+    std::cout << std::left << std::setw(12) << "parser" << std::setw(10) << "text"
+              << std::right << std::setw(8) << "bytes"
+              << std::setw(12) << "ns/frame"
+              << std::setw(12) << "GB/s" << "\n";
+
+    for (bool escaped : {false, true})
+    for (size_t size : {64, 256, 1000}) {
+        std::string text;
+        while (text.size() < size) {
+            text += escaped ? "lorem ipsum dolor sit amet, consectetur \\\"adipiscing\\\" elit. "
+                            : "lorem ipsum dolor sit amet, consectetur adipiscing elit. ";
+        }
+        ChatFields fields;
+        std::string frame = "{\"user\":\"alice\",\"time\":\"2024-01-02T03:04:05\",\"text\":\"" +
+                            text.substr(0, size - 60) + "\"}";
+        // Keep the escape pairs intact after the cut
+        if (scanner->parse(frame, fields) != JsonError::NONE) {
+            frame = "{\"user\":\"alice\",\"time\":\"2024-01-02T03:04:05\",\"text\":\"" +
+                    text.substr(0, size - 61) + "\"}";
+        }
+
+        auto run = [&](const char* name, auto fn) {
+            auto start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < count; i++) {
+                sink = sink + fn();
+            }
+            double elapsed =
+                std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            std::cout << std::left << std::setw(12) << name
+                      << std::setw(10) << (escaped ? "escaped" : "plain") << std::right << std::setw(8) << frame.size()
+                      << std::setw(12) << std::fixed << std::setprecision(1)
+                      << elapsed * 1e9 / count
+                      << std::setw(12) << std::setprecision(2)
+                      << double(frame.size()) * count / elapsed / 1e9 << "\n";
+        };
+
+        run("simd", [&] {
+            return size_t(scanner->parse(frame, fields)) + fields.text.size();
+        });
+        run("find", [&] {
+            return legacy_field(frame, "user").size() + legacy_field(frame, "time").size() +
+                   legacy_field(frame, "text").size();
+        });
+    }
+    return 0;
+}
@@ -0,0 +1,131 @@
+/*
+ * MIT License
+ * Microbenchmark: byte-at-a-time read_line vs buffered LineBuffer framing
+ */
+
+#include "common.h"
+#include "line_buffer.h"
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <cstdlib>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static size_t recv_calls = 0;
+
+static ssize_t counted_recv(int fd, void* buf, size_t len) {
+    recv_calls++;
+    return recv(fd, buf, len, 0);
+}
+
+// The server's original framing: one recv() per byte
+static std::string legacy_read_line(int socket_fd) {
+    std::string line;
+    char c;
+
+    while (true) {
+        ssize_t n = counted_recv(socket_fd, &c, 1);
+        if (n <= 0) {
+            return "";
+        }
+        if (c == '\n') {
+            break;
+        }
+        line += c;
+    }
+
+    return line;
+}
+
+static size_t buffered_read_all(int socket_fd, size_t expected) {
+    LineBuffer buffer;
+    std::string_view line;
+    size_t lines = 0;
+
+    while (lines < expected) {
+        LineBuffer::Status status = buffer.next_line(line);
+        if (status == LineBuffer::LINE) {
+            lines++;
+            continue;
+        }
+        recv_calls++;
+        if (buffer.fill(socket_fd) <= 0) {
+            break;
+        }
+    }
+    return lines;
+}
+
+// Stream count messages of msg_size bytes (newline included) into fd
+static void writer(int fd, size_t count, size_t msg_size) {
+    std::string frame = create_json_message("bench", std::string(msg_size, 'x'));
+    frame = frame.substr(frame.size() - msg_size); // Exact size, still newline-terminated
+
+    std::string batch;
+    for (size_t i = 0; i < 64; i++) {
+        batch += frame;
+    }
+
+    size_t sent = 0;
+    while (sent < count) {
+        size_t n = std::min<size_t>(64, count - sent);
+        send(fd, batch.data(), n * frame.size(), MSG_NOSIGNAL);
+        sent += n;
+    }
+}
+
+static void run_case(const char* name, bool buffered, size_t count, size_t msg_size) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) {
+        std::cerr << "socketpair failed\n";
+        std::exit(1);
+    }
+
+    recv_calls = 0;
+    std::thread producer(writer, fds[0], count, msg_size);
+
+    auto start = std::chrono::steady_clock::now();
+    size_t lines = 0;
+    if (buffered) {
+        lines = buffered_read_all(fds[1], count);
+    } else {
+        while (lines < count && !legacy_read_line(fds[1]).empty()) {
+            lines++;
+        }
+    }
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    producer.join();
+    close(fds[0]);
+    close(fds[1]);
+
+    double bytes = double(lines) * msg_size;
+    std::cout << std::left << std::setw(10) << name
+              << std::right << std::setw(8) << msg_size
+              << std::setw(10) << lines
+              << std::setw(14) << recv_calls
+              << std::setw(12) << std::fixed << std::setprecision(3)
+              << double(recv_calls) / lines
+              << std::setw(12) << std::setprecision(1) << bytes / elapsed / 1e6 << "\n";
+}
+
+int main(int argc, char* argv[]) {
+    size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 20000;
+
+    std::cout << "Line framing benchmark (" << count << " messages per case)\n";
+    std::cout << std::left << std::setw(10) << "framing"
+              << std::right << std::setw(8) << "bytes"
+              << std::setw(10) << "lines"
+              << std::setw(14) << "recv calls"
+              << std::setw(12) << "calls/msg"
+              << std::setw(12) << "MB/s" << "\n";
+
+    for (size_t size : {64, 128, 500, 1000}) {
+        run_case("legacy", false, count, size);
+        run_case("buffered", true, count, size);
+    }
+    return 0;
+}
@@ -0,0 +1,200 @@
+/*
+ * MIT License
+ * Benchmark: message log append throughput and history replay latency
+ *
+ * Usage: message_log_bench [dir] [megabytes]
+ *
+ * Fills a fresh log with chat lines (2 GB by default), reopens it as the
+ * server does after a restart, then times history lookups and replays the
+ * whole log through sendfile() into a socket, the way a JSON client is
+ * served. Last, it posts to many more rooms than stay open, checks that
+ * open file descriptors stay bounded and that every room reads back, and
+ * times reopening a closed room. The directory is removed afterwards.
+ */
+
+#include "message_log.h"
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <thread>
+#include <ftw.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using Clock = std::chrono::steady_clock;
+
+static double seconds_since(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static int remove_entry(const char* path, const struct stat*, int, struct FTW*) {
+    return remove(path);
+}
+
+static size_t open_fds() {
+    size_t count = 0;
+    for (auto it = std::filesystem::directory_iterator("/proc/self/fd");
+         it != std::filesystem::directory_iterator(); ++it) {
+        count++;
+    }
+    return count;
+}
+
+static uint64_t span_bytes(const std::vector<LogSpan>& spans) {
+    uint64_t total = 0;
+    for (const LogSpan& span : spans) {
+        total += span.length;
+    }
+    return total;
+}
+
+int main(int argc, char* argv[]) {
+    std::string dir = argc > 1 ? argv[1] : "message_log_bench.dir";
+    uint64_t megabytes = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 2048;
+    if (access(dir.c_str(), F_OK) == 0) {
+        std::cerr << dir << " already exists; give a new directory\n";
+        return 1;
+    }
+
+    // A typical relayed line, about 120 bytes
+    std::string text(60, 'x');
+    std::string line = "{\"user\":\"alice\",\"time\":\"2024-01-02T03:04:05\",\"text\":\"" + text + "\"}\n";
+    FrameRef frame = make_frame(line);
+    uint64_t total = megabytes << 20;
+    uint64_t messages = total / line.size();
+
+    std::cout << "Message log benchmark: " << messages << " messages, "
+              << (messages * line.size() >> 20) << " MiB\n\n";
+
+    uint64_t midpoint = 0;
+    {
+        MessageLog log(dir);
+        if (!log.open()) {
+            return 1;
+        }
+
+        // Commit latency of a lone message: one write and fdatasync
+        std::vector<double> latencies;
+        for (int i = 0; i < 200; i++) {
+            auto start = Clock::now();
+            log.append("lobby", frame);
+            log.sync();
+            latencies.push_back(seconds_since(start) * 1e6);
+        }
+        std::sort(latencies.begin(), latencies.end());
+        std::cout << "single append + sync: p50 " << std::fixed << std::setprecision(0)
+                  << latencies[100] << " us, p99 " << latencies[198] << " us\n";
+
+        // Bulk appends, group-committed by the writer thread
+        auto start = Clock::now();
+        for (uint64_t i = 0; i < messages; i++) {
+            log.append("lobby", frame);
+            if (i == messages / 2) {
+                midpoint = (now_epoch_ms() / 1000 + 1) * 1000;
+            }
+            if ((i & 0xFFFF) == 0) {
+                log.sync(); // Bound the queue
+            }
+        }
+        log.sync();
+        double elapsed = seconds_since(start);
+        std::cout << "append:               " << std::setprecision(2)
+                  << messages / elapsed / 1e6 << " M msg/s, "
+                  << std::setprecision(0) << messages * line.size() / elapsed / 1e6
+                  << " MB/s (durable)\n";
+        log.close();
+    }
+
+    MessageLog log(dir);
+    auto start = Clock::now();
+    if (!log.open() || log.last("lobby", 1).empty()) {
+        return 1;
+    }
+    std::cout << "reopen:               " << std::setprecision(1)
+              << seconds_since(start) * 1e3 << " ms\n\n";
+
+    auto time_lookup = [&](const char* name, auto lookup) {
+        const int rounds = 1000;
+        std::vector<LogSpan> spans;
+        auto begin = Clock::now();
+        for (int i = 0; i < rounds; i++) {
+            spans = lookup();
+        }
+        std::cout << std::left << std::setw(22) << name << std::right
+                  << std::setprecision(2) << seconds_since(begin) * 1e6 / rounds << " us, "
+                  << span_bytes(spans) / line.size() << " messages in "
+                  << spans.size() << " spans\n";
+        return spans;
+    };
+    time_lookup("last 100:", [&] { return log.last("lobby", 100); });
+    time_lookup("last 100000:", [&] { return log.last("lobby", 100000); });
+    time_lookup("since midpoint:", [&] { return log.since("lobby", midpoint); });
+    std::vector<LogSpan> all = time_lookup("everything:", [&] { return log.last("lobby", messages); });
+
+    // Replay as a JSON client gets it: sendfile() from the segments into a
+    // socket, with a reader draining the other end
+    int pair[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, pair);
+    std::thread reader([fd = pair[1]] {
+        std::vector<char> buffer(1 << 20);
+        while (recv(fd, buffer.data(), buffer.size(), 0) > 0) {
+        }
+    });
+    start = Clock::now();
+    uint64_t sent = 0;
+    for (const LogSpan& span : all) {
+        off_t offset = span.offset;
+        uint64_t left = span.length;
+        while (left > 0) {
+            ssize_t n = sendfile(pair[0], span.segment->fd, &offset, left);
+            if (n <= 0) {
+                break;
+            }
+            left -= n;
+            sent += n;
+        }
+    }
+    close(pair[0]);
+    reader.join();
+    double elapsed = seconds_since(start);
+    close(pair[1]);
+    std::cout << "\nreplay via sendfile:  " << std::setprecision(2) << sent / elapsed / 1e9
+              << " GB/s (" << (sent >> 20) << " MiB, page cache)\n";
+    all.clear();
+
+    // Client-named rooms: only DEFAULT_LOG_OPEN_ROOMS keep their segments open
+    const int rooms = 2000;
+    size_t fds_before = open_fds();
+    for (int i = 0; i < rooms; i++) {
+        log.append("room-" + std::to_string(i), frame);
+    }
+    log.sync();
+    log.append("lobby", frame);   // One more pass closes the idle rooms
+    log.sync();
+    size_t fds_after = open_fds();
+    int missing = 0;
+    start = Clock::now();
+    for (int i = 0; i < rooms; i++) {
+        if (span_bytes(log.last("room-" + std::to_string(i), 10)) != line.size()) {
+            missing++;
+        }
+    }
+    std::cout << rooms << " rooms:           " << fds_after - std::min(fds_after, fds_before)
+              << " more open fds (limit " << 2 * DEFAULT_LOG_OPEN_ROOMS << "), "
+              << std::setprecision(1) << seconds_since(start) * 1e6 / rooms
+              << " us to reopen a room, " << missing << " rooms wrong\n";
+    bool bounded = fds_after <= fds_before + 2 * DEFAULT_LOG_OPEN_ROOMS;
+    if (!bounded || missing > 0) {
+        std::cout << "FAIL: room logs are not released or not read back\n";
+    }
+
+    log.close();
+    nftw(dir.c_str(), remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    return bounded && missing == 0 ? 0 : 1;
+}
@@ -0,0 +1,286 @@
+/*
+ * MIT License
+ * Protocol edge cases against a running socket server
+ *
+ * Usage: protocol_test [--port=N]
+ *
+ * Logs in JSON and binary clients and sends frames that sit on the edges
+ * of the protocol, checking what the other clients receive, or that they
+ * receive nothing. After every check a fresh connection must still be
+ * welcomed, so a check that brings the server down fails. Exits non-zero
+ * if any check fails.
+ */
+
+#include "common.h"
+#include "wire_protocol.h"
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+int port = DEFAULT_PORT;
+
+// How long a client waits for something it expects, or for something
+// that must not arrive
+constexpr int WAIT_MS = 500;
+
+class TestClient {
+public:
+    ~TestClient() {
+        if (fd != -1) {
+            close(fd);
+        }
+    }
+
+    // Connect and wait for the welcome; false if the server is not there
+    bool connect_server() {
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        std::string welcome;
+        return connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0 &&
+               read_line(welcome) && welcome.find("\"welcome\"") != std::string::npos;
+    }
+
+    // Log in as name, in the lobby once the user list arrives
+    bool login(const std::string& name, bool use_binary = false) {
+        if (!connect_server()) {
+            return false;
+        }
+        send_raw("{\"user\":\"" + name + "\"" +
+                 (use_binary ? std::string(",\"proto\":\"bin1\"") : std::string()) + "}\n");
+        binary = use_binary;
+        return wait_for("\"type\":\"userlist\"");
+    }
+
+    // A command object, as a line or a CONTROL frame; waits for the room's user list
+    bool join(const std::string& escaped_room) {
+        send_command("{\"type\":\"join\",\"room\":\"" + escaped_room + "\"}");
+        return wait_for("\"type\":\"userlist\"");
+    }
+
+    void send_command(const std::string& json) {
+        if (binary) {
+            send_binary("", json, BinaryType::CONTROL);
+        } else {
+            send_raw(json + "\n");
+        }
+    }
+
+    void send_binary(std::string_view room, std::string_view text,
+                     BinaryType type = BinaryType::CHAT, uint64_t timestamp = 0) {
+        std::string frame(binary_frame_size("", room, text), '\0');
+        encode_binary_frame(&frame[0], type, 0, timestamp, "", room, text);
+        send_raw(frame);
+    }
+
+    void send_raw(const std::string& bytes) {
+        send(fd, bytes.data(), bytes.size(), MSG_NOSIGNAL);
+    }
+
+    // Next line from a JSON client, or the text of the next frame from a
+    // binary one, with "room" and "user" for CHAT frames put in front
+    bool read_message(std::string& message) {
+        if (!binary) {
+            return read_line(message);
+        }
+        std::string header;
+        if (!read_bytes(header, BINARY_HEADER_SIZE)) {
+            return false;
+        }
+        BinaryHeader h = decode_binary_header(header.data());
+        std::string payload;
+        if (!read_bytes(payload, h.length)) {
+            return false;
+        }
+        std::string_view view(payload);
+        if (h.type == static_cast<uint8_t>(BinaryType::CHAT)) {
+            message = "user=" + std::string(view.substr(0, h.name_len)) +
+                      " room=" + std::string(view.substr(h.name_len, h.room_len)) +
+                      " text=" + std::string(view.substr(h.name_len + h.room_len));
+        } else {
+            message = std::string(view.substr(h.name_len + h.room_len));
+        }
+        return true;
+    }
+
+    // Read messages until one contains needle; the match is left in last
+    bool wait_for(const std::string& needle) {
+        while (read_message(last)) {
+            if (last.find(needle) != std::string::npos) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // No message containing needle arrives within WAIT_MS
+    bool never(const std::string& needle) {
+        return !wait_for(needle);
+    }
+
+    std::string last;
+
+private:
+    int fd = -1;
+    bool binary = false;
+    std::string in;
+
+    bool fill() {
+        pollfd pfd{fd, POLLIN, 0};
+        if (poll(&pfd, 1, WAIT_MS) <= 0) {
+            return false;
+        }
+        char buffer[65536];
+        ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n <= 0) {
+            return false;
+        }
+        in.append(buffer, n);
+        return true;
+    }
+
+    bool read_line(std::string& line) {
+        size_t end;
+        while ((end = in.find('\n')) == std::string::npos) {
+            if (!fill()) {
+                return false;
+            }
+        }
+        line = in.substr(0, end);
+        in.erase(0, end + 1);
+        return true;
+    }
+
+    bool read_bytes(std::string& out, size_t count) {
+        while (in.size() < count) {
+            if (!fill()) {
+                return false;
+            }
+        }
+        out = in.substr(0, count);
+        in.erase(0, count);
+        return true;
+    }
+};
+
+// Binary rooms are raw bytes: a backslash is kept, and a room that would
+// be a broken JSON escape is just a room the sender has not joined
+bool binary_room_bytes() {
+    TestClient json, binary;
+    if (!json.login("pt_json") || !binary.login("pt_bin", true) ||
+        !json.join("a\\\\b") || !binary.join("a\\\\b")) {
+        return false;
+    }
+    binary.send_binary("\\u", "broken escape");
+    binary.send_binary("ab\\", "trailing backslash");
+    binary.send_binary(std::string(MAX_ROOM_NAME_LEN, 'r'), "oversized room");
+    binary.send_binary("a\\b", "backslash room");
+    return json.wait_for("backslash room") &&
+           json.last.find("\"room\":\"a\\\\b\"") != std::string::npos &&
+           json.last.find("broken escape") == std::string::npos &&
+           json.never("trailing backslash");
+}
+
+// A join notice goes to the room's other members, not to the joiner
+bool join_notice() {
+    TestClient member, joiner;
+    if (!member.login("pt_member") || !joiner.login("pt_joiner") || !member.join("notices")) {
+        return false;
+    }
+    // Anything the joiner is sent up to its user list comes from the join
+    joiner.send_command("{\"type\":\"join\",\"room\":\"notices\"}");
+    bool own_notice = false;
+    while (joiner.read_message(joiner.last) &&
+           joiner.last.find("\"type\":\"userlist\"") == std::string::npos) {
+        own_notice |= joiner.last.find("joined the chat") != std::string::npos;
+    }
+    return !own_notice && member.wait_for("\"room\":\"notices\",\"text\":\"pt_joiner joined the chat\"");
+}
+
+// tag, then unit until the text decodes to size bytes; unit is a single
+// byte or a JSON escape of one
+std::string padded(const std::string& tag, size_t size, const std::string& unit) {
+    std::string text = tag;
+    for (size_t n = tag.size(); n < size; n++) {
+        text += unit;
+    }
+    return text;
+}
+
+// Texts are limited to MAX_MESSAGE_TEXT_LEN - 1 bytes once decoded, in
+// either format, and nothing that escapes to more than a frame is relayed
+bool text_limit() {
+    TestClient json, binary, peer;
+    if (!json.login("pt_json_text") || !binary.login("pt_bin_text", true) ||
+        !peer.login("pt_peer")) {
+        return false;
+    }
+    const size_t longest = MAX_MESSAGE_TEXT_LEN - 1;
+    json.send_raw("{\"text\":\"" + padded("json-fits", longest, "\\\"") + "\"}\n");
+    json.send_raw("{\"text\":\"" + padded("json-over", longest + 1, "\\\"") + "\"}\n");
+    json.send_raw("{\"text\":\"json-last\"}\n");
+    binary.send_binary("", padded("bin-fits", longest, "x"));
+    binary.send_binary("", padded("bin-over", longest + 1, "x"));
+    binary.send_binary("", padded("bin-escapes", longest, "\x01"));
+    binary.send_binary("", "bin-last");
+
+    std::string seen;
+    while ((seen.find("json-last") == std::string::npos ||
+            seen.find("bin-last") == std::string::npos) && peer.read_message(peer.last)) {
+        seen += peer.last;
+    }
+    return seen.find("json-last") != std::string::npos &&
+           seen.find("bin-last") != std::string::npos &&
+           seen.find("json-fits") != std::string::npos &&
+           seen.find("bin-fits") != std::string::npos &&
+           seen.find("json-over") == std::string::npos &&
+           seen.find("bin-over") == std::string::npos &&
+           seen.find("bin-escapes") == std::string::npos;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    for (int i = 1; i < argc; i++) {
+        if (std::strncmp(argv[i], "--port=", 7) == 0) {
+            port = std::atoi(argv[i] + 7);
+        }
+    }
+
+    struct Check {
+        const char* name;
+        std::function<bool()> run;
+    };
+    const std::vector<Check> checks = {
+        {"binary room bytes", binary_room_bytes},
+        {"join notice", join_notice},
+        {"text limit", text_limit},
+    };
+
+    int failures = 0;
+    for (const Check& check : checks) {
+        bool passed = check.run();
+        TestClient probe;
+        bool alive = probe.connect_server();
+        std::cout << (passed && alive ? "PASS: " : "FAIL: ") << check.name
+                  << (alive ? "" : " (server stopped answering)") << "\n";
+        failures += passed && alive ? 0 : 1;
+        if (!alive) {
+            break;
+        }
+    }
+    std::cout << (failures == 0 ? "All protocol checks passed\n" : "Protocol checks FAILED\n");
+    return failures == 0 ? 0 : 1;
+}
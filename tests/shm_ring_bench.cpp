@@ -0,0 +1,291 @@
+/*
+ * MIT License
+ * Benchmark: lock-free shared-memory ring vs the semaphore-guarded layout
+ *
+ * Forks N producer and M consumer processes. Every message carries its
+ * CLOCK_MONOTONIC send time; consumers record the delivery latency. The
+ * semaphore layout hands each message to one consumer, while the ring
+ * broadcasts it to all of them, so throughput is reported as deliveries.
+ */
+
+#include "common.h"
+#include "shm_ring.h"
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+
+const char* BENCH_RING_NAME = "/os_chat_bench_ring";
+const char* BENCH_SHM_NAME = "/os_chat_bench_shm";
+const char* BENCH_SEM_MUTEX = "/os_chat_bench_mutex";
+const char* BENCH_SEM_FULL = "/os_chat_bench_full";
+const char* BENCH_SEM_EMPTY = "/os_chat_bench_empty";
+const char* STOP_TEXT = "STOP";
+
+uint64_t now_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+// Results shared by all forked processes
+struct BenchShared {
+    std::atomic<uint64_t> received;
+    std::atomic<uint64_t> lost;
+    std::atomic<int> ready;
+    uint64_t latencies[1]; // Sized at mmap time
+};
+
+BenchShared* map_results(size_t total) {
+    size_t size = sizeof(BenchShared) + total * sizeof(uint64_t);
+    void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        std::cerr << "Failed to map results\n";
+        std::exit(1);
+    }
+    return static_cast<BenchShared*>(mem);
+}
+
+void record(BenchShared* results, const ChatMessage& msg) {
+    uint64_t sent = std::strtoull(msg.text, nullptr, 10);
+    uint64_t index = results->received.fetch_add(1);
+    results->latencies[index] = now_ns() - sent;
+}
+
+// --- Lock-free ring --------------------------------------------------------
+
+ShmRing* attach_bench_ring() {
+    return attach_shm_ring(BENCH_RING_NAME, ShmRingPolicy::BLOCK);
+}
+
+void ring_producer(int count) {
+    ShmRing* ring = attach_bench_ring();
+    for (int i = 0; i < count; i++) {
+        ring->push("bench", "t", std::to_string(now_ns()));
+    }
+    detach_shm_ring(ring);
+}
+
+void ring_consumer(BenchShared* results) {
+    ShmRing* ring = attach_bench_ring();
+    int reader = ring->attach_reader();
+    results->ready.fetch_add(1);
+
+    ChatMessage msg;
+    uint64_t lost = 0;
+    while (true) {
+        RingRead result = ring->read_wait(reader, msg, lost, -1);
+        if (result == RingRead::LAPPED) {
+            results->lost.fetch_add(lost);
+            continue;
+        }
+        if (std::strcmp(msg.text, STOP_TEXT) == 0) {
+            break;
+        }
+        record(results, msg);
+    }
+    ring->detach_reader(reader);
+    detach_shm_ring(ring);
+}
+
+void ring_stop() {
+    ShmRing* ring = attach_bench_ring();
+    ring->push("bench", "t", STOP_TEXT); // Seen by every reader
+    detach_shm_ring(ring);
+}
+
+// --- Semaphore layout (mutex + full/empty, as before) -----------------------
+
+struct SemHandles {
+    SharedMemoryLayout* shm;
+    sem_t* mutex;
+    sem_t* full;
+    sem_t* empty;
+};
+
+SemHandles sem_attach() {
+    SemHandles h{};
+    int fd = shm_open(BENCH_SHM_NAME, O_CREAT | O_RDWR, 0666);
+    if (fd == -1 || ftruncate(fd, sizeof(SharedMemoryLayout)) == -1) {
+        std::cerr << "Failed to open shared memory\n";
+        std::exit(1);
+    }
+    h.shm = static_cast<SharedMemoryLayout*>(mmap(nullptr, sizeof(SharedMemoryLayout),
+                                                  PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
+    close(fd);
+    h.mutex = sem_open(BENCH_SEM_MUTEX, O_CREAT, 0666, 1);
+    h.empty = sem_open(BENCH_SEM_EMPTY, O_CREAT, 0666, SHARED_MEMORY_CAPACITY);
+    h.full = sem_open(BENCH_SEM_FULL, O_CREAT, 0666, 0);
+    return h;
+}
+
+void sem_detach(SemHandles& h) {
+    sem_close(h.mutex);
+    sem_close(h.full);
+    sem_close(h.empty);
+    munmap(h.shm, sizeof(SharedMemoryLayout));
+}
+
+void sem_push(SemHandles& h, const std::string& text) {
+    sem_wait(h.empty);
+    sem_wait(h.mutex);
+    int write_idx = h.shm->write_index.load();
+    h.shm->messages[write_idx].set("bench", "t", text);
+    h.shm->write_index.store((write_idx + 1) % SHARED_MEMORY_CAPACITY);
+    sem_post(h.mutex);
+    sem_post(h.full);
+}
+
+void sem_producer(int count) {
+    SemHandles h = sem_attach();
+    for (int i = 0; i < count; i++) {
+        sem_push(h, std::to_string(now_ns()));
+    }
+    sem_detach(h);
+}
+
+void sem_consumer(BenchShared* results) {
+    SemHandles h = sem_attach();
+    ChatMessage msg;
+    while (true) {
+        sem_wait(h.full);
+        sem_wait(h.mutex);
+        int read_idx = h.shm->read_index.load();
+        msg = h.shm->messages[read_idx];
+        h.shm->read_index.store((read_idx + 1) % SHARED_MEMORY_CAPACITY);
+        sem_post(h.mutex);
+        sem_post(h.empty);
+
+        if (std::strcmp(msg.text, STOP_TEXT) == 0) {
+            break;
+        }
+        record(results, msg);
+    }
+    sem_detach(h);
+}
+
+void sem_stop(int consumers) {
+    SemHandles h = sem_attach();
+    for (int i = 0; i < consumers; i++) {
+        sem_push(h, STOP_TEXT);
+    }
+    sem_detach(h);
+}
+
+void cleanup() {
+    shm_unlink(BENCH_RING_NAME);
+    shm_unlink(BENCH_SHM_NAME);
+    sem_unlink(BENCH_SEM_MUTEX);
+    sem_unlink(BENCH_SEM_FULL);
+    sem_unlink(BENCH_SEM_EMPTY);
+}
+
+// --- Driver ------------------------------------------------------------------
+
+template <typename Fn>
+pid_t spawn(Fn fn) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        fn();
+        _exit(0);
+    }
+    return pid;
+}
+
+void run(const char* name, bool ring, int producers, int consumers, int per_producer) {
+    cleanup();
+    if (ring) {
+        detach_shm_ring(attach_bench_ring());
+    } else {
+        SemHandles h = sem_attach();
+        new (h.shm) SharedMemoryLayout();
+        sem_detach(h);
+    }
+
+    size_t sent = size_t(producers) * per_producer;
+    size_t total = ring ? sent * consumers : sent;
+    BenchShared* results = map_results(total);
+    results->received.store(0);
+    results->lost.store(0);
+    results->ready.store(0);
+
+    std::vector<pid_t> consumer_pids;
+    for (int i = 0; i < consumers; i++) {
+        consumer_pids.push_back(spawn([&] {
+            ring ? ring_consumer(results) : sem_consumer(results);
+        }));
+    }
+    if (ring) {
+        // Readers must be attached before the first message is published
+        while (results->ready.load() < consumers) {
+            sched_yield();
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<pid_t> producer_pids;
+    for (int i = 0; i < producers; i++) {
+        producer_pids.push_back(spawn([&] {
+            ring ? ring_producer(per_producer) : sem_producer(per_producer);
+        }));
+    }
+    for (pid_t pid : producer_pids) {
+        waitpid(pid, nullptr, 0);
+    }
+    while (results->received.load() + results->lost.load() < total) {
+        sched_yield();
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    ring ? ring_stop() : sem_stop(consumers);
+    for (pid_t pid : consumer_pids) {
+        waitpid(pid, nullptr, 0);
+    }
+
+    size_t received = results->received.load();
+    std::vector<uint64_t> lat(results->latencies, results->latencies + received);
+    std::sort(lat.begin(), lat.end());
+    auto pct = [&](double p) {
+        return received == 0 ? 0.0 : lat[std::min(received - 1, size_t(p * received))] / 1000.0;
+    };
+
+    std::cout << std::left << std::setw(12) << name << std::right
+              << std::setw(4) << producers << std::setw(4) << consumers
+              << std::setw(14) << std::fixed << std::setprecision(0) << received / elapsed
+              << std::setw(12) << std::setprecision(1) << pct(0.50)
+              << std::setw(12) << pct(0.99)
+              << std::setw(10) << results->lost.load() << "\n";
+
+    munmap(results, sizeof(BenchShared) + total * sizeof(uint64_t));
+    cleanup();
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    int producers = argc > 1 ? std::atoi(argv[1]) : 2;
+    int consumers = argc > 2 ? std::atoi(argv[2]) : 2;
+    int per_producer = argc > 3 ? std::atoi(argv[3]) : 100000;
+
+    std::cout << "Shared memory transport benchmark (" << per_producer
+              << " messages per producer)\n";
+    std::cout << std::left << std::setw(12) << "transport" << std::right
+              << std::setw(4) << "P" << std::setw(4) << "C"
+              << std::setw(14) << "deliveries/s" << std::setw(12) << "p50 us"
+              << std::setw(12) << "p99 us" << std::setw(10) << "lost" << "\n";
+
+    run("semaphore", false, producers, consumers, per_producer);
+    run("lock-free", true, producers, consumers, per_producer);
+    return 0;
+}
@@ -4,81 +4,140 @@
  */
 
 #include "common.h"
+#include "shm_ring.h"
 #include <iostream>
-#include <sys/mman.h>
-#include <sys/stat.h>
-#include <fcntl.h>
-#include <unistd.h>
-#include <semaphore.h>
-#include <cstring>
-#include <thread>
 #include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
-int main(int argc, char* argv[]) {
-    if (argc < 3) {
-        std::cerr << "Usage: " << argv[0] << " <username> <message>\n";
+// Print every message published to the ring until interrupted
+int listen_ring(ShmRing* ring, const std::string& username) {
+    int reader = ring->attach_reader();
+    if (reader == -1) {
+        std::cerr << "No free reader slot in shared memory ring\n";
         return 1;
     }
-    
-    std::string username = argv[1];
-    std::string message = argv[2];
-    
-    int shm_fd = shm_open(DEFAULT_SHM_NAME, O_CREAT | O_RDWR, 0666);
-    if (shm_fd == -1) {
-        std::cerr << "Failed to open shared memory\n";
+
+    std::cout << "[" << username << "] Listening..." << std::endl;
+
+    ChatMessage msg;
+    uint64_t lost = 0;
+    while (true) {
+        RingRead result = ring->read_wait(reader, msg, lost, -1);
+        if (result == RingRead::LAPPED) {
+            std::cout << "[" << username << "] Fell behind, missed " << lost << " messages" << std::endl;
+        } else if (result == RingRead::MESSAGE) {
+            std::cout << "[" << msg.timestamp << "] " << msg.username << ": " << msg.text << std::endl;
+        }
+    }
+}
+
+// Log in to a chat_server running with --shm-bridge, publish count
+// records to the ring back to back, and count how many the bridge relays
+// to the lobby. A burst of a few hundred spans several bridge batches.
+int check_bridge(ShmRing* ring, int port, int count) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    // Room for the whole burst, so the server never sees us as a slow reader
+    int buffer_size = 4 << 20;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+    if (connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == -1) {
+        std::cerr << "Failed to connect to port " << port << "\n";
         return 1;
     }
-    
-    size_t shm_size = sizeof(SharedMemoryLayout);
-    ftruncate(shm_fd, shm_size);
-    
-    SharedMemoryLayout* shm_ptr = (SharedMemoryLayout*)mmap(
-        nullptr, shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
-    
-    if (shm_ptr == MAP_FAILED) {
-        std::cerr << "Failed to map shared memory\n";
-        close(shm_fd);
+
+    // Each line is handed to on_line; returns once it says so or on timeout
+    std::string in;
+    auto read_until = [&](auto on_line) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (std::chrono::steady_clock::now() < deadline) {
+            size_t end;
+            while ((end = in.find('\n')) != std::string::npos) {
+                bool done = on_line(in.substr(0, end));
+                in.erase(0, end + 1);
+                if (done) {
+                    return true;
+                }
+            }
+            pollfd pfd{fd, POLLIN, 0};
+            char buffer[16384];
+            ssize_t n = poll(&pfd, 1, 100) > 0 ? recv(fd, buffer, sizeof(buffer), 0) : 0;
+            if (n < 0 || (n == 0 && pfd.revents != 0)) {
+                return false;
+            }
+            in.append(buffer, n > 0 ? n : 0);
+        }
+        return false;
+    };
+
+    // Welcome, then our user list once we are in the lobby
+    read_until([](const std::string&) { return true; });
+    const char login[] = "{\"user\":\"bridge_check\"}\n";
+    send(fd, login, sizeof(login) - 1, MSG_NOSIGNAL);
+    read_until([](const std::string& line) {
+        return line.find("\"type\":\"userlist\"") != std::string::npos;
+    });
+
+    char now[MAX_TIMESTAMP_LEN];
+    std::string_view time(now, get_timestamp(now));
+    for (int i = 0; i < count; i++) {
+        ring->push("burst", time, "burst-" + std::to_string(i));
+    }
+
+    std::set<int> relayed;
+    read_until([&](const std::string& line) {
+        size_t pos = line.find("\"text\":\"burst-");
+        if (pos != std::string::npos) {
+            relayed.insert(std::atoi(line.c_str() + pos + 14));
+        }
+        return int(relayed.size()) == count;
+    });
+    close(fd);
+
+    std::cout << "Relayed " << relayed.size() << " of " << count << " records\n";
+    return int(relayed.size()) == count ? 0 : 1;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " <username> <message>\n"
+                  << "       " << argv[0] << " --listen <username>\n"
+                  << "       " << argv[0] << " --bridge-check <port> [count]\n";
         return 1;
     }
-    
-    sem_t* sem_mutex = sem_open(SEM_MUTEX_NAME, O_CREAT, 0666, 1);
-    sem_t* sem_empty = sem_open(SEM_EMPTY_NAME, O_CREAT, 0666, SHARED_MEMORY_CAPACITY);
-    sem_t* sem_full = sem_open(SEM_FULL_NAME, O_CREAT, 0666, 0);
-    
-    if (sem_mutex == SEM_FAILED || sem_empty == SEM_FAILED || sem_full == SEM_FAILED) {
-        std::cerr << "Failed to open semaphores\n";
-        munmap(shm_ptr, shm_size);
-        close(shm_fd);
+
+    ShmRing* ring = attach_shm_ring(DEFAULT_SHM_RING_NAME);
+    if (ring == nullptr) {
+        std::cerr << "Failed to open shared memory ring\n";
         return 1;
     }
-    
-    sem_wait(sem_mutex);
-    if (shm_ptr->capacity == 0) {
-        new (shm_ptr) SharedMemoryLayout();
+
+    if (std::strcmp(argv[1], "--listen") == 0) {
+        return listen_ring(ring, argv[2]);
+    }
+    if (std::strcmp(argv[1], "--bridge-check") == 0) {
+        return check_bridge(ring, std::atoi(argv[2]), argc > 3 ? std::atoi(argv[3]) : 1000);
     }
-    sem_post(sem_mutex);
-    
-    sem_wait(sem_empty);
-    sem_wait(sem_mutex);
-    
-    int write_idx = shm_ptr->write_index.load();
-    ChatMessage& msg = shm_ptr->messages[write_idx];
-    
-    std::string timestamp = get_timestamp();
-    msg.set(username, timestamp, message);
-    
-    shm_ptr->write_index.store((write_idx + 1) % SHARED_MEMORY_CAPACITY);
-    
-    sem_post(sem_mutex);
-    sem_post(sem_full);
-    
+
+    std::string username = argv[1];
+    std::string message = argv[2];
+
+    // Lock-free publish; every attached reader will see it
+    char now[MAX_TIMESTAMP_LEN];
+    ring->push(username, std::string_view(now, get_timestamp(now)), message);
+
     std::cout << "[" << username << "] Message sent: " << message << "\n";
-    
-    sem_close(sem_mutex);
-    sem_close(sem_empty);
-    sem_close(sem_full);
-    munmap(shm_ptr, shm_size);
-    close(shm_fd);
-    
+
+    detach_shm_ring(ring);
+
     return 0;
 }
@@ -0,0 +1,132 @@
+/*
+ * MIT License
+ * Benchmark: generational connection slab vs fd-keyed hash map
+ *
+ * Checks stale-handle detection and slot reuse first, then simulates
+ * connection churn: a fixed population of live records where each step
+ * drops one, accepts a replacement and looks up a batch of live entries,
+ * as the reactor does for epoll events and room fan-out.
+ */
+
+#include "slab.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+static volatile size_t sink = 0;
+
+// Stand-in for a Connection: some inline state and an owned buffer
+struct Record {
+    int fd;
+    uint64_t counters[6];
+    std::string name;
+
+    explicit Record(int fd) : fd(fd), counters{}, name("user") {}
+};
+
+static int check_slab() {
+    int failures = 0;
+    auto fail = [&](const char* what) {
+        std::cout << "FAIL: " << what << "\n";
+        failures++;
+    };
+
+    Slab<Record, 4> slab;
+    SlabId a = slab.emplace(10);
+    SlabId b = slab.emplace(11);
+    if (slab.get(a) == nullptr || slab.get(a)->fd != 10 || slab.get(b)->fd != 11) {
+        fail("lookup");
+    }
+    if (slab.get(0) != nullptr || slab.get(1) != nullptr) {
+        fail("generation 0 must never name an entry");
+    }
+
+    slab.erase(a);
+    if (slab.get(a) != nullptr) {
+        fail("erased handle still resolves");
+    }
+    SlabId c = slab.emplace(12);
+    if (uint32_t(c) != uint32_t(a) || c == a) {
+        fail("slot reuse with a new generation");
+    }
+    if (slab.get(a) != nullptr || slab.get(c)->fd != 12) {
+        fail("stale handle aliases the new occupant");
+    }
+    slab.erase(a); // Stale: must not touch c
+    if (slab.get(c) == nullptr || slab.size() != 2) {
+        fail("erase through a stale handle");
+    }
+
+    // Churn at a steady population must not grow the slab
+    std::vector<SlabId> live{b, c};
+    for (int i = 0; i < 10000; i++) {
+        slab.erase(live[i % 2]);
+        live[i % 2] = slab.emplace(i);
+    }
+    if (slab.size() != 2 || slab.capacity() != 4) {
+        fail("capacity grew under churn");
+    }
+
+    std::cout << (failures == 0 ? "All slab checks passed\n" : "Slab checks FAILED\n");
+    return failures;
+}
+
+int main(int argc, char* argv[]) {
+    size_t steps = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 2000000;
+    if (check_slab() != 0) {
+        return 1;
+    }
+
+    std::cout << "\nConnection churn benchmark (" << steps << " steps, 16 lookups each)\n";
+    std::cout << std::left << std::setw(12) << "table"
+              << std::right << std::setw(10) << "live"
+              << std::setw(12) << "ns/step" << "\n";
+
+    for (size_t population : {1000, 10000, 100000}) {
+        std::mt19937 rng(42);
+        auto run = [&](const char* name, auto insert, auto lookup, auto remove) {
+            using Key = decltype(insert(0));
+            std::vector<Key> live;
+            std::vector<int> fds;
+            for (size_t i = 0; i < population; i++) {
+                fds.push_back(int(i));
+                live.push_back(insert(fds[i]));
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < steps; i++) {
+                size_t victim = rng() % live.size();
+                remove(live[victim]);
+                live[victim] = insert(fds[victim]); // The kernel reuses the fd
+                for (int j = 0; j < 16; j++) {
+                    sink = sink + lookup(live[rng() % live.size()]);
+                }
+            }
+            double elapsed =
+                std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            std::cout << std::left << std::setw(12) << name
+                      << std::right << std::setw(10) << population
+                      << std::setw(12) << std::fixed << std::setprecision(1)
+                      << elapsed * 1e9 / steps << "\n";
+        };
+
+        Slab<Record> slab;
+        run("slab",
+            [&](int fd) { return slab.emplace(fd); },
+            [&](SlabId id) { return size_t(slab.get(id)->fd); },
+            [&](SlabId id) { slab.erase(id); });
+
+        std::unordered_map<int, std::unique_ptr<Record>> map;
+        run("hash map",
+            [&](int fd) { map[fd] = std::make_unique<Record>(fd); return fd; },
+            [&](int fd) { return size_t(map.find(fd)->second->fd); },
+            [&](int fd) { map.erase(fd); });
+    }
+    return 0;
+}
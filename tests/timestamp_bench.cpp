@@ -0,0 +1,184 @@
+/*
+ * MIT License
+ * Benchmark: cached timestamp formatting vs time() + gmtime() + strftime()
+ *
+ * Checks the cached text against strftime across minute, day, year and
+ * leap-day boundaries and at every precision, checks that parse_epoch_ms
+ * reads it back and rejects anything else, then times formatting the
+ * current time and formatting a stream of message timestamps.
+ */
+
+#include "common.h"
+#include "timestamp.h"
+#include "wire_protocol.h"
+#include <iostream>
+#include <iomanip>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+static volatile size_t sink = 0;
+
+// What get_timestamp() did before the cache
+static std::string uncached_timestamp() {
+    time_t now = time(nullptr);
+    char buf[MAX_TIMESTAMP_LEN];
+    strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", gmtime(&now));
+    return std::string(buf);
+}
+
+static std::string expected(uint64_t us, timestamp::Precision precision) {
+    time_t seconds = time_t(us / 1000000);
+    tm parts;
+    gmtime_r(&seconds, &parts);
+    char buf[64];
+    size_t n = strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &parts);
+    if (precision == timestamp::Precision::MILLIS) {
+        n += snprintf(buf + n, sizeof(buf) - n, ".%03u", unsigned(us / 1000 % 1000));
+    } else if (precision == timestamp::Precision::MICROS) {
+        n += snprintf(buf + n, sizeof(buf) - n, ".%06u", unsigned(us % 1000000));
+    }
+    return std::string(buf, n);
+}
+
+static int check_timestamps() {
+    int failures = 0;
+    auto check = [&](uint64_t us, timestamp::Precision precision) {
+        char out[timestamp::TEXT_SIZE];
+        size_t n = timestamp::format_us(us, out, precision);
+        if (std::string(out, n) != expected(us, precision) || out[n] != '\0') {
+            std::cout << "FAIL: " << us << " formatted as " << std::string(out, n)
+                      << ", expected " << expected(us, precision) << "\n";
+            failures++;
+        }
+    };
+    const timestamp::Precision precisions[] = {
+        timestamp::Precision::SECONDS, timestamp::Precision::MILLIS, timestamp::Precision::MICROS};
+
+    // Across boundaries, forwards and backwards, so the cache is both
+    // reused and replaced
+    const uint64_t edges[] = {
+        946684800,    // 2000-01-01T00:00:00
+        951782399,    // 2000-02-28T23:59:59, before a leap day
+        1709251199,   // 2024-02-29T23:59:59
+        1735689599,   // 2024-12-31T23:59:59
+        4102444799,   // 2099-12-31T23:59:59
+    };
+    for (uint64_t edge : edges) {
+        for (int step : {-2, -1, 0, 1, 2, 61, -61}) {
+            for (timestamp::Precision precision : precisions) {
+                uint64_t seconds = uint64_t(int64_t(edge) + step);
+                check(seconds * 1000000 + 999999, precision);
+                check(seconds * 1000000, precision);
+            }
+        }
+    }
+
+    std::mt19937_64 rng(42);
+    for (int i = 0; i < 200000; i++) {
+        uint64_t us = rng() % 4102444800000000ull;
+        check(us, precisions[i % 3]);
+    }
+
+    // Parsing reads every precision back, to the millisecond
+    for (uint64_t edge : edges) {
+        for (timestamp::Precision precision : precisions) {
+            uint64_t ms = edge * 1000 + 678;
+            char out[timestamp::TEXT_SIZE];
+            std::string text(out, timestamp::format_ms(ms, out, precision));
+            uint64_t want = precision == timestamp::Precision::SECONDS ? edge * 1000 : ms;
+            for (const std::string& written : {text, text + "Z"}) {
+                if (parse_epoch_ms(written) != want) {
+                    std::cout << "FAIL: " << written << " parsed as " << parse_epoch_ms(written)
+                              << ", expected " << want << "\n";
+                    failures++;
+                }
+            }
+        }
+    }
+    for (const char* bad : {"2024-01-01T00:00:00Zjunk", "2024-01-01T00:00:00junk",
+                            "2024-01-01T00:00:00.", "2024-01-01T00:00:00.5x",
+                            "2024-01-01T00:00:00ZZ", "2024-01-01T00:00:00 ", "2024-01-01", "t",
+                            ""}) {
+        if (parse_epoch_ms(bad) != 0) {
+            std::cout << "FAIL: \"" << bad << "\" parsed as " << parse_epoch_ms(bad) << "\n";
+            failures++;
+        }
+    }
+
+    // Each thread has its own cache
+    std::vector<std::thread> threads;
+    std::atomic<int> thread_failures{0};
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&, t] {
+            char out[timestamp::TEXT_SIZE];
+            for (uint64_t s = 0; s < 100000; s++) {
+                uint64_t us = (1700000000 + s * (t + 1) * 7) * 1000000;
+                size_t n = timestamp::format_us(us, out);
+                if (std::string(out, n) != expected(us, timestamp::Precision::SECONDS)) {
+                    thread_failures++;
+                }
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    if (thread_failures > 0) {
+        std::cout << "FAIL: " << thread_failures << " mismatches across threads\n";
+        failures++;
+    }
+
+    std::cout << (failures == 0 ? "All timestamp checks passed\n" : "Timestamp checks FAILED\n");
+    return failures;
+}
+
+template <typename Fn>
+static void run_case(const char* name, size_t count, Fn fn) {
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; i++) {
+        sink = sink + fn(i);
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << std::left << std::setw(28) << name
+              << std::right << std::setw(12) << std::fixed << std::setprecision(1)
+              << elapsed * 1e9 / count << "\n";
+}
+
+int main(int argc, char* argv[]) {
+    size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 5000000;
+    if (check_timestamps() != 0) {
+        return 1;
+    }
+
+    std::cout << "\nTimestamp benchmark (" << count << " calls per case)\n";
+    std::cout << std::left << std::setw(28) << "case"
+              << std::right << std::setw(12) << "ns/call" << "\n";
+
+    char out[MAX_TIMESTAMP_LEN];
+    run_case("now, uncached string", count, [](size_t) { return uncached_timestamp().size(); });
+    run_case("now, get_timestamp()", count, [](size_t) { return get_timestamp().size(); });
+    run_case("now, into a buffer", count, [&](size_t) { return get_timestamp(out); });
+    run_case("now, milliseconds", count, [&](size_t) {
+        return timestamp::format_now(out, timestamp::Precision::MILLIS);
+    });
+    run_case("now, raw epoch ms", count, [](size_t) { return size_t(timestamp::epoch_ms()); });
+
+    // Message timestamps a millisecond apart, as the server formats them
+    uint64_t base = timestamp::epoch_ms();
+    run_case("message time, strftime", count, [&](size_t i) {
+        time_t seconds = time_t((base + i) / 1000);
+        tm parts;
+        gmtime_r(&seconds, &parts);
+        return strftime(out, sizeof(out), "%Y-%m-%dT%H:%M:%S", &parts);
+    });
+    run_case("message time, cached", count, [&](size_t i) {
+        return timestamp::format_ms(base + i, out);
+    });
+    return 0;
+}
@@ -0,0 +1,102 @@
+/*
+ * MIT License
+ * Microbenchmark: JSON vs binary wire encoding and decoding
+ */
+
+#include "common.h"
+#include "json_scan.h"
+#include "wire_protocol.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+static volatile size_t sink = 0; // Keeps results observable
+
+template <typename Fn>
+static void run_case(const char* name, size_t text_size, size_t count, size_t frame_bytes, Fn fn) {
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; i++) {
+        sink = sink + fn();
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << std::left << std::setw(16) << name
+              << std::right << std::setw(8) << text_size
+              << std::setw(10) << frame_bytes
+              << std::setw(12) << std::fixed << std::setprecision(1) << elapsed * 1e9 / count
+              << std::setw(12) << std::setprecision(2) << count / elapsed / 1e6
+              << std::setw(12) << std::setprecision(1)
+              << double(frame_bytes) * count / elapsed / 1e6 << "\n";
+}
+
+int main(int argc, char* argv[]) {
+    size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+    const std::string user = "alice";
+    const std::string time = "2024-01-02T03:04:05";
+    auto scanner = std::make_unique<JsonScanner>();
+
+    std::cout << "Wire format benchmark (" << count << " messages per case)\n";
+    std::cout << std::left << std::setw(16) << "case"
+              << std::right << std::setw(8) << "text"
+              << std::setw(10) << "bytes"
+              << std::setw(12) << "ns/msg"
+              << std::setw(12) << "Mmsg/s"
+              << std::setw(12) << "MB/s" << "\n";
+
+    for (size_t size : {16, 80, 400}) {
+        std::string text(size, 'x');
+        text[size / 2] = '"'; // Something that needs escaping
+
+        // JSON encode, as the server builds frames for translated messages
+        std::string json;
+        auto json_encode = [&] {
+            json.clear();
+            json.append("{\"user\":\"");
+            append_json_escaped(json, user);
+            json.append("\",\"time\":\"").append(time).append("\",\"text\":\"");
+            append_json_escaped(json, text);
+            json.append("\"}\n");
+            return json.size();
+        };
+        json_encode();
+        const std::string encoded_json = json;
+
+        // JSON decode: validate, then unescape the text as the server does
+        // when translating for binary clients
+        ChatFields fields;
+        std::string out_text;
+        auto json_decode = [&] {
+            scanner->parse(encoded_json, fields);
+            json_unescape(fields.text, out_text);
+            return out_text.size() + fields.user.size();
+        };
+
+        // Binary encode into a reused buffer
+        std::vector<char> frame(binary_frame_size(user, "", text));
+        uint64_t timestamp = parse_epoch_ms(time);
+        auto binary_encode = [&] {
+            return encode_binary_frame(frame.data(), BinaryType::CHAT, 7, timestamp, user, "", text);
+        };
+        binary_encode();
+
+        // Binary decode: header plus views of name, room and text
+        auto binary_decode = [&] {
+            BinaryHeader header = decode_binary_header(frame.data());
+            std::string_view payload(frame.data() + BINARY_HEADER_SIZE, header.length);
+            std::string_view name = payload.substr(0, header.name_len);
+            std::string_view room = payload.substr(header.name_len, header.room_len);
+            std::string_view body = payload.substr(header.name_len + header.room_len);
+            return name.size() + room.size() + body.size() + size_t(header.timestamp & 1);
+        };
+
+        run_case("json encode", size, count, encoded_json.size(), json_encode);
+        run_case("json decode", size, count, encoded_json.size(), json_decode);
+        run_case("binary encode", size, count, frame.size(), binary_encode);
+        run_case("binary decode", size, count, frame.size(), binary_decode);
+    }
+    return 0;
+}